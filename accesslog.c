@@ -0,0 +1,273 @@
+#include <pthread.h>
+#include <stdarg.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <time.h>
+#include "accesslog.h"
+
+// 스레드마다 링 버퍼(단일 생산자 단일 소비자) 하나를 두어 워커끼리 락을 두고 다투지 않는다
+// 생산자(워커)는 head만, 소비자(writer)는 tail만 움직이므로 락 없이 원자적 load/store만으로 충분하다
+
+// 스레드 하나의 링 크기, 2의 거듭제곱
+#ifndef LOG_RING_SIZE
+#define LOG_RING_SIZE 256
+#endif
+// writer가 링들을 비운 뒤 다시 볼 때까지
+#ifndef LOG_FLUSH_MS
+#define LOG_FLUSH_MS 50
+#endif
+#define LOG_TEXT_LEN 256
+#define LOG_CLIENT_LEN 64
+
+#define RECORD_MSG 0
+#define RECORD_ACCESS 1
+
+typedef struct
+{
+    int kind, level;
+    struct timespec ts;
+    // RECORD_ACCESS에서만 쓰는 필드
+    int status, cache;
+    long usec;
+    size_t bytes;
+    long io_syscalls; // RIO_STATS 빌드에서만, 없으면 -1
+    double io_copies;  // 입출력한 바이트당 복사한 바이트
+    char client[LOG_CLIENT_LEN];
+    char text[LOG_TEXT_LEN]; // 메시지, 접근 로그라면 요청 줄
+} log_record;
+
+typedef struct log_ring
+{
+    _Atomic unsigned long head, tail;
+    _Atomic unsigned long dropped;
+    unsigned long reported; // writer가 이미 알린 dropped
+    log_record rec[LOG_RING_SIZE];
+    struct log_ring *next;
+} log_ring;
+
+// 지금 처리 중인 요청의 접근 로그, 요청이 끝나면 링에 한 레코드로 들어간다
+typedef struct
+{
+    int active, status, cache;
+    size_t bytes;
+    long io_syscalls;
+    double io_copies;
+    unsigned long count; // 샘플링용
+    struct timespec start;
+    char client[LOG_CLIENT_LEN];
+    char line[LOG_TEXT_LEN];
+} log_request;
+
+int log_level = LOG_DEFAULT_LEVEL;
+static int log_sample = LOG_DEFAULT_SAMPLE;
+static log_ring *rings; // 등록된 모든 링, 앞에만 붙이고 빼지 않는다
+static pthread_mutex_t rings_mutex = PTHREAD_MUTEX_INITIALIZER;
+static __thread log_ring *my_ring;
+static __thread log_request cur;
+
+static const char *const level_name[] = {"ERROR", "WARN", "INFO", "DEBUG"};
+static const char *const cache_name[] = {"-", "HIT", "MISS"};
+
+// 스레드의 첫 로그에서 링을 만들어 writer에게 등록한다
+static log_ring *ring_get(void)
+{
+    log_ring *r;
+    if (my_ring != NULL)
+        return my_ring;
+    if ((r = calloc(1, sizeof(log_ring))) == NULL)
+        return NULL;
+    pthread_mutex_lock(&rings_mutex);
+    r->next = rings;
+    rings = r;
+    pthread_mutex_unlock(&rings_mutex);
+    my_ring = r;
+    return r;
+}
+
+// 채울 레코드 자리를 얻는다, 링이 가득 찼으면 NULL (버린 수만 센다)
+static log_record *ring_reserve(log_ring *r)
+{
+    unsigned long head = atomic_load_explicit(&r->head, memory_order_relaxed);
+    unsigned long tail = atomic_load_explicit(&r->tail, memory_order_acquire);
+    if (head - tail >= LOG_RING_SIZE)
+    {
+        atomic_fetch_add_explicit(&r->dropped, 1, memory_order_relaxed);
+        return NULL;
+    }
+    return &r->rec[head & (LOG_RING_SIZE - 1)];
+}
+
+// 채운 레코드를 writer에게 보인다
+static void ring_commit(log_ring *r)
+{
+    atomic_store_explicit(&r->head, atomic_load_explicit(&r->head, memory_order_relaxed) + 1, memory_order_release);
+}
+
+static void write_record(FILE *out, log_record *rec)
+{
+    struct tm tm;
+    char stamp[32];
+
+    gmtime_r(&rec->ts.tv_sec, &tm);
+    strftime(stamp, sizeof(stamp), "%Y-%m-%dT%H:%M:%S", &tm);
+    if (rec->kind == RECORD_ACCESS && rec->io_syscalls >= 0)
+        fprintf(out, "%s.%03ldZ %s %s \"%s\" %d %s %zu %ldus %ldsc %.2fcpb\n", stamp, rec->ts.tv_nsec / 1000000,
+                level_name[rec->level], rec->client, rec->text, rec->status, cache_name[rec->cache], rec->bytes, rec->usec,
+                rec->io_syscalls, rec->io_copies);
+    else if (rec->kind == RECORD_ACCESS)
+        fprintf(out, "%s.%03ldZ %s %s \"%s\" %d %s %zu %ldus\n", stamp, rec->ts.tv_nsec / 1000000, level_name[rec->level],
+                rec->client, rec->text, rec->status, cache_name[rec->cache], rec->bytes, rec->usec);
+    else
+        fprintf(out, "%s.%03ldZ %s %s\n", stamp, rec->ts.tv_nsec / 1000000, level_name[rec->level], rec->text);
+}
+
+// writer 스레드, 모든 링을 돌며 쌓인 레코드를 출력하고 잠깐 쉰다
+static void *log_writer(void *vargp)
+{
+    struct timespec pause = {LOG_FLUSH_MS / 1000, (LOG_FLUSH_MS % 1000) * 1000000L};
+    unsigned long head, tail, dropped;
+    log_ring *r;
+    int wrote;
+
+    pthread_detach(pthread_self());
+    while (1)
+    {
+        wrote = 0;
+        pthread_mutex_lock(&rings_mutex);
+        r = rings;
+        pthread_mutex_unlock(&rings_mutex);
+        for (; r != NULL; r = r->next)
+        {
+            head = atomic_load_explicit(&r->head, memory_order_acquire);
+            tail = atomic_load_explicit(&r->tail, memory_order_relaxed);
+            for (; tail != head; tail = tail + 1)
+            {
+                write_record(stdout, &r->rec[tail & (LOG_RING_SIZE - 1)]);
+                wrote = 1;
+            }
+            atomic_store_explicit(&r->tail, tail, memory_order_release);
+            dropped = atomic_load_explicit(&r->dropped, memory_order_relaxed);
+            if (dropped != r->reported)
+            {
+                fprintf(stdout, "log: dropped %lu records\n", dropped - r->reported);
+                r->reported = dropped;
+                wrote = 1;
+            }
+        }
+        if (wrote)
+            fflush(stdout);
+        else
+            nanosleep(&pause, NULL);
+    }
+    return NULL;
+}
+
+void log_init(void)
+{
+    pthread_t tid;
+    char *env;
+    int i;
+
+    if ((env = getenv("PROXY_LOG_LEVEL")) != NULL)
+        for (i = LOG_ERROR; i <= LOG_DEBUG; i = i + 1)
+            if (!strcasecmp(env, level_name[i]))
+                log_level = i;
+    if ((env = getenv("PROXY_LOG_SAMPLE")) != NULL && atoi(env) > 0)
+        log_sample = atoi(env);
+    pthread_create(&tid, NULL, log_writer, NULL);
+}
+
+void log_msg(int level, const char *fmt, ...)
+{
+    log_ring *r;
+    log_record *rec;
+    va_list ap;
+
+    if (level > log_level || (r = ring_get()) == NULL || (rec = ring_reserve(r)) == NULL)
+        return;
+    rec->kind = RECORD_MSG;
+    rec->level = level;
+    clock_gettime(CLOCK_REALTIME, &rec->ts);
+    va_start(ap, fmt);
+    vsnprintf(rec->text, LOG_TEXT_LEN, fmt, ap);
+    va_end(ap);
+    ring_commit(r);
+}
+
+// 이 스레드가 처리하는 연결의 클라이언트 주소, 이후 접근 로그에 붙는다
+void log_request_client(const char *client)
+{
+    snprintf(cur.client, LOG_CLIENT_LEN, "%s", client);
+}
+
+void log_request_begin(void)
+{
+    cur.active = 0;
+    cur.status = 0;
+    cur.cache = LOG_CACHE_NONE;
+    cur.bytes = 0;
+    cur.io_syscalls = -1;
+}
+
+// 요청 줄을 읽었을 때 불러서 이 요청을 접근 로그 대상으로 만든다
+void log_request_line(const char *method, const char *uri, const char *version)
+{
+    cur.active = 1;
+    clock_gettime(CLOCK_MONOTONIC, &cur.start);
+    snprintf(cur.line, LOG_TEXT_LEN, "%s %s %s", method, uri, version);
+}
+
+void log_request_status(int status)
+{
+    cur.status = status;
+}
+
+void log_request_cache(int cache)
+{
+    cur.cache = cache;
+}
+
+void log_request_bytes(size_t bytes)
+{
+    cur.bytes = cur.bytes + bytes;
+}
+
+// 요청 하나 동안의 시스템 콜 수, 입출력 바이트와 복사한 바이트 (RIO_STATS 빌드에서 proxy가 부른다)
+void log_request_io(unsigned long syscalls, unsigned long long bytes, unsigned long long copied)
+{
+    cur.io_syscalls = (long)syscalls;
+    cur.io_copies = bytes > 0 ? (double)copied / bytes : 0.0;
+}
+
+// 요청이 끝나면 샘플링을 거쳐 접근 로그 레코드 하나를 남긴다
+void log_request_end(void)
+{
+    struct timespec now;
+    log_ring *r;
+    log_record *rec;
+
+    if (!cur.active || LOG_INFO > log_level)
+        return;
+    cur.active = 0;
+    cur.count = cur.count + 1;
+    if (cur.status < 500 && log_sample > 1 && cur.count % log_sample != 0)
+        return;
+    if ((r = ring_get()) == NULL || (rec = ring_reserve(r)) == NULL)
+        return;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    rec->kind = RECORD_ACCESS;
+    rec->level = LOG_INFO;
+    clock_gettime(CLOCK_REALTIME, &rec->ts);
+    rec->status = cur.status;
+    rec->cache = cur.cache;
+    rec->bytes = cur.bytes;
+    rec->io_syscalls = cur.io_syscalls;
+    rec->io_copies = cur.io_copies;
+    rec->usec = (now.tv_sec - cur.start.tv_sec) * 1000000L + (now.tv_nsec - cur.start.tv_nsec) / 1000;
+    memcpy(rec->client, cur.client, LOG_CLIENT_LEN);
+    memcpy(rec->text, cur.line, LOG_TEXT_LEN);
+    ring_commit(r);
+}
@@ -0,0 +1,39 @@
+#ifndef __ACCESSLOG_H__
+#define __ACCESSLOG_H__
+
+// 비동기 로그, 워커는 자기 스레드의 링 버퍼에 레코드를 넣기만 하고 출력은 writer 스레드가 한다
+// 링이 가득 차면 워커는 기다리지 않고 레코드를 버린다 (버린 수는 writer가 나중에 알려준다)
+// csapp.h 없이도 쓸 수 있게 따로 의존하지 않는다 (listener.c)
+
+#define LOG_ERROR 0
+#define LOG_WARN 1
+#define LOG_INFO 2
+#define LOG_DEBUG 3
+
+// 레벨 기본값, 실행 시 PROXY_LOG_LEVEL(error|warn|info|debug)로 바꾼다
+#ifndef LOG_DEFAULT_LEVEL
+#define LOG_DEFAULT_LEVEL LOG_INFO
+#endif
+// 접근 로그 샘플링 기본값, N이면 요청 N개 중 하나만 남긴다 (5xx는 항상), PROXY_LOG_SAMPLE로 바꾼다
+#ifndef LOG_DEFAULT_SAMPLE
+#define LOG_DEFAULT_SAMPLE 1
+#endif
+
+#define LOG_CACHE_NONE 0
+#define LOG_CACHE_HIT 1
+#define LOG_CACHE_MISS 2
+
+extern int log_level;
+
+void log_init(void);
+void log_msg(int level, const char *fmt, ...) __attribute__((format(printf, 2, 3)));
+void log_request_client(const char *client);
+void log_request_begin(void);
+void log_request_line(const char *method, const char *uri, const char *version);
+void log_request_status(int status);
+void log_request_cache(int cache);
+void log_request_bytes(size_t bytes);
+void log_request_io(unsigned long syscalls, unsigned long long bytes, unsigned long long copied);
+void log_request_end(void);
+
+#endif /* __ACCESSLOG_H__ */
@@ -0,0 +1,265 @@
+/*
+ * cachesim - 접근 기록을 프록시의 캐시 구현에 그대로 흘려 넣는 오프라인 시뮬레이터
+ *
+ * usage: cachesim [-f trace | -g generator] [-r rate] [-S seed] [-l label] [-H]
+ *
+ * -f  한 줄에 "timestamp(초) uri size(바이트)", #로 시작하는 줄은 무시
+ * -g  합성 트레이스
+ *       zipf:requests:objects:alpha            인기도가 Zipf 분포
+ *       scan:requests:objects                  objects개를 순서대로 반복해서 훑는다
+ *       mix:requests:objects:alpha:scanfrac    Zipf에 한 번만 나오는 객체의 순차 스캔을 scanfrac 비율로 섞는다
+ * -r  합성 트레이스의 초당 요청 수 (기본 1000)
+ * -S  난수 시드 (기본 1), 같은 시드면 같은 트레이스
+ * -l  리포트 줄에 붙일 이름, -H는 머리줄도 출력
+ *
+ * 소켓 없이 proxy.c의 cache_key, cache_find, cache_uri를 그대로 부른다
+ * 캐시 크기와 교체 정책은 컴파일할 때 정해지니 설정마다 다시 빌드한다 (bench/cachesim.sh)
+ *   make bench/cachesim CACHESIM_FLAGS="-DMAX_CACHE_SIZE=... -DMAX_OBJECT_SIZE=... -DCACHE_POLICY=1"
+ *
+ * 합성 객체의 크기는 객체 번호로 정해지는 로그 정규 분포 (중앙값 8KB, 100B ~ 4MB)
+ */
+#include <math.h>
+#include "../csapp.h"
+#include "../metrics.h"
+
+#define MAX_BODY (4 << 20)
+
+// proxy.c의 함수들
+void cache_init();
+int cache_key(char *uri, char *key);
+int cache_find(char *uri, char *client_header);
+void cache_uri(char *uri, char *hdr, size_t hdrlen, char *body, size_t bodylen, char *client_header);
+void readend(int index);
+
+typedef struct
+{
+    double ts;
+    char uri[MAXLINE];
+    size_t size;
+} trace_record;
+
+#define GEN_FILE 0
+#define GEN_ZIPF 1
+#define GEN_SCAN 2
+#define GEN_MIX 3
+
+typedef struct
+{
+    int kind;
+    FILE *fp;
+    long requests, objects, produced;
+    double alpha, scanfrac, rate;
+    double *cdf; // Zipf 누적 분포
+    long scan_next;
+    uint64_t rng;
+} generator;
+
+static char body[MAX_BODY];
+
+// xorshift64*, 재현 가능한 난수
+static uint64_t rng_next(uint64_t *s)
+{
+    *s ^= *s >> 12;
+    *s ^= *s << 25;
+    *s ^= *s >> 27;
+    return *s * 2685821657736338717ULL;
+}
+
+static double rng_unit(uint64_t *s)
+{
+    return (rng_next(s) >> 11) * (1.0 / 9007199254740992.0);
+}
+
+// 객체 번호로 정해지는 크기, 같은 객체는 항상 같은 크기
+static size_t object_size(long id)
+{
+    uint64_t s = 0x9E3779B97F4A7C15ULL * (uint64_t)(id + 1);
+    double u1, u2, z, size;
+    rng_next(&s);
+    u1 = rng_unit(&s);
+    u2 = rng_unit(&s);
+    z = sqrt(-2.0 * log(u1 > 0 ? u1 : 1e-12)) * cos(2 * M_PI * u2);
+    size = exp(log(8192.0) + 1.2 * z);
+    if (size < 100)
+        size = 100;
+    if (size > MAX_BODY)
+        size = MAX_BODY;
+    return (size_t)size;
+}
+
+static void zipf_init(generator *g)
+{
+    double sum = 0;
+    long i;
+    g->cdf = Malloc(sizeof(double) * g->objects);
+    for (i = 0; i < g->objects; i = i + 1)
+    {
+        sum = sum + 1.0 / pow(i + 1, g->alpha);
+        g->cdf[i] = sum;
+    }
+    for (i = 0; i < g->objects; i = i + 1)
+        g->cdf[i] = g->cdf[i] / sum;
+}
+
+static long zipf_sample(generator *g)
+{
+    double u = rng_unit(&g->rng);
+    long lo = 0, hi = g->objects - 1, mid;
+    while (lo < hi)
+    {
+        mid = (lo + hi) / 2;
+        if (g->cdf[mid] < u)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    return lo;
+}
+
+// 다음 기록, 끝이면 0
+static int next_record(generator *g, trace_record *rec)
+{
+    char line[MAXLINE * 2];
+    long id;
+
+    if (g->kind == GEN_FILE)
+    {
+        while (fgets(line, sizeof(line), g->fp) != NULL)
+        {
+            if (line[0] == '#' || sscanf(line, "%lf %8191s %zu", &rec->ts, rec->uri, &rec->size) != 3)
+                continue;
+            if (rec->size > MAX_BODY)
+                rec->size = MAX_BODY;
+            return 1;
+        }
+        return 0;
+    }
+    if (g->produced >= g->requests)
+        return 0;
+    rec->ts = g->produced / g->rate;
+    g->produced = g->produced + 1;
+    if (g->kind == GEN_SCAN)
+        id = g->scan_next++ % g->objects;
+    else if (g->kind == GEN_MIX && rng_unit(&g->rng) < g->scanfrac)
+    {
+        // 스캔 객체는 Zipf 객체와 번호가 겹치지 않고 다시 나오지 않는다
+        id = g->objects + g->scan_next++;
+        sprintf(rec->uri, "http://origin.test/scan/%ld", id);
+        rec->size = object_size(id);
+        return 1;
+    }
+    else
+        id = zipf_sample(g);
+    sprintf(rec->uri, "http://origin.test/object/%ld", id);
+    rec->size = object_size(id);
+    return 1;
+}
+
+static void usage(char *prog)
+{
+    fprintf(stderr, "usage: %s [-f trace | -g zipf:N:objects:alpha | scan:N:objects | mix:N:objects:alpha:scanfrac] [-r rate] [-S seed] [-l label] [-H]\n", prog);
+    exit(1);
+}
+
+static void parse_generator(generator *g, char *spec)
+{
+    if (sscanf(spec, "zipf:%ld:%ld:%lf", &g->requests, &g->objects, &g->alpha) == 3)
+        g->kind = GEN_ZIPF;
+    else if (sscanf(spec, "scan:%ld:%ld", &g->requests, &g->objects) == 2)
+        g->kind = GEN_SCAN;
+    else if (sscanf(spec, "mix:%ld:%ld:%lf:%lf", &g->requests, &g->objects, &g->alpha, &g->scanfrac) == 4)
+        g->kind = GEN_MIX;
+    else
+        usage("cachesim");
+    if (g->requests <= 0 || g->objects <= 0)
+        usage("cachesim");
+    if (g->kind != GEN_SCAN)
+        zipf_init(g);
+}
+
+int main(int argc, char **argv)
+{
+    static trace_record rec;
+    generator g;
+    char key[MAXLINE], hdr[MAXLINE], *label = "-", *trace = NULL, *spec = "zipf:100000:10000:0.9";
+    long requests = 0, hits = 0, uncacheable = 0, inserts, second = -1;
+    double first_ts = -1, last_ts = 0, bytes = 0, hit_bytes = 0, origin_bytes = 0, second_bytes = 0, peak = 0, span;
+    size_t hdrlen;
+    int opt, header = 0, index;
+
+    memset(&g, 0, sizeof(g));
+    g.rate = 1000;
+    g.rng = 1;
+    while ((opt = getopt(argc, argv, "f:g:r:S:l:H")) != -1)
+    {
+        switch (opt)
+        {
+        case 'f': trace = optarg; break;
+        case 'g': spec = optarg; break;
+        case 'r': g.rate = atof(optarg); break;
+        case 'S': g.rng = strtoull(optarg, NULL, 10) | 1; break;
+        case 'l': label = optarg; break;
+        case 'H': header = 1; break;
+        default: usage(argv[0]);
+        }
+    }
+    if (trace != NULL)
+    {
+        g.kind = GEN_FILE;
+        if ((g.fp = fopen(trace, "r")) == NULL)
+            unix_error("trace open error");
+    }
+    else
+        parse_generator(&g, spec);
+    if (g.rate <= 0)
+        usage(argv[0]);
+
+    cache_init();
+    while (next_record(&g, &rec))
+    {
+        if (first_ts < 0)
+            first_ts = rec.ts;
+        last_ts = rec.ts;
+        requests = requests + 1;
+        bytes = bytes + rec.size;
+        // 키를 만들 수 없을 만큼 긴 uri는 프록시가 414로 거절하니 hit에도 origin 바이트에도 넣지 않는다
+        if (cache_key(rec.uri, key) < 0)
+            continue;
+        if ((index = cache_find(key, "")) >= 0)
+        {
+            readend(index);
+            hits = hits + 1;
+            hit_bytes = hit_bytes + rec.size;
+            continue;
+        }
+        // miss는 origin에서 받아와 캐시에 넣는다 (너무 크면 cache_uri가 넣지 않는다)
+        origin_bytes = origin_bytes + rec.size;
+        if ((long)rec.ts != second)
+        {
+            second = (long)rec.ts;
+            second_bytes = 0;
+        }
+        second_bytes = second_bytes + rec.size;
+        if (second_bytes > peak)
+            peak = second_bytes;
+        hdrlen = sprintf(hdr, "HTTP/1.0 200 OK\r\nContent-Type: application/octet-stream\r\nContent-Length: %zu\r\n\r\n", rec.size);
+        inserts = metrics_get(M_CACHE_INSERTS);
+        cache_uri(key, hdr, hdrlen, body, rec.size, "");
+        if (metrics_get(M_CACHE_INSERTS) == inserts)
+            uncacheable = uncacheable + 1;
+    }
+    if (requests == 0)
+    {
+        fprintf(stderr, "%s: empty trace\n", argv[0]);
+        exit(1);
+    }
+    span = last_ts - first_ts > 1 ? last_ts - first_ts : 1;
+
+    if (header)
+        printf("%-28s %9s %8s %8s %10s %11s %12s %12s %12s\n", "config", "requests", "obj-hit", "byte-hit", "evictions",
+                "too-large", "origin-MB", "origin-MB/s", "peak-MB/s");
+    printf("%-28s %9ld %7.2f%% %7.2f%% %10ld %11ld %12.1f %12.2f %12.2f\n", label, requests, 100.0 * hits / requests,
+            bytes > 0 ? 100.0 * hit_bytes / bytes : 0.0, metrics_get(M_CACHE_EVICTIONS), uncacheable,
+            origin_bytes / 1e6, origin_bytes / 1e6 / span, peak / 1e6);
+    return 0;
+}
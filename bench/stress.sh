@@ -0,0 +1,120 @@
+#!/bin/bash
+#
+# stress.sh - 느린 클라이언트(slowloris) 수천 개를 붙여 놓고 보통 클라이언트의 지연이 어떻게 변하는지 잰다
+#     proxy와 tiny(반복 서버)에 각각 돌려서 비교하고, 서버 프로세스의 메모리, 스레드, fd 수도 함께 출력한다
+#
+# usage: bench/stress.sh  (보통은 make stress)
+#
+# 환경 변수
+#   STRESS_SLOW_CONNS  느린 연결 수 (기본 2000)
+#   STRESS_MODE        slowloris 방식 trickle|read|mix (기본 mix)
+#   STRESS_INTERVAL    느린 연결이 한 조각을 보내거나 읽는 간격 ms (기본 1000)
+#   STRESS_CONNS       보통 클라이언트 수 (기본 8)
+#   STRESS_DURATION    측정 시간 초 (기본 10)
+#   STRESS_TIMEOUT     보통 클라이언트의 요청 타임아웃 ms (기본 2000), 넘기면 errors로 센다
+#
+
+SLOW_CONNS=${STRESS_SLOW_CONNS:-2000}
+MODE=${STRESS_MODE:-mix}
+INTERVAL=${STRESS_INTERVAL:-1000}
+CONNS=${STRESS_CONNS:-8}
+DURATION=${STRESS_DURATION:-10}
+TIMEOUT=${STRESS_TIMEOUT:-2000}
+RAMP=$(( INTERVAL / 1000 + 2 ))
+
+HOME_DIR=`cd "$(dirname "$0")/.." && pwd`
+TMP_DIR=`mktemp -d`
+
+function cleanup {
+    kill ${SLOW_PID} ${PROXY_PID} ${TINY_PID} ${SIM_PID} 2> /dev/null
+    wait 2> /dev/null
+    rm -rf ${TMP_DIR}
+}
+trap cleanup EXIT
+
+# port_in_use, free_port, wait_for_port는 run.sh와 같다
+function port_in_use {
+    netstat --numeric-ports --numeric-hosts -l --protocol=tcpip | grep -q ":$1 "
+}
+
+function free_port {
+    while [ TRUE ]
+    do
+        port=$((( RANDOM % 30000) + 20000))
+        port_in_use ${port} || { echo ${port}; return; }
+    done
+}
+
+function wait_for_port {
+    for i in `seq 50`
+    do
+        port_in_use $1 && return 0
+        sleep 0.1
+    done
+    echo "Error: port $1 did not open"
+    exit 1
+}
+
+# usage - 프로세스의 RSS, 스레드 수, 열린 fd 수
+function usage_of {
+    rss=`awk '/^VmRSS/ { print $2 }' /proc/$1/status 2> /dev/null`
+    threads=`awk '/^Threads/ { print $2 }' /proc/$1/status 2> /dev/null`
+    fds=`ls /proc/$1/fd 2> /dev/null | wc -l`
+    echo "rss ${rss:-?} kB, threads ${threads:-?}, fds ${fds}"
+}
+
+# run_target name pid host:port urlfile slow-url [loadgen/slowloris 추가 옵션]
+function run_target {
+    name=$1; pid=$2; addr=$3; urlfile=$4; slowurl=$5; extra=$6
+
+    echo "== ${name}: idle $(usage_of ${pid})"
+    ./bench/loadgen -s ${addr} -f ${urlfile} -c ${CONNS} -d ${DURATION} -t ${TIMEOUT} ${extra} -l "${name}" -H
+
+    ./bench/slowloris -s ${addr} -u ${slowurl} -c ${SLOW_CONNS} -m ${MODE} -i ${INTERVAL} -d $(( DURATION + RAMP + 5 )) ${extra} \
+        > ${TMP_DIR}/slowloris.out &
+    SLOW_PID=$!
+    sleep ${RAMP}
+    echo "== ${name}: under ${SLOW_CONNS} slow clients $(usage_of ${pid})"
+    ./bench/loadgen -s ${addr} -f ${urlfile} -c ${CONNS} -d ${DURATION} -t ${TIMEOUT} ${extra} -l "${name}+slow"
+    echo "== ${name}: after $(usage_of ${pid})"
+    kill -INT ${SLOW_PID}
+    wait ${SLOW_PID}
+    SLOW_PID=
+    cat ${TMP_DIR}/slowloris.out
+    echo
+}
+
+cd ${HOME_DIR}
+if [ ! -x ./proxy ] || [ ! -x ./bench/loadgen ] || [ ! -x ./bench/originsim ] || [ ! -x ./bench/slowloris ] || [ ! -x ./tiny/tiny ]
+then
+    echo "Error: build proxy, bench/loadgen, bench/originsim, bench/slowloris and tiny/tiny first (make stress)"
+    exit 1
+fi
+
+TINY_PORT=`free_port`
+(cd ./tiny; exec ./tiny ${TINY_PORT} > /dev/null 2>&1) &
+TINY_PID=$!
+wait_for_port ${TINY_PORT}
+SIM_PORT=`free_port`
+./bench/originsim -p ${SIM_PORT} -l 2 -z 8192 2> /dev/null &
+SIM_PID=$!
+wait_for_port ${SIM_PORT}
+PROXY_PORT=`free_port`
+./proxy ${PROXY_PORT} > /dev/null 2>&1 &
+PROXY_PID=$!
+wait_for_port ${PROXY_PORT}
+
+TINY="http://localhost:${TINY_PORT}"
+SIM="http://localhost:${SIM_PORT}"
+# 프록시로는 캐시 히트와 매번 미스를 섞고, 느린 클라이언트는 큰 응답을 받는다
+cat > ${TMP_DIR}/proxy-urls <<END
+${TINY}/home.html
+${SIM}/obj/{n}
+END
+cat > ${TMP_DIR}/tiny-urls <<END
+${TINY}/home.html
+END
+
+echo "${SLOW_CONNS} slow clients (${MODE}, every ${INTERVAL} ms), ${CONNS} normal clients, ${DURATION}s, timeout ${TIMEOUT} ms, latency in us"
+run_target proxy ${PROXY_PID} localhost:${PROXY_PORT} ${TMP_DIR}/proxy-urls "${SIM}/big?size=1048576&cc=no-store"
+run_target tiny ${TINY_PID} localhost:${TINY_PORT} ${TMP_DIR}/tiny-urls "${TINY}/godzilla.jpg" -O
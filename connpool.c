@@ -0,0 +1,138 @@
+#include <poll.h>
+#include "connpool.h"
+
+// origin("host:port")별로 keep-alive 상태로 남은 연결을 보관해두는 풀
+// 캐시 미스마다 새로 TCP 핸드셰이크를 하지 않고 응답을 끝까지 읽은 연결을 다시 쓴다
+
+// 풀 전체에 보관할 최대 연결 수
+#ifndef POOL_MAX_IDLE
+#define POOL_MAX_IDLE 64
+#endif
+// origin 하나당 보관할 최대 연결 수
+#ifndef POOL_MAX_IDLE_PER_ORIGIN
+#define POOL_MAX_IDLE_PER_ORIGIN 8
+#endif
+// 이보다 오래 놀던 연결은 origin이 이미 닫았을 가능성이 높으니 버린다
+#ifndef POOL_IDLE_TIMEOUT
+#define POOL_IDLE_TIMEOUT 30 // 초
+#endif
+#define POOL_KEYLEN 300
+
+typedef struct
+{
+    char origin[POOL_KEYLEN]; // 빈 문자열이면 빈 칸
+    int fd;
+    time_t idle_since;
+} pool_slot;
+
+static pool_slot pool[POOL_MAX_IDLE];
+static sem_t pool_mutex;
+
+static time_t monotonic_sec(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec;
+}
+
+// idle 시간을 재는 시계, 테스트에서 가짜 시계로 바꿔 끼울 수 있다
+static time_t (*clock_fn)(void) = monotonic_sec;
+
+static time_t now_sec(void)
+{
+    return clock_fn();
+}
+
+void connpool_init(void)
+{
+    memset(pool, 0, sizeof(pool));
+    Sem_init(&pool_mutex, 0, 1);
+}
+
+// 테스트에서 idle 만료를 기다리지 않고 확인할 수 있도록, NULL이면 원래 시계로 돌아간다
+void connpool_set_clock(time_t (*fn)(void))
+{
+    clock_fn = fn != NULL ? fn : monotonic_sec;
+}
+
+// 놀고 있는 연결에 읽을 것이 있다면 origin이 닫았거나(EOF) 프로토콜이 어긋난 것
+static int conn_alive(int fd)
+{
+    struct pollfd pfd;
+    pfd.fd = fd;
+    pfd.events = POLLIN;
+    return poll(&pfd, 1, 0) == 0;
+}
+
+// origin으로 가는 쓸 수 있는 연결을 꺼낸다, 없으면 -1
+// 가장 최근에 반납된 연결부터 쓰고, 타임아웃됐거나 닫힌 연결은 정리한다
+int connpool_get(const char *origin)
+{
+    time_t now = now_sec();
+    int i, best, fd;
+
+    P(&pool_mutex);
+    while (1)
+    {
+        best = -1;
+        for (i = 0; i < POOL_MAX_IDLE; i = i + 1)
+        {
+            if (pool[i].origin[0] == '\0')
+                continue;
+            if (now - pool[i].idle_since > POOL_IDLE_TIMEOUT)
+            {
+                close(pool[i].fd);
+                pool[i].origin[0] = '\0';
+                continue;
+            }
+            if (!strcmp(pool[i].origin, origin) && (best < 0 || pool[i].idle_since > pool[best].idle_since))
+                best = i;
+        }
+        if (best < 0)
+        {
+            V(&pool_mutex);
+            return -1;
+        }
+        fd = pool[best].fd;
+        pool[best].origin[0] = '\0';
+        if (conn_alive(fd))
+            break;
+        close(fd);
+    }
+    V(&pool_mutex);
+    return fd;
+}
+
+// 응답을 끝까지 읽어 재사용할 수 있는 연결을 반납한다
+// origin당 한도를 넘으면 닫고, 풀이 가득 차면 가장 오래 놀던 연결을 닫고 자리를 만든다
+void connpool_put(const char *origin, int fd)
+{
+    int i, target = -1, count = 0;
+
+    P(&pool_mutex);
+    for (i = 0; i < POOL_MAX_IDLE; i = i + 1)
+    {
+        if (pool[i].origin[0] == '\0')
+        {
+            if (target < 0 || pool[target].origin[0] != '\0')
+                target = i;
+            continue;
+        }
+        if (!strcmp(pool[i].origin, origin))
+            count = count + 1;
+        if (target < 0 || (pool[target].origin[0] != '\0' && pool[i].idle_since < pool[target].idle_since))
+            target = i;
+    }
+    if (count >= POOL_MAX_IDLE_PER_ORIGIN || strlen(origin) >= POOL_KEYLEN)
+    {
+        V(&pool_mutex);
+        close(fd);
+        return;
+    }
+    if (pool[target].origin[0] != '\0')
+        close(pool[target].fd);
+    strcpy(pool[target].origin, origin);
+    pool[target].fd = fd;
+    pool[target].idle_since = now_sec();
+    V(&pool_mutex);
+}
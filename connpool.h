@@ -0,0 +1,11 @@
+#ifndef __CONNPOOL_H__
+#define __CONNPOOL_H__
+
+#include "csapp.h"
+
+void connpool_init(void);
+int connpool_get(const char *origin);
+void connpool_put(const char *origin, int fd);
+void connpool_set_clock(time_t (*fn)(void));
+
+#endif /* __CONNPOOL_H__ */
@@ -742,6 +742,10 @@ void V(sem_t *sem)
  * The Rio package - Robust I/O functions
  ****************************************/
 
+#if RIO_STATS
+__thread rio_stats_t rio_stats;
+#endif
+
 /*
  * rio_readn - Robustly read n bytes (unbuffered)
  */
@@ -753,7 +757,13 @@ ssize_t rio_readn(int fd, void *usrbuf, size_t n)
     char *bufp = usrbuf;
 
     while (nleft > 0) {
-	if ((nread = read(fd, bufp, nleft)) < 0) {
+	nread = read(fd, bufp, nleft);
+	RIO_STAT(syscalls, 1);
+	if (nread > 0) {
+	    RIO_STAT(read_bytes, nread);
+	    RIO_STAT(short_reads, (size_t)nread < nleft);
+	}
+	if (nread < 0) {
 	    if (errno == EINTR) /* Interrupted by sig handler return */
 		nread = 0;      /* and call read() again */
 	    else
@@ -779,7 +789,13 @@ ssize_t rio_writen(int fd, void *usrbuf, size_t n)
     char *bufp = usrbuf;
 
     while (nleft > 0) {
-	if ((nwritten = write(fd, bufp, nleft)) <= 0) {
+	nwritten = write(fd, bufp, nleft);
+	RIO_STAT(syscalls, 1);
+	if (nwritten > 0) {
+	    RIO_STAT(write_bytes, nwritten);
+	    RIO_STAT(short_writes, (size_t)nwritten < nleft);
+	}
+	if (nwritten <= 0) {
 	    if (errno == EINTR)  /* Interrupted by sig handler return */
 		nwritten = 0;    /* and call write() again */
 	    else
@@ -809,6 +825,11 @@ static ssize_t rio_read(rio_t *rp, char *usrbuf, size_t n)
     while (rp->rio_cnt <= 0) {  /* Refill if buf is empty */
 	rp->rio_cnt = read(rp->rio_fd, rp->rio_buf, 
 			   sizeof(rp->rio_buf));
+	RIO_STAT(syscalls, 1);
+	if (rp->rio_cnt > 0) {
+	    RIO_STAT(read_bytes, rp->rio_cnt);
+	    RIO_STAT(short_reads, rp->rio_cnt < (int)sizeof(rp->rio_buf));
+	}
 	if (rp->rio_cnt < 0) {
 	    if (errno != EINTR) /* Interrupted by sig handler return */
 		return -1;
@@ -824,6 +845,7 @@ static ssize_t rio_read(rio_t *rp, char *usrbuf, size_t n)
     if (rp->rio_cnt < n)   
 	cnt = rp->rio_cnt;
     memcpy(usrbuf, rp->rio_bufptr, cnt);
+    RIO_STAT_COPY(cnt);
     rp->rio_bufptr += cnt;
     rp->rio_cnt -= cnt;
     return cnt;
@@ -51,6 +51,31 @@ typedef struct {
 } rio_t;
 /* $end rio_t */
 
+/*
+ * Rio 계측, -DRIO_STATS=1로 빌드하면 스레드마다 시스템 콜, 바이트, 짧은 읽기/쓰기와
+ * 사용자 공간 복사를 센다 (연결 하나는 스레드 하나가 맡으니 요청 전후의 차이가 그 요청의 몫)
+ * 꺼져 있으면 RIO_STAT은 아무 코드도 만들지 않는다
+ */
+#ifndef RIO_STATS
+#define RIO_STATS 0
+#endif
+
+typedef struct {
+    unsigned long syscalls;        /* read()/write() 호출 (EINTR 포함) */
+    unsigned long short_reads;     /* 요청보다 적게 돌려준 read(), EOF 제외 */
+    unsigned long short_writes;    /* 요청보다 적게 쓴 write() */
+    unsigned long copies;          /* 사용자 공간 memcpy 호출 */
+    unsigned long long read_bytes, write_bytes, copy_bytes;
+} rio_stats_t;
+
+#if RIO_STATS
+extern __thread rio_stats_t rio_stats;
+#define RIO_STAT(field, n) (rio_stats.field += (n))
+#else
+#define RIO_STAT(field, n) ((void)0)
+#endif
+#define RIO_STAT_COPY(n) (RIO_STAT(copies, 1), RIO_STAT(copy_bytes, (n)))
+
 /* External variables */
 extern int h_errno;    /* Defined by BIND for DNS errors */ 
 extern char **environ; /* Defined by libc */
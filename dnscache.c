@@ -0,0 +1,396 @@
+#include "dnscache.h"
+#include "resolver.h"
+#include "nbconnect.h"
+#include "latency.h"
+
+// 캐시 미스마다 open_clientfd가 getaddrinfo를 부르지 않도록 이름 해석 결과를 기억하는 캐시
+// 키(host:port)의 해시로 샤드를 고르고, 샤드마다 세마포어 하나로 보호해서 스레드 간 경합을 나눈다
+// 성공(positive)과 이름이 없다는 확답(negative)을 TTL 동안 기억하고 (일시적인 실패는 기억하지 않는다),
+// 만료가 가까운 엔트리가 조회되면 백그라운드에서 미리 다시 풀어둔다
+// 실제 이름 해석은 resolver.c의 전용 스레드 풀이 맡는다
+
+// getaddrinfo는 TTL을 알려주지 않으니 리졸버가 TTL을 모르면 이 값을 쓴다
+#ifndef DNS_CACHE_TTL
+#define DNS_CACHE_TTL 60 // 초
+#endif
+// 이름이 없다는 확답(EAI_NONAME, EAI_NODATA)을 기억하는 시간
+#ifndef DNS_NEG_TTL
+#define DNS_NEG_TTL 5 // 초
+#endif
+// 만료까지 이만큼 남은 엔트리가 조회되면 백그라운드 갱신 시작
+#ifndef DNS_REFRESH_AHEAD
+#define DNS_REFRESH_AHEAD 10 // 초
+#endif
+#ifndef RESOLVER_THREADS
+#define RESOLVER_THREADS 4
+#endif
+#define DNS_SHARDS 16
+#define DNS_SHARD_SLOTS 16
+#define DNS_KEYLEN 300
+
+typedef struct
+{
+    char key[DNS_KEYLEN]; // "host:port", 빈 문자열이면 빈 칸
+    int status; // 0이면 answer가 유효, 아니면 EAI_* 에러코드
+    dns_answer answer;
+    time_t expire;
+    time_t last_used;
+    int refreshing;
+} dns_entry;
+
+typedef struct
+{
+    sem_t mutex;
+    dns_entry entry[DNS_SHARD_SLOTS];
+} dns_shard;
+
+static dns_shard shards[DNS_SHARDS];
+static dns_resolver_fn resolver = dns_getaddrinfo_resolver;
+
+typedef struct
+{
+    char host[NI_MAXHOST];
+    dns_addr addr;
+} hosts_entry;
+
+// dnscache_load_hosts로 읽어둔 hosts 파일 내용 (테스트용 리졸버가 사용)
+static hosts_entry *hosts;
+static int hosts_num;
+
+static time_t monotonic_sec(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec;
+}
+
+// TTL 판단에 쓰는 시계, 테스트에서 가짜 시계로 바꿔 끼울 수 있다
+static time_t (*clock_fn)(void) = monotonic_sec;
+
+static time_t now_sec(void)
+{
+    return clock_fn();
+}
+
+// FNV-1a
+static unsigned int key_hash(const char *key)
+{
+    unsigned int h = 2166136261u;
+    for (; *key; key = key + 1)
+        h = (h ^ (unsigned char)*key) * 16777619u;
+    return h;
+}
+
+static dns_shard *key_shard(const char *key)
+{
+    return &shards[key_hash(key) % DNS_SHARDS];
+}
+
+static void make_key(char *key, const char *host, const char *port)
+{
+    int i;
+    snprintf(key, DNS_KEYLEN, "%s:%s", host, port);
+    for (i = 0; key[i]; i = i + 1)
+        key[i] = tolower(key[i]);
+}
+
+void dnscache_init(void)
+{
+    int i;
+    memset(shards, 0, sizeof(shards));
+    for (i = 0; i < DNS_SHARDS; i = i + 1)
+        Sem_init(&shards[i].mutex, 0, 1);
+    resolver_init(RESOLVER_THREADS);
+}
+
+// 테스트에서 로컬 리졸버로 바꿔 끼울 수 있도록
+void dnscache_set_resolver(dns_resolver_fn fn)
+{
+    resolver = fn;
+}
+
+// 테스트에서 TTL과 갱신 시점을 기다리지 않고 확인할 수 있도록, NULL이면 원래 시계로 돌아간다
+void dnscache_set_clock(time_t (*fn)(void))
+{
+    clock_fn = fn != NULL ? fn : monotonic_sec;
+}
+
+// 기본 리졸버, open_clientfd와 같은 hints로 getaddrinfo를 부른다
+int dns_getaddrinfo_resolver(const char *host, const char *port, dns_answer *answer)
+{
+    struct addrinfo hints, *listp, *p;
+    int rc;
+
+    memset(&hints, 0, sizeof(struct addrinfo));
+    hints.ai_socktype = SOCK_STREAM;
+    hints.ai_flags = AI_NUMERICSERV | AI_ADDRCONFIG;
+    if ((rc = getaddrinfo(host, port, &hints, &listp)) != 0)
+        return rc;
+    answer->naddr = 0;
+    answer->ttl = DNS_CACHE_TTL;
+    for (p = listp; p && answer->naddr < DNS_MAX_ADDRS; p = p->ai_next)
+    {
+        dns_addr *a = &answer->addr[answer->naddr];
+        a->family = p->ai_family;
+        a->socktype = p->ai_socktype;
+        a->protocol = p->ai_protocol;
+        a->addrlen = p->ai_addrlen;
+        memcpy(&a->addr, p->ai_addr, p->ai_addrlen);
+        answer->naddr = answer->naddr + 1;
+    }
+    freeaddrinfo(listp);
+    return answer->naddr ? 0 : EAI_NONAME;
+}
+
+// "주소 이름 [이름...]" 형식의 hosts 파일을 읽는다, 성공하면 읽은 엔트리 수
+// 읽은 뒤 dnscache_set_resolver(dns_hosts_resolver)로 쓰면 실제 DNS 없이 테스트할 수 있다
+int dnscache_load_hosts(const char *path)
+{
+    FILE *fp;
+    char line[MAXLINE], *tok, *saveptr, addrstr[INET6_ADDRSTRLEN];
+    dns_addr addr;
+    int cap = 0;
+
+    if ((fp = fopen(path, "r")) == NULL)
+        return -1;
+    while (fgets(line, MAXLINE, fp) != NULL)
+    {
+        line[strcspn(line, "#\n")] = '\0';
+        if ((tok = strtok_r(line, " \t", &saveptr)) == NULL)
+            continue;
+        snprintf(addrstr, sizeof(addrstr), "%s", tok);
+        memset(&addr, 0, sizeof(addr));
+        addr.socktype = SOCK_STREAM;
+        addr.protocol = IPPROTO_TCP;
+        if (inet_pton(AF_INET, addrstr, &((struct sockaddr_in *)&addr.addr)->sin_addr) == 1)
+        {
+            addr.family = AF_INET;
+            addr.addrlen = sizeof(struct sockaddr_in);
+        }
+        else if (inet_pton(AF_INET6, addrstr, &((struct sockaddr_in6 *)&addr.addr)->sin6_addr) == 1)
+        {
+            addr.family = AF_INET6;
+            addr.addrlen = sizeof(struct sockaddr_in6);
+        }
+        else
+            continue;
+        addr.addr.ss_family = addr.family;
+        while ((tok = strtok_r(NULL, " \t", &saveptr)) != NULL)
+        {
+            if (hosts_num == cap)
+            {
+                cap = cap ? cap * 2 : 16;
+                hosts = Realloc(hosts, cap * sizeof(hosts_entry));
+            }
+            snprintf(hosts[hosts_num].host, NI_MAXHOST, "%s", tok);
+            hosts[hosts_num].addr = addr;
+            hosts_num = hosts_num + 1;
+        }
+    }
+    fclose(fp);
+    return hosts_num;
+}
+
+// hosts 파일에 있는 이름만 푸는 리졸버, 없는 이름은 NXDOMAIN처럼 EAI_NONAME
+int dns_hosts_resolver(const char *host, const char *port, dns_answer *answer)
+{
+    int i;
+    unsigned short nport = htons(atoi(port));
+    answer->naddr = 0;
+    answer->ttl = DNS_CACHE_TTL;
+    for (i = 0; i < hosts_num && answer->naddr < DNS_MAX_ADDRS; i = i + 1)
+    {
+        if (strcasecmp(hosts[i].host, host))
+            continue;
+        dns_addr *a = &answer->addr[answer->naddr];
+        *a = hosts[i].addr;
+        if (a->family == AF_INET)
+            ((struct sockaddr_in *)&a->addr)->sin_port = nport;
+        else
+            ((struct sockaddr_in6 *)&a->addr)->sin6_port = nport;
+        answer->naddr = answer->naddr + 1;
+    }
+    return answer->naddr ? 0 : EAI_NONAME;
+}
+
+// negative 엔트리로 기억해도 되는 실패인지
+// EAI_AGAIN(타임아웃, SERVFAIL), EAI_FAIL, EAI_SYSTEM 같은 일시적인 실패로 이름을 막아두지 않도록 확답만 고른다
+static int dns_definite_failure(int status)
+{
+    if (status == EAI_NONAME)
+        return 1;
+#ifdef EAI_NODATA
+    if (status == EAI_NODATA)
+        return 1;
+#endif
+    return 0;
+}
+
+// 리졸버 결과를 샤드에 기록, 같은 키가 있으면 덮어쓰고 없으면 빈 칸이나 가장 오래 안 쓴 칸을 쓴다
+static void dns_store(const char *key, int status, dns_answer *answer)
+{
+    dns_shard *shard = key_shard(key);
+    time_t now = now_sec();
+    int i, target = 0;
+
+    P(&shard->mutex);
+    for (i = 0; i < DNS_SHARD_SLOTS; i = i + 1)
+    {
+        if (!strcmp(shard->entry[i].key, key) || shard->entry[i].key[0] == '\0')
+        {
+            target = i;
+            break;
+        }
+        if (shard->entry[i].last_used < shard->entry[target].last_used)
+            target = i;
+    }
+    dns_entry *e = &shard->entry[target];
+    // 백그라운드 갱신이 실패했다면 만료 전까지는 기존 주소를 계속 쓴다
+    if (status != 0 && !strcmp(e->key, key) && e->status == 0 && e->expire > now)
+    {
+        e->refreshing = 0;
+        V(&shard->mutex);
+        return;
+    }
+    // 일시적인 실패는 기록하지 않고 다음 조회가 리졸버를 다시 부르게 한다
+    if (status != 0 && !dns_definite_failure(status))
+    {
+        if (!strcmp(e->key, key))
+            e->refreshing = 0;
+        V(&shard->mutex);
+        return;
+    }
+    strcpy(e->key, key);
+    e->status = status;
+    if (status == 0)
+    {
+        e->answer = *answer;
+        e->expire = now + (answer->ttl > 0 ? answer->ttl : DNS_CACHE_TTL);
+    }
+    else
+        e->expire = now + DNS_NEG_TTL;
+    e->last_used = now;
+    e->refreshing = 0;
+    V(&shard->mutex);
+}
+
+// 백그라운드 갱신 완료 콜백, arg는 Malloc한 키
+static void dns_refresh_done(int status, dns_answer *answer, void *arg)
+{
+    dns_store(arg, status, answer);
+    Free(arg);
+}
+
+// 캐시 미스로 기다리는 워커와 완료 콜백이 함께 쓰는 구조체
+// 워커가 타임아웃으로 먼저 떠날 수 있으니 refcnt로 마지막에 놓는 쪽이 Free
+typedef struct
+{
+    char key[DNS_KEYLEN];
+    sem_t done;
+    int refcnt;
+    int status;
+    dns_answer answer;
+} dns_lookup_wait;
+
+static void dns_wait_release(dns_lookup_wait *w)
+{
+    if (__atomic_sub_fetch(&w->refcnt, 1, __ATOMIC_ACQ_REL) == 0)
+    {
+        sem_destroy(&w->done);
+        Free(w);
+    }
+}
+
+static void dns_lookup_done(int status, dns_answer *answer, void *arg)
+{
+    dns_lookup_wait *w = arg;
+    dns_store(w->key, status, answer);
+    w->status = status;
+    w->answer = *answer;
+    V(&w->done);
+    dns_wait_release(w);
+}
+
+// host:port를 풀어 answer에 사본을 채운다, 성공하면 0 실패하면 EAI_* 에러코드
+// 캐시에 살아있는 엔트리가 있으면 리졸버를 부르지 않는다
+int dnscache_lookup(const char *host, const char *port, dns_answer *answer)
+{
+    char key[DNS_KEYLEN];
+    dns_shard *shard;
+    dns_lookup_wait *w;
+    struct timespec deadline;
+    char *refresh = NULL;
+    time_t now = now_sec();
+    int i, rc;
+
+    make_key(key, host, port);
+    shard = key_shard(key);
+    P(&shard->mutex);
+    for (i = 0; i < DNS_SHARD_SLOTS; i = i + 1)
+    {
+        dns_entry *e = &shard->entry[i];
+        if (e->expire <= now || strcmp(e->key, key))
+            continue;
+        e->last_used = now;
+        rc = e->status;
+        if (rc == 0)
+        {
+            *answer = e->answer;
+            // 곧 만료될 엔트리라면 다음 요청이 리졸버를 기다리지 않도록 미리 갱신
+            if (e->expire - now <= DNS_REFRESH_AHEAD && !e->refreshing)
+            {
+                e->refreshing = 1;
+                refresh = Malloc(DNS_KEYLEN);
+                strcpy(refresh, key);
+            }
+        }
+        V(&shard->mutex);
+        if (refresh != NULL)
+            resolver_submit(host, port, resolver, dns_refresh_done, refresh);
+        return rc;
+    }
+    V(&shard->mutex);
+
+    // 캐시 미스, 리졸버 풀에 넘기고 결과를 기다린다
+    // 같은 이름을 기다리는 다른 워커가 있으면 풀에서 한 번만 풀린다
+    w = Malloc(sizeof(dns_lookup_wait));
+    strcpy(w->key, key);
+    Sem_init(&w->done, 0, 0);
+    w->refcnt = 2;
+    resolver_submit(host, port, resolver, dns_lookup_done, w);
+    clock_gettime(CLOCK_REALTIME, &deadline);
+    deadline.tv_sec = deadline.tv_sec + DNS_RESOLVE_TIMEOUT_MS / 1000;
+    deadline.tv_nsec = deadline.tv_nsec + (DNS_RESOLVE_TIMEOUT_MS % 1000) * 1000000L;
+    if (deadline.tv_nsec >= 1000000000L)
+    {
+        deadline.tv_sec = deadline.tv_sec + 1;
+        deadline.tv_nsec = deadline.tv_nsec - 1000000000L;
+    }
+    while ((rc = sem_timedwait(&w->done, &deadline)) < 0 && errno == EINTR)
+        ;
+    if (rc == 0)
+    {
+        rc = w->status;
+        *answer = w->answer;
+    }
+    else
+        rc = EAI_AGAIN;
+    dns_wait_release(w);
+    return rc;
+}
+
+// open_clientfd와 같지만 주소 목록을 dnscache에서 가져오고,
+// 주소들을 하나씩 blocking connect하는 대신 타임아웃이 있는 happy eyeballs 경주로 연결한다
+// 리턴값도 같다: -2는 이름 해석 실패(getaddrinfo 에러코드를 *dns_error에), -1은 errno가 설정된 그 밖의 실패
+// 리졸버를 기다리다 시간이 다 된 경우도 -2이고 *dns_error는 EAI_AGAIN
+int dnscache_open_clientfd(char *hostname, char *port, int *dns_error)
+{
+    dns_answer answer;
+
+    int rc = dnscache_lookup(hostname, port, &answer);
+    latency_mark(LAT_DNS);
+    *dns_error = rc;
+    if (rc != 0)
+        return -2;
+    return connect_race_blocking(&answer, CONNECT_ATTEMPT_TIMEOUT_MS, CONNECT_TIMEOUT_MS);
+}
@@ -0,0 +1,41 @@
+#ifndef __DNSCACHE_H__
+#define __DNSCACHE_H__
+
+#include "csapp.h"
+
+// 한 이름에 대해 기억해둘 최대 주소 수
+#define DNS_MAX_ADDRS 8
+// 캐시 미스 때 워커가 이름 해석을 기다리는 최대 시간, 넘으면 EAI_AGAIN으로 포기
+// (해석은 풀에서 계속되고 결과는 캐시에 남는다)
+#ifndef DNS_RESOLVE_TIMEOUT_MS
+#define DNS_RESOLVE_TIMEOUT_MS 3000
+#endif
+
+typedef struct
+{
+    int family, socktype, protocol;
+    socklen_t addrlen;
+    struct sockaddr_storage addr;
+} dns_addr;
+
+// 리졸버 한 번의 결과, 캐시 엔트리와 호출자에게 돌려주는 사본 모두 이 형태
+typedef struct
+{
+    int naddr;
+    dns_addr addr[DNS_MAX_ADDRS];
+    int ttl; // 초, 리졸버가 모르면 DNS_CACHE_TTL
+} dns_answer;
+
+// host, port를 풀어서 answer를 채우는 함수, 성공하면 0 실패하면 getaddrinfo 에러코드(EAI_*)
+typedef int (*dns_resolver_fn)(const char *host, const char *port, dns_answer *answer);
+
+void dnscache_init(void);
+int dnscache_lookup(const char *host, const char *port, dns_answer *answer);
+int dnscache_open_clientfd(char *hostname, char *port, int *dns_error);
+void dnscache_set_resolver(dns_resolver_fn resolver);
+void dnscache_set_clock(time_t (*fn)(void));
+int dnscache_load_hosts(const char *path);
+int dns_getaddrinfo_resolver(const char *host, const char *port, dns_answer *answer);
+int dns_hosts_resolver(const char *host, const char *port, dns_answer *answer);
+
+#endif /* __DNSCACHE_H__ */
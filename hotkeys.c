@@ -0,0 +1,285 @@
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "hotkeys.h"
+
+// 리포트에 찍을 키 앞부분, 키는 전체 uri의 해시로 구분한다
+#define HOTKEY_KEY_LEN 160
+// 합칠 때 쓰는 해시 테이블 (스레드 수 * HOTKEY_K보다 넉넉하게, 2의 거듭제곱)
+#define MERGE_TABLE_SIZE 16384
+
+#define BY_REQUESTS 0
+#define BY_BYTES 1
+
+typedef struct
+{
+    uint64_t hash, count, error;
+    char key[HOTKEY_KEY_LEN];
+} hk_entry;
+
+typedef struct
+{
+    int n;
+    uint64_t total; // sketch에 넣은 무게의 합 (요청 수나 바이트)
+    hk_entry e[HOTKEY_K];
+} hk_sketch;
+
+// 스레드 하나의 sketch, mutex는 merge 스레드와만 겨루니 평소에는 경합이 없다
+typedef struct hk_set
+{
+    pthread_mutex_t mutex;
+    hk_sketch sketch[2];
+    struct hk_set *next;
+} hk_set;
+
+// 지금 처리 중인 요청
+typedef struct
+{
+    int active;
+    uint64_t hash;
+    size_t bytes;
+    char key[HOTKEY_KEY_LEN];
+} hk_request;
+
+// 합친 결과, 무게 순으로 정렬해 둔다
+typedef struct
+{
+    int n, threads;
+    uint64_t total;
+    hk_entry e[HOTKEY_REPORT_N];
+} hk_top;
+
+static hk_set *sets;
+static pthread_mutex_t sets_mutex = PTHREAD_MUTEX_INITIALIZER;
+static __thread hk_set *my_set;
+static __thread hk_request cur;
+
+static hk_top merged[2];
+static pthread_mutex_t merged_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+static hk_set *set_get(void)
+{
+    hk_set *s;
+    if (my_set != NULL)
+        return my_set;
+    if ((s = calloc(1, sizeof(hk_set))) == NULL)
+        return NULL;
+    pthread_mutex_init(&s->mutex, NULL);
+    pthread_mutex_lock(&sets_mutex);
+    s->next = sets;
+    sets = s;
+    pthread_mutex_unlock(&sets_mutex);
+    my_set = s;
+    return s;
+}
+
+// FNV-1a
+static uint64_t key_hash(const char *key)
+{
+    uint64_t h = 14695981039346656037ULL;
+    for (; *key != '\0'; key = key + 1)
+        h = (h ^ (unsigned char)*key) * 1099511628211ULL;
+    return h;
+}
+
+// Space-Saving 갱신, 있으면 더하고 빈 칸이 있으면 넣고
+// 둘 다 아니면 가장 작은 항목을 밀어내고 그 값을 error로 물려받는다
+static void sketch_add(hk_sketch *sk, uint64_t hash, const char *key, uint64_t weight)
+{
+    int i, min = 0;
+
+    sk->total = sk->total + weight;
+    for (i = 0; i < sk->n; i = i + 1)
+    {
+        if (sk->e[i].hash == hash)
+        {
+            sk->e[i].count = sk->e[i].count + weight;
+            return;
+        }
+        if (sk->e[i].count < sk->e[min].count)
+            min = i;
+    }
+    if (sk->n < HOTKEY_K)
+    {
+        i = sk->n;
+        sk->n = sk->n + 1;
+        sk->e[i].error = 0;
+        sk->e[i].count = weight;
+    }
+    else
+    {
+        i = min;
+        sk->e[i].error = sk->e[i].count;
+        sk->e[i].count = sk->e[i].count + weight;
+    }
+    sk->e[i].hash = hash;
+    memcpy(sk->e[i].key, key, HOTKEY_KEY_LEN);
+}
+
+// 캐시 키가 정해졌을 때 doit이 부른다, 이 요청은 hotkey_end에서 기록된다
+void hotkey_request(const char *key)
+{
+    cur.active = 1;
+    cur.hash = key_hash(key);
+    cur.bytes = 0;
+    snprintf(cur.key, HOTKEY_KEY_LEN, "%s", key);
+}
+
+void hotkey_bytes(size_t bytes)
+{
+    cur.bytes = cur.bytes + bytes;
+}
+
+void hotkey_end(void)
+{
+    hk_set *s;
+
+    if (!cur.active)
+        return;
+    cur.active = 0;
+    if ((s = set_get()) == NULL)
+        return;
+    pthread_mutex_lock(&s->mutex);
+    sketch_add(&s->sketch[BY_REQUESTS], cur.hash, cur.key, 1);
+    if (cur.bytes > 0)
+        sketch_add(&s->sketch[BY_BYTES], cur.hash, cur.key, cur.bytes);
+    pthread_mutex_unlock(&s->mutex);
+}
+
+static int entry_cmp(const void *a, const void *b)
+{
+    const hk_entry *x = a, *y = b;
+    return x->count < y->count ? 1 : x->count > y->count ? -1 : 0;
+}
+
+// 모든 스레드의 sketch를 합친다 (mergeable summaries의 Space-Saving 합치기)
+// 어떤 sketch가 가득 찼는데 키가 없다면 그 sketch에서의 값은 최대 그 sketch의 최솟값이니
+// 그만큼을 count와 error에 같이 더한다
+static void merge_one(int which, hk_entry *table, hk_top *out)
+{
+    hk_set *head, *s;
+    hk_sketch *sk;
+    uint64_t floor_total = 0, floor, h;
+    hk_entry *slot;
+    int i, j, threads = 0, n = 0;
+    static uint64_t present_floor[MERGE_TABLE_SIZE]; // 키가 들어 있던 sketch들의 최솟값 합
+
+    memset(table, 0, sizeof(hk_entry) * MERGE_TABLE_SIZE);
+    memset(present_floor, 0, sizeof(present_floor));
+    memset(out, 0, sizeof(hk_top));
+    pthread_mutex_lock(&sets_mutex);
+    head = sets;
+    pthread_mutex_unlock(&sets_mutex);
+    for (s = head; s != NULL; s = s->next)
+    {
+        threads = threads + 1;
+        pthread_mutex_lock(&s->mutex);
+        sk = &s->sketch[which];
+        out->total = out->total + sk->total;
+        floor = 0;
+        if (sk->n == HOTKEY_K)
+        {
+            for (i = 0, floor = sk->e[0].count; i < sk->n; i = i + 1)
+                floor = sk->e[i].count < floor ? sk->e[i].count : floor;
+        }
+        floor_total = floor_total + floor;
+        for (i = 0; i < sk->n; i = i + 1)
+        {
+            // 선형 탐사, 테이블이 차면 더 넣지 않는다 (스레드 수 * HOTKEY_K가 테이블보다 클 때만)
+            h = sk->e[i].hash;
+            for (j = 0; j < MERGE_TABLE_SIZE; j = j + 1)
+            {
+                slot = &table[(h + j) & (MERGE_TABLE_SIZE - 1)];
+                if (slot->count == 0 || slot->hash == h)
+                    break;
+            }
+            if (j == MERGE_TABLE_SIZE)
+                continue;
+            if (slot->count == 0)
+            {
+                slot->hash = h;
+                memcpy(slot->key, sk->e[i].key, HOTKEY_KEY_LEN);
+                n = n + 1;
+            }
+            slot->count = slot->count + sk->e[i].count;
+            slot->error = slot->error + sk->e[i].error;
+            present_floor[slot - table] = present_floor[slot - table] + floor;
+        }
+        pthread_mutex_unlock(&s->mutex);
+    }
+    // 빈 칸을 앞으로 모으고 없던 sketch의 몫을 더한 뒤 정렬
+    for (i = 0, j = 0; i < MERGE_TABLE_SIZE; i = i + 1)
+    {
+        if (table[i].count == 0)
+            continue;
+        table[j] = table[i];
+        table[j].count = table[j].count + floor_total - present_floor[i];
+        table[j].error = table[j].error + floor_total - present_floor[i];
+        j = j + 1;
+    }
+    qsort(table, n, sizeof(hk_entry), entry_cmp);
+    out->n = n < HOTKEY_REPORT_N ? n : HOTKEY_REPORT_N;
+    out->threads = threads;
+    memcpy(out->e, table, sizeof(hk_entry) * out->n);
+}
+
+static void *merge_routine(void *vargp)
+{
+    struct timespec pause = {HOTKEY_MERGE_MS / 1000, (HOTKEY_MERGE_MS % 1000) * 1000000L};
+    hk_entry *table = malloc(sizeof(hk_entry) * MERGE_TABLE_SIZE);
+    hk_top top[2];
+
+    pthread_detach(pthread_self());
+    if (table == NULL)
+        return NULL;
+    while (1)
+    {
+        nanosleep(&pause, NULL);
+        merge_one(BY_REQUESTS, table, &top[BY_REQUESTS]);
+        merge_one(BY_BYTES, table, &top[BY_BYTES]);
+        pthread_mutex_lock(&merged_mutex);
+        memcpy(merged, top, sizeof(merged));
+        pthread_mutex_unlock(&merged_mutex);
+    }
+    return NULL;
+}
+
+void hotkeys_init(void)
+{
+    pthread_t tid;
+    pthread_create(&tid, NULL, merge_routine, NULL);
+}
+
+static size_t report_one(char *buf, size_t size, hk_top *top, const char *title, const char *unit)
+{
+    size_t used;
+    int i;
+
+    used = snprintf(buf, size, "top uris by %s (total %llu %s, %d threads)\n%4s %14s %14s %7s  %s\n", title,
+            (unsigned long long)top->total, unit, top->threads, "rank", unit, ">=", "share", "uri");
+    for (i = 0; i < top->n && used < size; i = i + 1)
+        used = used + snprintf(buf + used, size - used, "%4d %14llu %14llu %6.2f%%  %s\n", i + 1,
+                (unsigned long long)top->e[i].count, (unsigned long long)(top->e[i].count - top->e[i].error),
+                top->total > 0 ? 100.0 * top->e[i].count / top->total : 0.0, top->e[i].key);
+    return used < size ? used : size - 1;
+}
+
+// 마지막으로 합친 결과 (최대 HOTKEY_MERGE_MS 전), 두 번째 열은 보장되는 최솟값
+size_t hotkeys_report(char *buf, size_t size)
+{
+    hk_top top[2];
+    size_t used;
+
+    pthread_mutex_lock(&merged_mutex);
+    memcpy(top, merged, sizeof(top));
+    pthread_mutex_unlock(&merged_mutex);
+    used = report_one(buf, size, &top[BY_REQUESTS], "requests", "requests");
+    if (used + 1 < size)
+        used = used + snprintf(buf + used, size - used, "\n");
+    if (used + 1 < size)
+        used = used + report_one(buf + used, size - used, &top[BY_BYTES], "bytes", "bytes");
+    return used < size ? used : size - 1;
+}
@@ -0,0 +1,30 @@
+#ifndef __HOTKEYS_H__
+#define __HOTKEYS_H__
+
+#include <stddef.h>
+
+// 트래픽이 몰리는 uri(캐시 키)를 요청 수와 바이트 기준으로 찾는 top-K 추적기 (Space-Saving)
+// 스레드마다 크기가 정해진 sketch 두 개(요청 수, 바이트)에 기록하고,
+// merge 스레드가 주기적으로 모든 스레드의 것을 합쳐 둔 결과를 관리 포트의 GET /hotkeys가 보여준다
+// 메모리는 스레드당 HOTKEY_K개 항목으로 고정이고, 어떤 키의 실제 값은 count - error 이상 count 이하
+
+// 스레드 sketch 하나의 항목 수
+#ifndef HOTKEY_K
+#define HOTKEY_K 64
+#endif
+// 합치는 주기
+#ifndef HOTKEY_MERGE_MS
+#define HOTKEY_MERGE_MS 1000
+#endif
+// 리포트에 보여줄 순위 수
+#ifndef HOTKEY_REPORT_N
+#define HOTKEY_REPORT_N 20
+#endif
+
+void hotkeys_init(void);
+void hotkey_request(const char *key);
+void hotkey_bytes(size_t bytes);
+void hotkey_end(void);
+size_t hotkeys_report(char *buf, size_t size);
+
+#endif /* __HOTKEYS_H__ */
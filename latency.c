@@ -0,0 +1,244 @@
+#include <pthread.h>
+#include <signal.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include "latency.h"
+
+// HDR 히스토그램처럼 2의 거듭제곱 구간마다 같은 수의 하위 구간으로 나눈 로그-선형 버킷
+// 2의 거듭제곱 구간 하나는 HIST_HALF개로 나뉘어서 (값의 상위 HIST_SUB_BITS비트 중 맨 위는 항상 1),
+// 값(마이크로초)이 얼마든 상대 오차가 1/HIST_HALF(1/16) 이내로 유지된다
+#define HIST_SUB_BITS 5
+#define HIST_SUB (1 << HIST_SUB_BITS)
+#define HIST_HALF (HIST_SUB / 2)
+#define HIST_MAX_SHIFT 31 // 약 2^36us = 19시간까지, 넘으면 마지막 버킷
+#define HIST_BUCKETS ((HIST_MAX_SHIFT + 2) * HIST_HALF)
+
+typedef struct
+{
+    _Atomic uint64_t count[HIST_BUCKETS];
+    _Atomic uint64_t total, max;
+} histogram;
+
+// 스레드 하나의 히스토그램 묶음, 만들어지면 목록에 붙고 빠지지 않는다
+typedef struct lat_set
+{
+    histogram hist[LAT_NPHASE][LAT_NCLASS];
+    struct lat_set *next;
+} lat_set;
+
+// 지금 처리 중인 요청의 단계별 시간, 요청이 끝나고 hit/miss가 정해지면 히스토그램에 들어간다
+typedef struct
+{
+    int active, cls;
+    struct timespec start, last;
+    long pending[LAT_NPHASE]; // 아직 기록되지 않은 단계는 -1
+} lat_request;
+
+static lat_set *sets;
+static pthread_mutex_t sets_mutex = PTHREAD_MUTEX_INITIALIZER;
+static __thread lat_set *my_set;
+static __thread lat_request cur;
+
+static const char *const phase_name[LAT_NPHASE] = {"parse", "cache", "dns", "connect", "ttfb", "relay", "total"};
+static const char *const class_name[LAT_NCLASS] = {"hit", "miss"};
+
+static int bucket_of(uint64_t v)
+{
+    int msb, shift;
+    if (v < HIST_SUB)
+        return (int)v;
+    msb = 63 - __builtin_clzll(v);
+    shift = msb - HIST_SUB_BITS + 1;
+    if (shift > HIST_MAX_SHIFT)
+        return HIST_BUCKETS - 1;
+    return shift * HIST_HALF + (int)(v >> shift);
+}
+
+// 버킷에 들어가는 가장 큰 값
+static uint64_t bucket_high(int idx)
+{
+    int shift;
+    uint64_t top;
+    if (idx < HIST_SUB)
+        return idx;
+    shift = idx / HIST_HALF - 1;
+    top = idx % HIST_HALF + HIST_HALF;
+    return ((top + 1) << shift) - 1;
+}
+
+// 주인 스레드만 쓰니 원자적 더하기 대신 load/store로 충분하다 (리포트 쪽이 찢어진 값을 읽지 않을 정도면 된다)
+static void counter_add(_Atomic uint64_t *c, uint64_t n)
+{
+    atomic_store_explicit(c, atomic_load_explicit(c, memory_order_relaxed) + n, memory_order_relaxed);
+}
+
+static void hist_record(histogram *h, long usec)
+{
+    uint64_t v = usec < 0 ? 0 : (uint64_t)usec;
+    counter_add(&h->count[bucket_of(v)], 1);
+    counter_add(&h->total, 1);
+    if (v > atomic_load_explicit(&h->max, memory_order_relaxed))
+        atomic_store_explicit(&h->max, v, memory_order_relaxed);
+}
+
+static lat_set *set_get(void)
+{
+    lat_set *s;
+    if (my_set != NULL)
+        return my_set;
+    if ((s = calloc(1, sizeof(lat_set))) == NULL)
+        return NULL;
+    pthread_mutex_lock(&sets_mutex);
+    s->next = sets;
+    sets = s;
+    pthread_mutex_unlock(&sets_mutex);
+    my_set = s;
+    return s;
+}
+
+static long elapsed_us(struct timespec *from, struct timespec *to)
+{
+    return (to->tv_sec - from->tv_sec) * 1000000L + (to->tv_nsec - from->tv_nsec) / 1000;
+}
+
+// 요청 처리를 시작할 때 (요청 줄을 읽은 직후)
+void latency_begin(void)
+{
+    int i;
+    cur.active = 1;
+    cur.cls = LAT_MISS;
+    clock_gettime(CLOCK_MONOTONIC, &cur.start);
+    cur.last = cur.start;
+    for (i = 0; i < LAT_NPHASE; i = i + 1)
+        cur.pending[i] = -1;
+}
+
+// 직전 mark(혹은 begin) 이후의 시간을 phase에 더한다
+void latency_mark(int phase)
+{
+    struct timespec now;
+    if (!cur.active)
+        return;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    cur.pending[phase] = (cur.pending[phase] < 0 ? 0 : cur.pending[phase]) + elapsed_us(&cur.last, &now);
+    cur.last = now;
+}
+
+void latency_class(int cls)
+{
+    cur.cls = cls;
+}
+
+// 요청이 끝나면 거친 단계와 전체 시간을 기록한다
+void latency_end(void)
+{
+    struct timespec now;
+    lat_set *s;
+    int i;
+
+    if (!cur.active)
+        return;
+    cur.active = 0;
+    if ((s = set_get()) == NULL)
+        return;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    cur.pending[LAT_TOTAL] = elapsed_us(&cur.start, &now);
+    for (i = 0; i < LAT_NPHASE; i = i + 1)
+        if (cur.pending[i] >= 0)
+            hist_record(&s->hist[i][cur.cls], cur.pending[i]);
+}
+
+// merged에서 전체의 q 비율 지점에 해당하는 값, 버킷의 상한이니 실제 최댓값을 넘지 않게 자른다
+static uint64_t percentile(uint64_t *merged, uint64_t total, uint64_t max, double q)
+{
+    uint64_t rank = (uint64_t)(q * total + 0.5), seen = 0;
+    int i;
+    if (rank == 0)
+        rank = 1;
+    for (i = 0; i < HIST_BUCKETS; i = i + 1)
+    {
+        seen = seen + merged[i];
+        if (seen >= rank)
+            return bucket_high(i) < max ? bucket_high(i) : max;
+    }
+    return max;
+}
+
+// 모든 스레드의 히스토그램을 합쳐 단계별, hit/miss별 백분위를 buf에 쓴다 (단위 us)
+size_t latency_report(char *buf, size_t size)
+{
+    static uint64_t merged[HIST_BUCKETS];
+    static pthread_mutex_t report_mutex = PTHREAD_MUTEX_INITIALIZER;
+    uint64_t total, max;
+    size_t used;
+    lat_set *s;
+    int p, c, i;
+
+    pthread_mutex_lock(&report_mutex);
+    used = snprintf(buf, size, "%-8s %-5s %10s %10s %10s %10s %10s %10s\n", "phase", "class", "count", "p50", "p90", "p99", "p999", "max");
+    for (p = 0; p < LAT_NPHASE; p = p + 1)
+    {
+        for (c = 0; c < LAT_NCLASS; c = c + 1)
+        {
+            memset(merged, 0, sizeof(merged));
+            total = max = 0;
+            pthread_mutex_lock(&sets_mutex);
+            s = sets;
+            pthread_mutex_unlock(&sets_mutex);
+            for (; s != NULL; s = s->next)
+            {
+                for (i = 0; i < HIST_BUCKETS; i = i + 1)
+                    merged[i] = merged[i] + atomic_load_explicit(&s->hist[p][c].count[i], memory_order_relaxed);
+                total = total + atomic_load_explicit(&s->hist[p][c].total, memory_order_relaxed);
+                if (atomic_load_explicit(&s->hist[p][c].max, memory_order_relaxed) > max)
+                    max = atomic_load_explicit(&s->hist[p][c].max, memory_order_relaxed);
+            }
+            if (total == 0 || used >= size)
+                continue;
+            used = used + snprintf(buf + used, size - used, "%-8s %-5s %10llu %10llu %10llu %10llu %10llu %10llu\n",
+                    phase_name[p], class_name[c], (unsigned long long)total,
+                    (unsigned long long)percentile(merged, total, max, 0.5), (unsigned long long)percentile(merged, total, max, 0.9),
+                    (unsigned long long)percentile(merged, total, max, 0.99), (unsigned long long)percentile(merged, total, max, 0.999),
+                    (unsigned long long)max);
+        }
+    }
+    pthread_mutex_unlock(&report_mutex);
+    return used < size ? used : size - 1;
+}
+
+// SIGUSR1을 받으면 리포트를 stderr로 (시그널 핸들러 대신 sigwait하는 스레드에서)
+static void *report_routine(void *vargp)
+{
+    sigset_t *set = vargp;
+    char buf[8192];
+    size_t len;
+    int sig;
+
+    pthread_detach(pthread_self());
+    while (1)
+    {
+        if (sigwait(set, &sig) != 0)
+            continue;
+        len = latency_report(buf, sizeof(buf));
+        if (write(STDERR_FILENO, buf, len) < 0)
+            continue;
+    }
+    return NULL;
+}
+
+// 다른 스레드를 만들기 전에 불러야 한다 (모든 스레드가 SIGUSR1을 막은 마스크를 물려받도록)
+void latency_init(void)
+{
+    static sigset_t set;
+    pthread_t tid;
+
+    sigemptyset(&set);
+    sigaddset(&set, SIGUSR1);
+    pthread_sigmask(SIG_BLOCK, &set, NULL);
+    pthread_create(&tid, NULL, report_routine, &set);
+}
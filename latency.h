@@ -0,0 +1,29 @@
+#ifndef __LATENCY_H__
+#define __LATENCY_H__
+
+#include <stddef.h>
+
+// 요청 단계별 지연 시간 히스토그램
+// 스레드마다 자기 히스토그램에만 기록하고, 리포트를 만들 때 모든 스레드의 것을 합친다
+
+#define LAT_PARSE 0   // 요청 줄을 읽은 뒤 헤더를 다 읽기까지
+#define LAT_CACHE 1   // 캐시 조회
+#define LAT_DNS 2     // 이름 해석 (DNS 캐시 포함)
+#define LAT_CONNECT 3 // origin 연결 (풀에서 꺼낸 경우 포함)
+#define LAT_TTFB 4    // origin에 요청을 보내고 status line을 받기까지
+#define LAT_RELAY 5   // 응답을 클라이언트에 다 보내기까지
+#define LAT_TOTAL 6   // 요청 전체
+#define LAT_NPHASE 7
+
+#define LAT_HIT 0
+#define LAT_MISS 1
+#define LAT_NCLASS 2
+
+void latency_init(void);
+void latency_begin(void);
+void latency_mark(int phase);
+void latency_class(int cls);
+void latency_end(void);
+size_t latency_report(char *buf, size_t size);
+
+#endif /* __LATENCY_H__ */
@@ -0,0 +1,136 @@
+// accept4
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <netdb.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include "listener.h"
+#include "accesslog.h"
+
+// accept 루프는 연결을 큐에 넣기만 하고, 주소를 문자열로 바꾸는 일은 워커가 숫자 형식으로만 한다
+// 역방향 DNS는 켜져 있을 때만 별도 스레드가 로그용으로 처리해서 느린 DNS가 accept를 막지 않게 한다
+
+// 역방향 DNS 대기열 크기, 가득 차면 그냥 버린다 (로그용이니 잃어도 된다)
+#define RDNS_QUEUE_SIZE 64
+
+typedef struct
+{
+    struct sockaddr_storage addr;
+    socklen_t addrlen;
+} rdns_item;
+
+static int rdns_enabled;
+static rdns_item rdns_queue[RDNS_QUEUE_SIZE];
+static int rdns_head, rdns_count;
+static pthread_mutex_t rdns_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t rdns_cond = PTHREAD_COND_INITIALIZER;
+
+static void *rdns_routine(void *vargp)
+{
+    rdns_item item;
+    char addr[NI_MAXHOST], name[NI_MAXHOST];
+
+    pthread_detach(pthread_self());
+    while (1)
+    {
+        pthread_mutex_lock(&rdns_mutex);
+        while (rdns_count == 0)
+            pthread_cond_wait(&rdns_cond, &rdns_mutex);
+        item = rdns_queue[rdns_head];
+        rdns_head = (rdns_head + 1) % RDNS_QUEUE_SIZE;
+        rdns_count = rdns_count - 1;
+        pthread_mutex_unlock(&rdns_mutex);
+        if (getnameinfo((struct sockaddr *)&item.addr, item.addrlen, addr, sizeof(addr), NULL, 0, NI_NUMERICHOST) == 0
+            && getnameinfo((struct sockaddr *)&item.addr, item.addrlen, name, sizeof(name), NULL, 0, NI_NAMEREQD) == 0)
+            log_msg(LOG_INFO, "Client %s is %s", addr, name);
+    }
+    return NULL;
+}
+
+static void rdns_submit(struct sockaddr_storage *addr, socklen_t addrlen)
+{
+    pthread_mutex_lock(&rdns_mutex);
+    if (rdns_count < RDNS_QUEUE_SIZE)
+    {
+        rdns_item *item = &rdns_queue[(rdns_head + rdns_count) % RDNS_QUEUE_SIZE];
+        memcpy(&item->addr, addr, addrlen);
+        item->addrlen = addrlen;
+        rdns_count = rdns_count + 1;
+        pthread_cond_signal(&rdns_cond);
+    }
+    pthread_mutex_unlock(&rdns_mutex);
+}
+
+// 듣기 소켓을 논블로킹으로 바꾸고, reverse_dns가 켜져 있으면 역방향 DNS 스레드를 띄운다
+int listener_init(int listenfd, int reverse_dns)
+{
+    pthread_t tid;
+    int flags;
+
+    if ((flags = fcntl(listenfd, F_GETFL)) < 0 || fcntl(listenfd, F_SETFL, flags | O_NONBLOCK) < 0)
+        return -1;
+    rdns_enabled = reverse_dns;
+    if (rdns_enabled && pthread_create(&tid, NULL, rdns_routine, NULL) != 0)
+        rdns_enabled = 0;
+    return 0;
+}
+
+// 대기 중인 연결을 max개까지 한 번에 accept해서 fds에 담는다
+// 받은 수를 돌려주고, 하나도 못 받았으면 -1 (errno가 EAGAIN이면 기다리는 연결이 없는 것)
+// 받은 소켓은 SOCK_NONBLOCK|SOCK_CLOEXEC, 워커가 listener_set_blocking으로 블로킹으로 되돌린다
+int listener_accept_batch(int listenfd, int *fds, int max)
+{
+    struct sockaddr_storage addr;
+    socklen_t addrlen;
+    int n = 0, fd;
+
+    while (n < max)
+    {
+        addrlen = sizeof(addr);
+        if ((fd = accept4(listenfd, (struct sockaddr *)&addr, &addrlen, SOCK_NONBLOCK | SOCK_CLOEXEC)) < 0)
+        {
+            if (errno == EINTR || errno == ECONNABORTED)
+                continue;
+            break;
+        }
+        if (rdns_enabled)
+            rdns_submit(&addr, addrlen);
+        fds[n] = fd;
+        n = n + 1;
+    }
+    return n > 0 ? n : -1;
+}
+
+// 듣기 소켓에 새 연결이 올 때까지 기다린다
+void listener_wait(int listenfd)
+{
+    struct pollfd pfd;
+    pfd.fd = listenfd;
+    pfd.events = POLLIN;
+    poll(&pfd, 1, -1);
+}
+
+void listener_set_blocking(int fd)
+{
+    int flags;
+    if ((flags = fcntl(fd, F_GETFL)) >= 0)
+        fcntl(fd, F_SETFL, flags & ~O_NONBLOCK);
+}
+
+// 연결의 상대 주소를 숫자 형식으로 (DNS를 거치지 않는다)
+void listener_format_peer(int fd, char *host, size_t hostlen, char *port, size_t portlen)
+{
+    struct sockaddr_storage addr;
+    socklen_t addrlen = sizeof(addr);
+
+    if (getpeername(fd, (struct sockaddr *)&addr, &addrlen) < 0
+        || getnameinfo((struct sockaddr *)&addr, addrlen, host, hostlen, port, portlen, NI_NUMERICHOST | NI_NUMERICSERV) != 0)
+    {
+        snprintf(host, hostlen, "?");
+        snprintf(port, portlen, "?");
+    }
+}
@@ -0,0 +1,20 @@
+#ifndef __LISTENER_H__
+#define __LISTENER_H__
+
+#include <sys/socket.h>
+
+// accept 경로에서 쓰는 함수들
+// accept4가 _GNU_SOURCE를 필요로 하는데 csapp.h의 gai_error와 충돌하니 csapp.h 없이 따로 컴파일한다
+
+// 한 번 깨어날 때 accept할 최대 연결 수
+#ifndef ACCEPT_BATCH
+#define ACCEPT_BATCH 32
+#endif
+
+int listener_init(int listenfd, int reverse_dns);
+int listener_accept_batch(int listenfd, int *fds, int max);
+void listener_wait(int listenfd);
+void listener_set_blocking(int fd);
+void listener_format_peer(int fd, char *host, size_t hostlen, char *port, size_t portlen);
+
+#endif /* __LISTENER_H__ */
@@ -0,0 +1,155 @@
+#include <stdatomic.h>
+#include <stdint.h>
+#include <time.h>
+#include "lockprof.h"
+
+void prof_lock_init(prof_lock *l)
+{
+    Sem_init(&l->sem, 0, 1);
+}
+
+#if LOCK_PROFILE
+
+static const char *const site_name[LS_NSITES] = {
+    "cache readstart read_mutex", "cache readend read_mutex", "cache reader write_mutex", "cache writer write_mutex",
+    "cache insert_mutex", "negcache find", "negcache insert"};
+
+typedef struct
+{
+    _Atomic uint64_t acquired, contended;
+    _Atomic uint64_t wait_ns, wait_max_ns, hold_ns, hold_max_ns;
+} site_stats;
+
+// 스레드 하나의 카운터, metrics.c처럼 자기 것에만 쓰고 리포트할 때 모두 더한다
+// (통계를 공유하면 그 자체가 새 경합이 된다)
+typedef struct lock_set
+{
+    site_stats site[LS_NSITES];
+    struct lock_set *next;
+} __attribute__((aligned(64))) lock_set;
+
+static lock_set *sets;
+static pthread_mutex_t sets_mutex = PTHREAD_MUTEX_INITIALIZER;
+static __thread lock_set *my_set;
+
+static lock_set *set_get(void)
+{
+    lock_set *s;
+    if (my_set != NULL)
+        return my_set;
+    if ((s = aligned_alloc(64, sizeof(lock_set))) == NULL)
+        return NULL;
+    memset(s, 0, sizeof(lock_set));
+    pthread_mutex_lock(&sets_mutex);
+    s->next = sets;
+    sets = s;
+    pthread_mutex_unlock(&sets_mutex);
+    my_set = s;
+    return s;
+}
+
+static int64_t now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static void counter_add(_Atomic uint64_t *c, uint64_t n)
+{
+    atomic_store_explicit(c, atomic_load_explicit(c, memory_order_relaxed) + n, memory_order_relaxed);
+}
+
+static void counter_max(_Atomic uint64_t *c, uint64_t v)
+{
+    if (v > atomic_load_explicit(c, memory_order_relaxed))
+        atomic_store_explicit(c, v, memory_order_relaxed);
+}
+
+// 먼저 sem_trywait로 바로 얻어보고, 실패했을 때만 경합으로 세고 기다린 시간을 잰다
+void prof_P(prof_lock *l, int site)
+{
+    lock_set *s = set_get();
+    int64_t start, waited;
+
+    if (sem_trywait(&l->sem) < 0)
+    {
+        start = now_ns();
+        P(&l->sem);
+        l->acquired_ns = now_ns();
+        waited = l->acquired_ns - start;
+        if (s != NULL)
+        {
+            counter_add(&s->site[site].contended, 1);
+            counter_add(&s->site[site].wait_ns, waited);
+            counter_max(&s->site[site].wait_max_ns, waited);
+        }
+    }
+    else
+        l->acquired_ns = now_ns();
+    l->site = site;
+    if (s != NULL)
+        counter_add(&s->site[site].acquired, 1);
+}
+
+void prof_V(prof_lock *l)
+{
+    lock_set *s = set_get();
+    int64_t held = now_ns() - l->acquired_ns;
+    int site = l->site;
+
+    V(&l->sem);
+    if (s != NULL)
+    {
+        counter_add(&s->site[site].hold_ns, held);
+        counter_max(&s->site[site].hold_max_ns, held);
+    }
+}
+
+// 자리마다 모든 스레드의 값을 더한 표
+size_t lockprof_report(char *buf, size_t size)
+{
+    uint64_t acquired, contended, wait_ns, wait_max, hold_ns, hold_max, v;
+    lock_set *head, *s;
+    size_t used;
+    int i;
+
+    pthread_mutex_lock(&sets_mutex);
+    head = sets;
+    pthread_mutex_unlock(&sets_mutex);
+    used = snprintf(buf, size, "%-28s %12s %10s %7s %12s %10s %10s %10s %10s\n", "site", "acquired", "contended", "cont%",
+            "wait-total", "wait-avg", "wait-max", "hold-avg", "hold-max");
+    used = used + snprintf(buf + used, size - used, "%-28s %12s %10s %7s %12s %10s %10s %10s %10s\n", "", "", "", "", "ms", "us",
+            "us", "us", "us");
+    for (i = 0; i < LS_NSITES && used < size; i = i + 1)
+    {
+        acquired = contended = wait_ns = wait_max = hold_ns = hold_max = 0;
+        for (s = head; s != NULL; s = s->next)
+        {
+            acquired = acquired + atomic_load_explicit(&s->site[i].acquired, memory_order_relaxed);
+            contended = contended + atomic_load_explicit(&s->site[i].contended, memory_order_relaxed);
+            wait_ns = wait_ns + atomic_load_explicit(&s->site[i].wait_ns, memory_order_relaxed);
+            hold_ns = hold_ns + atomic_load_explicit(&s->site[i].hold_ns, memory_order_relaxed);
+            if ((v = atomic_load_explicit(&s->site[i].wait_max_ns, memory_order_relaxed)) > wait_max)
+                wait_max = v;
+            if ((v = atomic_load_explicit(&s->site[i].hold_max_ns, memory_order_relaxed)) > hold_max)
+                hold_max = v;
+        }
+        // 경합한 획득만 기다리니 wait-avg는 경합 한 번당 평균
+        used = used + snprintf(buf + used, size - used, "%-28s %12llu %10llu %6.2f%% %12.3f %10.2f %10.2f %10.2f %10.2f\n",
+                site_name[i], (unsigned long long)acquired, (unsigned long long)contended,
+                acquired > 0 ? 100.0 * contended / acquired : 0.0, wait_ns / 1e6,
+                contended > 0 ? wait_ns / 1e3 / contended : 0.0, wait_max / 1e3,
+                acquired > 0 ? hold_ns / 1e3 / acquired : 0.0, hold_max / 1e3);
+    }
+    return used < size ? used : size - 1;
+}
+
+#else
+
+size_t lockprof_report(char *buf, size_t size)
+{
+    return snprintf(buf, size, "lock profiling is off, rebuild with -DLOCK_PROFILE=1\n");
+}
+
+#endif
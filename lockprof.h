@@ -0,0 +1,46 @@
+#ifndef __LOCKPROF_H__
+#define __LOCKPROF_H__
+
+#include "csapp.h"
+
+// 락 경합 프로파일링, -DLOCK_PROFILE=1로 빌드하면 prof_P/prof_V가 자리(site)마다
+// 획득 수, 경합(바로 얻지 못한) 수, 기다린 시간, 쥐고 있던 시간을 스레드별로 센다
+// 끄면 prof_lock은 sem_t 하나뿐이고 prof_P/prof_V는 P/V 그대로라 비용이 없다
+// 결과는 관리 포트의 GET /locks
+
+#ifndef LOCK_PROFILE
+#define LOCK_PROFILE 0
+#endif
+
+// 락을 얻는 자리, 이름은 lockprof.c의 site_name에 같은 순서로
+#define LS_CACHE_READSTART 0    // readstart의 read_mutex (reader 수 보호)
+#define LS_CACHE_READEND 1      // readend의 read_mutex
+#define LS_CACHE_READER_WRITE 2 // 첫 reader가 잡는 write_mutex (마지막 reader가 놓는다)
+#define LS_CACHE_WRITER_WRITE 3 // cache_uri가 잡는 write_mutex
+#define LS_CACHE_INSERT 4       // cache_uri의 insert_mutex
+#define LS_NEGCACHE_FIND 5
+#define LS_NEGCACHE_INSERT 6
+#define LS_NSITES 7
+
+typedef struct
+{
+    sem_t sem;
+#if LOCK_PROFILE
+    // 놓을 때 hold 시간을 얻은 자리에 더한다 (write_mutex는 얻은 스레드와 놓는 스레드가 다를 수 있다)
+    int site;
+    int64_t acquired_ns;
+#endif
+} prof_lock;
+
+void prof_lock_init(prof_lock *l);
+size_t lockprof_report(char *buf, size_t size);
+
+#if LOCK_PROFILE
+void prof_P(prof_lock *l, int site);
+void prof_V(prof_lock *l);
+#else
+#define prof_P(l, site) P(&(l)->sem)
+#define prof_V(l) V(&(l)->sem)
+#endif
+
+#endif /* __LOCKPROF_H__ */
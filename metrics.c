@@ -0,0 +1,181 @@
+#include <stdatomic.h>
+#include <stdint.h>
+#include "csapp.h"
+#include "metrics.h"
+#include "latency.h"
+#include "lockprof.h"
+#include "hotkeys.h"
+
+// 카운터 묶음은 캐시 라인에 맞춰 정렬하고 크기도 캐시 라인의 배수라서
+// 서로 다른 스레드의 카운터가 한 캐시 라인을 공유하지 않는다 (false sharing 없음)
+#define CACHE_LINE 64
+
+typedef struct metrics_block
+{
+    _Atomic int64_t value[M_NCOUNTERS];
+    struct metrics_block *next;
+} __attribute__((aligned(CACHE_LINE))) metrics_block;
+
+typedef struct
+{
+    const char *name, *type, *help;
+} metric_info;
+
+static const metric_info metric_table[M_NCOUNTERS] = {
+    {"proxy_requests_total", "counter", "Requests parsed from clients"},
+    {"proxy_cache_hits_total", "counter", "Requests served from the cache"},
+    {"proxy_cache_misses_total", "counter", "Requests not found in the cache"},
+    {"proxy_cache_inserts_total", "counter", "Responses stored in the cache"},
+    {"proxy_cache_evictions_total", "counter", "Cached objects replaced to make room"},
+    {"proxy_negative_cache_hits_total", "counter", "Requests answered from the negative cache"},
+    {"proxy_origin_bytes_total", "counter", "Bytes read from origin servers"},
+    {"proxy_client_bytes_total", "counter", "Bytes written to clients"},
+    {"proxy_connections_accepted_total", "counter", "Client connections accepted"},
+    {"proxy_connections_active", "gauge", "Client connections being served"},
+    {"proxy_connections_rejected_total", "counter", "Client requests rejected with 503 under overload"},
+    {"proxy_origin_requests_total", "counter", "Requests sent to origin servers"},
+    {"proxy_origin_reused_total", "counter", "Origin requests sent on pooled connections"},
+    {"proxy_origin_errors_total", "counter", "Origin DNS, connect or protocol failures"},
+    {"proxy_origin_timeouts_total", "counter", "Origin requests that hit the origin timeout"},
+    {"proxy_io_syscalls_total", "counter", "read/write system calls made by Rio (RIO_STATS builds only)"},
+    {"proxy_io_short_total", "counter", "Rio reads and writes that moved fewer bytes than asked (RIO_STATS builds only)"},
+    {"proxy_io_bytes_total", "counter", "Bytes moved by Rio system calls (RIO_STATS builds only)"},
+    {"proxy_io_copied_bytes_total", "counter", "Bytes copied in user space by Rio and the relay (RIO_STATS builds only)"},
+};
+
+static metrics_block *blocks;
+static pthread_mutex_t blocks_mutex = PTHREAD_MUTEX_INITIALIZER;
+static __thread metrics_block *my_block;
+
+static metrics_block *block_get(void)
+{
+    metrics_block *b;
+    if (my_block != NULL)
+        return my_block;
+    if ((b = aligned_alloc(CACHE_LINE, sizeof(metrics_block))) == NULL)
+        return NULL;
+    memset(b, 0, sizeof(metrics_block));
+    pthread_mutex_lock(&blocks_mutex);
+    b->next = blocks;
+    blocks = b;
+    pthread_mutex_unlock(&blocks_mutex);
+    my_block = b;
+    return b;
+}
+
+// 자기 스레드의 카운터에만 쓰니 원자적 더하기(lock 접두사)가 필요 없다
+void metrics_add(int id, long n)
+{
+    metrics_block *b = block_get();
+    if (b != NULL)
+        atomic_store_explicit(&b->value[id], atomic_load_explicit(&b->value[id], memory_order_relaxed) + n, memory_order_relaxed);
+}
+
+// 카운터 하나의 모든 스레드 합
+long metrics_get(int id)
+{
+    int64_t sum = 0;
+    metrics_block *b;
+
+    pthread_mutex_lock(&blocks_mutex);
+    b = blocks;
+    pthread_mutex_unlock(&blocks_mutex);
+    for (; b != NULL; b = b->next)
+        sum = sum + atomic_load_explicit(&b->value[id], memory_order_relaxed);
+    return (long)sum;
+}
+
+// 모든 스레드의 카운터를 더해 Prometheus 텍스트 형식으로 buf에 쓴다
+size_t metrics_render(char *buf, size_t size)
+{
+    int64_t sum;
+    metrics_block *b, *head;
+    size_t used = 0;
+    int i;
+
+    pthread_mutex_lock(&blocks_mutex);
+    head = blocks;
+    pthread_mutex_unlock(&blocks_mutex);
+    for (i = 0; i < M_NCOUNTERS && used < size; i = i + 1)
+    {
+        sum = 0;
+        for (b = head; b != NULL; b = b->next)
+            sum = sum + atomic_load_explicit(&b->value[i], memory_order_relaxed);
+        used = used + snprintf(buf + used, size - used, "# HELP %s %s\n# TYPE %s %s\n%s %lld\n",
+                metric_table[i].name, metric_table[i].help, metric_table[i].name, metric_table[i].type,
+                metric_table[i].name, (long long)sum);
+    }
+    return used < size ? used : size - 1;
+}
+
+// 관리 포트의 요청 하나, GET /metrics는 카운터, GET /latency는 단계별 지연 시간 표, GET /locks는 락 경합 표,
+// GET /hotkeys는 요청 수와 바이트 기준 상위 uri
+static void admin_handle(int fd)
+{
+    static char body[32768];
+    char buf[MAXLINE], method[MAXLINE], path[MAXLINE], head[MAXLINE];
+    const char *status = "200 OK", *type = "text/plain; version=0.0.4";
+    struct timeval tv = {1, 0};
+    size_t len;
+    rio_t rio;
+
+    // 관리용이라 한 번에 하나씩 처리하니, 느린 클라이언트가 붙잡고 있지 못하게 읽기 시간을 제한한다
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+    rio_readinitb(&rio, fd);
+    if (rio_readlineb(&rio, buf, MAXLINE) <= 0 || sscanf(buf, "%s %s", method, path) != 2)
+        return;
+    while (rio_readlineb(&rio, buf, MAXLINE) > 0 && strcmp(buf, "\r\n") && strcmp(buf, "\n"))
+        ;
+    if (!strcmp(path, "/metrics"))
+        len = metrics_render(body, sizeof(body));
+    else if (!strcmp(path, "/latency"))
+    {
+        len = latency_report(body, sizeof(body));
+        type = "text/plain";
+    }
+    else if (!strcmp(path, "/hotkeys"))
+    {
+        len = hotkeys_report(body, sizeof(body));
+        type = "text/plain";
+    }
+    else if (!strcmp(path, "/locks"))
+    {
+        len = lockprof_report(body, sizeof(body));
+        type = "text/plain";
+    }
+    else
+    {
+        status = "404 Not Found";
+        type = "text/plain";
+        len = snprintf(body, sizeof(body), "try /metrics, /latency, /locks or /hotkeys\n");
+    }
+    snprintf(head, MAXLINE, "HTTP/1.0 %s\r\nContent-Type: %s\r\nContent-Length: %zu\r\nConnection: close\r\n\r\n", status, type, len);
+    if (rio_writen(fd, head, strlen(head)) > 0)
+        rio_writen(fd, body, len);
+}
+
+static void *admin_routine(void *vargp)
+{
+    int listenfd = *(int *)vargp, connfd;
+
+    Free(vargp);
+    Pthread_detach(pthread_self());
+    while (1)
+    {
+        if ((connfd = accept(listenfd, NULL, NULL)) < 0)
+            continue;
+        admin_handle(connfd);
+        close(connfd);
+    }
+    return NULL;
+}
+
+// port에서 지표를 내보내는 관리용 스레드를 띄운다 (프록시 포트와 분리)
+void metrics_serve(char *port)
+{
+    pthread_t tid;
+    int *listenfdp = Malloc(sizeof(int));
+
+    *listenfdp = Open_listenfd(port);
+    Pthread_create(&tid, NULL, admin_routine, listenfdp);
+}
@@ -0,0 +1,35 @@
+#ifndef __METRICS_H__
+#define __METRICS_H__
+
+#include <stddef.h>
+
+// 운영 지표 카운터, 스레드마다 자기 카운터만 올리고 읽을 때 모든 스레드의 값을 더한다
+// 이름과 설명은 metrics.c의 metric_info 표에 같은 순서로 있다
+#define M_REQUESTS 0
+#define M_CACHE_HITS 1
+#define M_CACHE_MISSES 2
+#define M_CACHE_INSERTS 3
+#define M_CACHE_EVICTIONS 4
+#define M_NEGCACHE_HITS 5
+#define M_BYTES_FROM_ORIGIN 6
+#define M_BYTES_TO_CLIENT 7
+#define M_CONNS_ACCEPTED 8
+#define M_CONNS_ACTIVE 9 // gauge, 연결을 맡을 때 +1 놓을 때 -1
+#define M_CONNS_REJECTED 10
+#define M_ORIGIN_REQUESTS 11
+#define M_ORIGIN_REUSED 12
+#define M_ORIGIN_ERRORS 13
+#define M_ORIGIN_TIMEOUTS 14
+// Rio 계측 (RIO_STATS 빌드에서만 올라간다)
+#define M_IO_SYSCALLS 15
+#define M_IO_SHORT 16 // 짧은 읽기와 쓰기
+#define M_IO_BYTES 17
+#define M_IO_COPIED_BYTES 18
+#define M_NCOUNTERS 19
+
+void metrics_add(int id, long n);
+long metrics_get(int id);
+size_t metrics_render(char *buf, size_t size);
+void metrics_serve(char *port);
+
+#endif /* __METRICS_H__ */
@@ -0,0 +1,220 @@
+#include "nbconnect.h"
+
+// open_clientfd는 주소 목록을 하나씩 blocking connect로 시도해서, 응답 없는 첫 주소가
+// 커널의 SYN 타임아웃 내내 워커를 붙잡는다
+// 여기서는 RFC 8305(Happy Eyeballs v2)처럼 IPv6/IPv4 후보를 번갈아 CONNECT_ATTEMPT_DELAY_MS 간격으로
+// non-blocking connect를 시작하고 먼저 연결된 것을 쓴다
+// 시도마다의 타임아웃과 전체 타임아웃을 따로 둔다
+
+static long long now_ms(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000LL + ts.tv_nsec / 1000000;
+}
+
+// 리졸버가 준 순서(선호도 순)를 유지하면서 첫 주소의 패밀리부터 패밀리를 번갈아 배치 (RFC 8305 4절)
+static void interleave(connect_race *cr, dns_answer *answer)
+{
+    int used[DNS_MAX_ADDRS] = {0};
+    int i, family = answer->naddr ? answer->addr[0].family : AF_INET6, found;
+
+    cr->naddr = 0;
+    while (cr->naddr < answer->naddr)
+    {
+        found = 0;
+        for (i = 0; i < answer->naddr; i = i + 1)
+        {
+            if (!used[i] && answer->addr[i].family == family)
+            {
+                used[i] = 1;
+                cr->addr[cr->naddr] = answer->addr[i];
+                cr->naddr = cr->naddr + 1;
+                found = 1;
+                break;
+            }
+        }
+        // 이번 패밀리가 바닥나면 남은 것 중 아무거나
+        if (!found)
+        {
+            for (i = 0; used[i]; i = i + 1)
+                ;
+            used[i] = 1;
+            cr->addr[cr->naddr] = answer->addr[i];
+            cr->naddr = cr->naddr + 1;
+        }
+        family = family == AF_INET6 ? AF_INET : AF_INET6;
+    }
+}
+
+static void close_attempt(connect_race *cr, int i)
+{
+    close(cr->fd[i]);
+    cr->fd[i] = -1;
+}
+
+// 남은 후보로 시도 하나를 시작, 바로 연결됐다면 그 fd를, 아니면 -1
+// 즉시 실패한 후보는 건너뛰고 다음 후보로 넘어간다
+static int start_attempt(connect_race *cr, long long now)
+{
+    int fd, i;
+    while (cr->next < cr->naddr)
+    {
+        i = cr->next;
+        cr->next = cr->next + 1;
+        dns_addr *a = &cr->addr[i];
+        if ((fd = socket(a->family, a->socktype | SOCK_NONBLOCK | SOCK_CLOEXEC, a->protocol)) < 0)
+        {
+            cr->last_errno = errno;
+            continue;
+        }
+        if (connect(fd, (SA *)&a->addr, a->addrlen) == 0)
+            return fd;
+        if (errno != EINPROGRESS)
+        {
+            cr->last_errno = errno;
+            close(fd);
+            continue;
+        }
+        cr->fd[i] = fd;
+        cr->started[i] = now;
+        cr->next_attempt = now + CONNECT_ATTEMPT_DELAY_MS;
+        return -1;
+    }
+    return -1;
+}
+
+void connect_race_start(connect_race *cr, dns_answer *answer, int attempt_timeout_ms, int total_timeout_ms)
+{
+    long long now = now_ms();
+    int i;
+    interleave(cr, answer);
+    for (i = 0; i < DNS_MAX_ADDRS; i = i + 1)
+        cr->fd[i] = -1;
+    cr->next = 0;
+    cr->next_attempt = now;
+    cr->deadline = now + total_timeout_ms;
+    cr->attempt_timeout = attempt_timeout_ms;
+    cr->last_errno = ETIMEDOUT;
+}
+
+// 진행 중인 시도들을 pfds(DNS_MAX_ADDRS 칸)에 채우고, 다음에 step을 불러야 할 때까지의 시간을 *timeout_ms에
+// 리턴값은 채운 pollfd 수
+int connect_race_pollfds(connect_race *cr, struct pollfd *pfds, int *timeout_ms)
+{
+    long long now = now_ms(), wake = cr->deadline;
+    int i, n = 0;
+    for (i = 0; i < cr->naddr; i = i + 1)
+    {
+        if (cr->fd[i] < 0)
+            continue;
+        pfds[n].fd = cr->fd[i];
+        pfds[n].events = POLLOUT;
+        pfds[n].revents = 0;
+        n = n + 1;
+        if (cr->started[i] + cr->attempt_timeout < wake)
+            wake = cr->started[i] + cr->attempt_timeout;
+    }
+    if (cr->next < cr->naddr && cr->next_attempt < wake)
+        wake = cr->next_attempt;
+    *timeout_ms = wake > now ? (int)(wake - now) : 0;
+    return n;
+}
+
+// poll 결과(pfds)와 현재 시간으로 경주를 한 단계 진행
+// 연결된 fd(non-blocking 상태)를 리턴하면 나머지 시도는 모두 닫힌다
+// 아직 진행 중이면 -2, 모든 후보가 실패했거나 전체 타임아웃이면 errno를 설정하고 -1
+int connect_race_step(connect_race *cr, struct pollfd *pfds, int npfds)
+{
+    long long now = now_ms();
+    int i, j, fd, err, pending = 0;
+    socklen_t len;
+
+    for (j = 0; j < npfds; j = j + 1)
+    {
+        if (pfds[j].revents == 0)
+            continue;
+        for (i = 0; i < cr->naddr && cr->fd[i] != pfds[j].fd; i = i + 1)
+            ;
+        if (i == cr->naddr)
+            continue;
+        err = 0;
+        len = sizeof(err);
+        if (getsockopt(cr->fd[i], SOL_SOCKET, SO_ERROR, &err, &len) < 0)
+            err = errno;
+        if (err == 0)
+        {
+            fd = cr->fd[i];
+            cr->fd[i] = -1;
+            connect_race_abort(cr);
+            return fd;
+        }
+        // 실패한 시도가 있으면 딜레이를 기다리지 않고 바로 다음 후보로
+        cr->last_errno = err;
+        close_attempt(cr, i);
+        cr->next_attempt = now;
+    }
+    if (now >= cr->deadline)
+    {
+        connect_race_abort(cr);
+        errno = ETIMEDOUT;
+        return -1;
+    }
+    for (i = 0; i < cr->naddr; i = i + 1)
+    {
+        if (cr->fd[i] >= 0 && now - cr->started[i] >= cr->attempt_timeout)
+        {
+            cr->last_errno = ETIMEDOUT;
+            close_attempt(cr, i);
+            cr->next_attempt = now;
+        }
+    }
+    if (cr->next < cr->naddr && now >= cr->next_attempt && (fd = start_attempt(cr, now)) >= 0)
+    {
+        connect_race_abort(cr);
+        return fd;
+    }
+    for (i = 0; i < cr->naddr; i = i + 1)
+        pending = pending || cr->fd[i] >= 0;
+    if (pending || cr->next < cr->naddr)
+        return -2;
+    errno = cr->last_errno;
+    return -1;
+}
+
+// 진행 중인 시도를 모두 닫는다
+void connect_race_abort(connect_race *cr)
+{
+    int i;
+    for (i = 0; i < cr->naddr; i = i + 1)
+    {
+        if (cr->fd[i] >= 0)
+            close_attempt(cr, i);
+    }
+    cr->next = cr->naddr;
+}
+
+// 스레드 모델용, 경주가 끝날 때까지 poll로 기다리고 연결된 fd를 blocking 모드로 돌려서 리턴
+// 실패하면 errno를 설정하고 -1
+int connect_race_blocking(dns_answer *answer, int attempt_timeout_ms, int total_timeout_ms)
+{
+    connect_race cr;
+    struct pollfd pfds[DNS_MAX_ADDRS];
+    int n, timeout, fd;
+
+    connect_race_start(&cr, answer, attempt_timeout_ms, total_timeout_ms);
+    // 첫 시도는 기다리지 않고 바로 시작
+    n = 0;
+    while ((fd = connect_race_step(&cr, pfds, n)) == -2)
+    {
+        n = connect_race_pollfds(&cr, pfds, &timeout);
+        if (poll(pfds, n, timeout) < 0 && errno != EINTR)
+        {
+            connect_race_abort(&cr);
+            return -1;
+        }
+    }
+    if (fd >= 0)
+        fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) & ~O_NONBLOCK);
+    return fd;
+}
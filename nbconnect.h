@@ -0,0 +1,41 @@
+#ifndef __NBCONNECT_H__
+#define __NBCONNECT_H__
+
+#include <poll.h>
+#include "dnscache.h"
+
+// 앞 시도가 끝나지 않았을 때 다음 주소로 시도를 시작하기까지 기다리는 시간 (RFC 8305의 Connection Attempt Delay)
+#ifndef CONNECT_ATTEMPT_DELAY_MS
+#define CONNECT_ATTEMPT_DELAY_MS 250
+#endif
+// 주소 하나에 대한 connect 시도의 최대 시간
+#ifndef CONNECT_ATTEMPT_TIMEOUT_MS
+#define CONNECT_ATTEMPT_TIMEOUT_MS 2000
+#endif
+// 모든 주소에 대한 시도를 합친 최대 시간
+#ifndef CONNECT_TIMEOUT_MS
+#define CONNECT_TIMEOUT_MS 5000
+#endif
+
+// 여러 주소(IPv6/IPv4)로 non-blocking connect를 경주시키는 상태
+// 스레드 모델은 connect_race_blocking을, 이벤트 루프는 start/pollfds/step을 직접 써서
+// 자기 poll/epoll에 fd와 타임아웃을 넣으면 된다
+typedef struct
+{
+    dns_addr addr[DNS_MAX_ADDRS]; // 패밀리를 번갈아 가며 정렬된 후보
+    int naddr;
+    int next; // 다음에 시도할 후보
+    int fd[DNS_MAX_ADDRS]; // 진행 중인 시도, 없으면 -1
+    long long started[DNS_MAX_ADDRS];
+    long long next_attempt, deadline; // 단조 시간(ms)
+    int attempt_timeout;
+    int last_errno;
+} connect_race;
+
+void connect_race_start(connect_race *cr, dns_answer *answer, int attempt_timeout_ms, int total_timeout_ms);
+int connect_race_pollfds(connect_race *cr, struct pollfd *pfds, int *timeout_ms);
+int connect_race_step(connect_race *cr, struct pollfd *pfds, int npfds);
+void connect_race_abort(connect_race *cr);
+int connect_race_blocking(dns_answer *answer, int attempt_timeout_ms, int total_timeout_ms);
+
+#endif /* __NBCONNECT_H__ */
@@ -0,0 +1,34 @@
+#ifndef __PROBES_H__
+#define __PROBES_H__
+
+// 요청 처리 단계의 USDT 정적 프로브, 프록시를 다시 띄우지 않고 perf나 bpftrace를 붙일 수 있다
+// -DPROXY_USDT=1로 빌드하면 sys/sdt.h(systemtap-sdt-dev)의 프로브가 되어 nop 한 개씩만 남고,
+// 기본 빌드에서는 인자도 평가하지 않는 빈 문장이라 흔적이 없다
+//   make clean && make CFLAGS="-g -Wall -DPROXY_USDT=1"
+//   bpftrace -e 'usdt:./proxy:proxy:cache__lookup { @[arg1 ? "hit" : "miss"] = count(); }'
+//
+// provider는 proxy, 프로브와 인자
+//   request__start       fd, uri(char *), uri 길이
+//   cache__lookup        캐시 키(char *), hit이면 1, hit이면 캐시 index 아니면 -1
+//   origin__connect      host(char *), port, origin fd(실패하면 음수), 풀에서 꺼냈으면 1
+//   origin__first__byte  origin fd, status line(char *)
+//   cache__insert        캐시 키(char *), 캐시 index, 객체 크기(헤더 포함)
+//   cache__evict         캐시 index, 밀려나는 객체 크기, 밀려나는 키(char *)
+//   request__end         fd, 연결을 유지하면 1
+
+#ifndef PROXY_USDT
+#define PROXY_USDT 0
+#endif
+
+#if PROXY_USDT
+#include <sys/sdt.h>
+#define PROBE2(name, a, b) DTRACE_PROBE2(proxy, name, a, b)
+#define PROBE3(name, a, b, c) DTRACE_PROBE3(proxy, name, a, b, c)
+#define PROBE4(name, a, b, c, d) DTRACE_PROBE4(proxy, name, a, b, c, d)
+#else
+#define PROBE2(name, a, b) ((void)0)
+#define PROBE3(name, a, b, c) ((void)0)
+#define PROBE4(name, a, b, c, d) ((void)0)
+#endif
+
+#endif /* __PROBES_H__ */
@@ -1,81 +1,439 @@
+// strptime, timegm
+#define _DEFAULT_SOURCE
+#define _XOPEN_SOURCE 700
 #include <stdio.h>
+#include <limits.h>
+#include <poll.h>
+#include <netinet/tcp.h>
 #include "csapp.h"
+#include "dnscache.h"
+#include "nbconnect.h"
+#include "connpool.h"
+#include "timerwheel.h"
+#include "sbuf.h"
+#include "listener.h"
+#include "accesslog.h"
+#include "latency.h"
+#include "metrics.h"
+#include "probes.h"
+#include "lockprof.h"
+#include "hotkeys.h"
 
 void cache_init();
-void *thread_routine(void *fdP);
-void doit(int connfd);
+int cache_key(char *uri, char *key);
+int cache_find(char *uri, char *client_header);
+int cache_eviction();
+void cache_reorder(int target);
+void cache_uri(char *uri, char *hdr, size_t hdrlen, char *body, size_t bodylen, char *client_header);
+int header_value(const char *headers, size_t len, const char *name, char *value, size_t valsize);
+int response_status(const char *buf, size_t size);
+size_t header_length(const char *buf, size_t size);
+time_t parse_http_date(const char *date);
+int cache_not_modified(int index, char *client_header);
+void send_not_modified(int connfd, int index, int keepalive);
+int cache_send_range(int connfd, int index, char *client_header, int keepalive);
+void send_cached(int connfd, int index, int keepalive);
+const char *client_conn_header(int keepalive);
+int has_token(const char *value, const char *token);
+size_t filter_headers(const char *headers, size_t len, char *out, size_t outsize, const char *const *skip);
+void *thread_routine(void *vargp);
+void serve_client(int connfd);
+void send_overloaded(int connfd);
+
+// 과부하 제어, 한도를 넘으면 느려지며 같이 무너지는 대신 일부를 빨리 거절한다
+// 동시에 처리하는 클라이언트 연결 수 = 워커 스레드 수
+#ifndef MAX_ACTIVE_CONNS
+#define MAX_ACTIVE_CONNS 64
+#endif
+// 워커를 기다리는 accept된 연결의 큐 크기
+#ifndef CONN_QUEUE_SIZE
+#define CONN_QUEUE_SIZE 128
+#endif
+// 큐가 가득 차면 accept를 멈추고 이만큼 자리가 나기를 기다린 뒤, 그래도 없으면 503으로 거절
+// accept 한 번에 받은 연결들이 이 시간을 나눠 쓴다 (연결마다 따로 기다리지 않는다)
+#ifndef ACCEPT_PAUSE_MS
+#define ACCEPT_PAUSE_MS 100
+#endif
+// 켜면 로그용으로 클라이언트 주소의 역방향 DNS를 별도 스레드에서 찾아 찍는다
+#ifndef ACCEPT_REVERSE_DNS
+#define ACCEPT_REVERSE_DNS 0
+#endif
+// 동시에 진행하는 origin 요청 수, 넘으면 캐시 미스 요청은 503
+#ifndef MAX_ORIGIN_FETCHES
+#define MAX_ORIGIN_FETCHES 48
+#endif
+
+sbuf_t connq; // accept된 connfd 큐
+sem_t fetch_slots; // 남은 origin 요청 자리
+
+// 연결 하나의 단계별 타임아웃 상태, 타이밍 휠의 타이머 하나로 현재 단계의 deadline만 추적한다
+#define PHASE_IDLE 1 // keep-alive 연결에서 다음 요청을 기다리는 중
+#define PHASE_CLIENT_READ 2 // 요청 헤더를 읽는 중
+#define PHASE_ORIGIN 3 // origin에 요청을 보내고 응답을 읽는 중
+#define PHASE_CLIENT_WRITE 4 // 클라이언트에 응답을 쓰는 중
+#define PHASE_CONNECT 5 // 헤더를 다 읽고 캐시 확인부터 origin 연결까지
+
+typedef struct
+{
+    wheel_timer timer;
+    int connfd, backfd; // backfd는 origin 연결이 없으면 -1
+    int phase;
+    volatile int expired; // 타임아웃으로 끊긴 단계, 아직이면 0
+    // 청크마다 휠 락을 잡지 않도록 진행은 deadline만 뒤로 적어두고, 타이머가 울렸을 때 확인한다
+    volatile long long deadline_at; // 현재 단계의 deadline (monotonic ms)
+    volatile long long timer_at; // 걸어둔 타이머가 울릴 시각, 걸려 있지 않으면 0
+} conn_deadline;
+
+void deadline_set(conn_deadline *dl, int phase, int ms);
+void deadline_progress(conn_deadline *dl, int phase, int ms);
+void deadline_clear(conn_deadline *dl);
+int doit(int connfd, rio_t *rio, int keepalive_allowed, conn_deadline *dl);
 int parse_uri(char *uri, char *hostname, char *path, int *port);
-void makeHTTPheader(char *HTTPheader, char *hostname, char *path, int port, rio_t *client_rio);
+int makeHTTPheader(char *HTTPheader, char *hostname, char *path, int port, rio_t *client_rio, char *client_header);
+void clienterror(int fd, char *cause, char *errnum, char *shortmsg, char *longmsg);
+int relay_response(int connfd, rio_t *backrio, char *statusline, int client_http10, int *client_keepalive, char *uri_store, char *client_header, conn_deadline *dl);
+void negcache_init();
+int negcache_find(char *key, int *status, char *reason);
+void negcache_insert(char *key, int status, char *reason);
 
 // main function
 // 프록시 서버도 main의 알고리즘, doit의 상단부는 tiny와 같으니 sequential한 파트는 주석 생략
+// PROXY_NO_MAIN으로 컴파일하면 main 없이 나머지 함수만 (bench/microbench가 링크해서 쓴다)
+#ifndef PROXY_NO_MAIN
 int main(int argc, char **argv)
 {
-    int listenfd;
-    char hostname[MAXLINE], port[MAXLINE];
-    socklen_t clientlen;
-    struct sockaddr_storage clientaddr;
+    int i, n, listenfd;
+    int fds[ACCEPT_BATCH];
+    struct timespec pause_end;
     pthread_t tid;
+    // 단계별 지연 시간, SIGUSR1을 받으면 stderr로 리포트 (다른 스레드보다 먼저 시그널 마스크를 정한다)
+    latency_init();
+    // 로그는 writer 스레드가 모아서 출력한다
+    log_init();
+    // 많이 요청되는 uri 추적, 스레드별 기록을 merge 스레드가 주기적으로 합친다
+    hotkeys_init();
     // 캐시 ON
     cache_init(); 
-    if (argc != 2)
+    negcache_init();
+    // DNS 캐시 ON, PROXY_HOSTS가 지정되면 실제 DNS 대신 그 hosts 파일로만 이름을 푼다 (테스트용)
+    dnscache_init();
+    connpool_init();
+    timerwheel_init();
+    // 풀에 있던 연결을 origin이 닫은 뒤에 쓰면 SIGPIPE가 오니 무시하고 write의 에러로 처리
+    Signal(SIGPIPE, SIG_IGN);
+    if (getenv("PROXY_HOSTS") != NULL)
+    {
+        if (dnscache_load_hosts(getenv("PROXY_HOSTS")) < 0)
+            unix_error("PROXY_HOSTS error");
+        dnscache_set_resolver(dns_hosts_resolver);
+    }
+    if (argc != 2 && argc != 3)
     {
-        fprintf(stderr, "usage: %s <port>\n", argv[0]);
+        fprintf(stderr, "usage: %s <port> [admin port]\n", argv[0]);
         exit(1);
     }
     listenfd = Open_listenfd(argv[1]);
+    // 관리 포트가 주어지면 거기서 지표를 내보낸다 (GET /metrics, GET /latency)
+    if (argc == 3)
+        metrics_serve(argv[2]);
+    // 연결마다 스레드를 만드는 대신 미리 만들어둔 워커들이 큐에서 connfd를 꺼내 처리한다 (prethreading)
+    // 워커 수가 동시 연결 수의 상한이 되고, 나머지는 큐에서 기다린다
+    sbuf_init(&connq, CONN_QUEUE_SIZE);
+    Sem_init(&fetch_slots, 0, MAX_ORIGIN_FETCHES);
+    for (i = 0; i < MAX_ACTIVE_CONNS; i = i + 1)
+        Pthread_create(&tid, NULL, thread_routine, NULL);
+    // 듣기 소켓은 논블로킹으로 두고, 깨어날 때마다 쌓인 연결을 한 번에 받아 큐에 넣는다
+    // accept 경로에서는 주소 변환도 출력도 하지 않는다 (워커가 한다)
+    if (listener_init(listenfd, ACCEPT_REVERSE_DNS) < 0)
+        unix_error("listener_init error");
     while (1)
     {
-        // sever main에서 일련의 처리를 하는 대신 스레드를 분기
-        // 각 연결에 대해 이후의 과정은 스레드 내에서 병렬적으로 처리되며
-        // main은 다시 while문의 처음으로 돌아가 새로운 연결을 기다린다
-        clientlen = sizeof(clientaddr);
-        // 스레드마다 각각의 connfd를 유지하기 위해 연결마다 메모리를 할당하여 포인팅
-        // (따로 안쓰고 thread_routine에서 바로 버리니까 할당 안하고 덮어씌워도 문제없을듯)
-        int *connfdp = Malloc(sizeof(int));
-        *connfdp = Accept(listenfd, (SA *)&clientaddr, &clientlen);
-        Getnameinfo((SA *)&clientaddr, clientlen, hostname, MAXLINE, port, MAXLINE, 0);
-        printf("Accepted connection from (%s, %s)\n", hostname, port);
-        // thread_routine를 실행하는 thread 생성
-        // 연결마다 고유한 connfdp를 thread_routine의 입력으로 가져간다
-        Pthread_create(&tid, NULL, thread_routine, connfdp);
+        if ((n = listener_accept_batch(listenfd, fds, ACCEPT_BATCH)) < 0)
+        {
+            // 기다리는 연결이 없으면 새 연결까지 잠들고
+            // fd가 바닥난 경우(EMFILE 등)에는 잠깐 쉬어서 워커들이 연결을 정리할 시간을 준다
+            if (errno == EAGAIN || errno == EWOULDBLOCK)
+                listener_wait(listenfd);
+            else
+                usleep(10000);
+            continue;
+        }
+        metrics_add(M_CONNS_ACCEPTED, n);
+        // 배치 전체가 자리를 기다릴 수 있는 시각, 한 번 다 쓰면 남은 연결은 기다리지 않고 바로 거절된다
+        clock_gettime(CLOCK_REALTIME, &pause_end);
+        pause_end.tv_nsec = pause_end.tv_nsec + ACCEPT_PAUSE_MS * 1000000L;
+        pause_end.tv_sec = pause_end.tv_sec + pause_end.tv_nsec / 1000000000L;
+        pause_end.tv_nsec = pause_end.tv_nsec % 1000000000L;
+        for (i = 0; i < n; i = i + 1)
+        {
+            // 큐가 가득 찼으면 그동안 accept를 멈추고(나머지는 커널 backlog에서 기다린다) 잠깐 자리를 기다린다
+            // 그래도 자리가 없으면 요청을 읽지도 않고 미리 만들어둔 503으로 거절
+            if (sbuf_insert_until(&connq, fds[i], &pause_end) < 0)
+            {
+                send_overloaded(fds[i]);
+                Close(fds[i]);
+            }
+        }
     }
     return 0;
 }
+#endif /* PROXY_NO_MAIN */
+
+// 클라이언트 keep-alive 연결 하나에서 처리할 최대 요청 수, 마지막 요청에는 Connection: close로 답한다
+#ifndef CLIENT_MAX_REQUESTS
+#define CLIENT_MAX_REQUESTS 100
+#endif
+// 단계별 타임아웃 (초)
+// keep-alive 연결에서 다음 요청을 기다리는 시간
+#ifndef CLIENT_IDLE_TIMEOUT
+#define CLIENT_IDLE_TIMEOUT 5
+#endif
+// 다음 요청을 기다리는 동안 워커를 기다리는 연결이 있는지 보는 간격 (ms)
+#ifndef IDLE_QUEUE_CHECK_MS
+#define IDLE_QUEUE_CHECK_MS 100
+#endif
+// 요청 줄을 받은 뒤 헤더를 다 받기까지
+#ifndef CLIENT_HEADER_TIMEOUT
+#define CLIENT_HEADER_TIMEOUT 10
+#endif
+// origin이 요청 후 첫 바이트를 보내기까지, 그리고 응답 중 읽기 사이의 간격
+// (연결 자체의 타임아웃은 nbconnect의 CONNECT_TIMEOUT_MS)
+#ifndef ORIGIN_TIMEOUT
+#define ORIGIN_TIMEOUT 15
+#endif
+// 헤더를 다 읽은 뒤 origin 주소를 찾고 연결하기까지
+// DNS 대기(DNS_RESOLVE_TIMEOUT_MS)와 connect(CONNECT_TIMEOUT_MS)는 각자 끝이 있으니 그게 끝난 뒤에 확인한다
+// 둘을 다 쓴 요청이 여기서 먼저 504가 되지 않도록 기본값은 두 한도의 합
+#ifndef ORIGIN_CONNECT_TIMEOUT
+#define ORIGIN_CONNECT_TIMEOUT ((DNS_RESOLVE_TIMEOUT_MS + CONNECT_TIMEOUT_MS + 999) / 1000)
+#endif
+// 클라이언트에 쓰기 한 번이 끝나기까지
+#ifndef CLIENT_WRITE_TIMEOUT
+#define CLIENT_WRITE_TIMEOUT 10
+#endif
+
+static long long deadline_now_ms(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000LL + ts.tv_nsec / 1000000;
+}
+
+// 타이밍 휠 스레드에서 불리는 만료 콜백
+// 타이머를 건 뒤에 deadline_progress로 deadline이 밀렸다면 남은 시간만큼 다시 기다린다
+// 해당 단계에서 블록된 소켓을 shutdown해서 워커의 read/write가 바로 돌아오게 하고, 워커는 expired를 보고 처리한다
+// 연결 단계는 끊을 소켓이 없으니 표시만 해두고, 워커가 연결 시도를 마친 뒤 504를 보낸다
+static void deadline_expired(void *arg)
+{
+    conn_deadline *dl = arg;
+    // phase를 먼저 읽는다, deadline_progress는 deadline을 적은 뒤에 phase를 바꾼다
+    int phase = __atomic_load_n(&dl->phase, __ATOMIC_ACQUIRE);
+    long long now = deadline_now_ms(), left = dl->deadline_at - now;
+    if (left > 0)
+    {
+        dl->timer_at = now + left;
+        timer_arm(&dl->timer, left, deadline_expired, dl);
+        return;
+    }
+    dl->timer_at = 0;
+    dl->expired = phase;
+    if (phase == PHASE_ORIGIN)
+    {
+        if (dl->backfd >= 0)
+            shutdown(dl->backfd, SHUT_RDWR);
+    }
+    else if (phase != PHASE_CONNECT)
+        shutdown(dl->connfd, SHUT_RDWR);
+}
+
+// 현재 단계를 phase로 바꾸고 deadline을 지금부터 ms 뒤로 옮긴다
+void deadline_set(conn_deadline *dl, int phase, int ms)
+{
+    // 만료 콜백이 도는 중이라면 끝난 뒤에 단계를 바꾼다
+    timer_cancel(&dl->timer);
+    dl->phase = phase;
+    dl->expired = 0;
+    dl->deadline_at = deadline_now_ms() + ms;
+    dl->timer_at = dl->deadline_at;
+    timer_arm(&dl->timer, ms, deadline_expired, dl);
+}
+
+// 청크 하나를 주고받기 직전에 불러서 phase의 deadline을 지금부터 ms 뒤로 미룬다
+// 걸린 타이머가 새 deadline보다 늦게 울리지 않으면 휠은 건드리지 않고 deadline만 적어둔다
+// (릴레이 중 origin 읽기와 클라이언트 쓰기가 번갈아도 휠 락은 타이머가 울릴 때쯤 한 번만 잡힌다)
+void deadline_progress(conn_deadline *dl, int phase, int ms)
+{
+    long long deadline = deadline_now_ms() + ms, timer_at = dl->timer_at;
+    if (dl->expired || timer_at == 0 || timer_at > deadline)
+    {
+        deadline_set(dl, phase, ms);
+        return;
+    }
+    dl->deadline_at = deadline;
+    __atomic_store_n(&dl->phase, phase, __ATOMIC_RELEASE);
+}
+
+// 타이머를 해제하고 origin 연결과의 관계를 끊는다 (풀에 반납한 연결이 대신 끊기지 않도록)
+void deadline_clear(conn_deadline *dl)
+{
+    timer_cancel(&dl->timer);
+    dl->timer_at = 0;
+    dl->backfd = -1;
+}
 
-void *thread_routine(void *fdP)
+// 워커 스레드, 큐에서 연결을 하나씩 꺼내 끝날 때까지 처리한다
+void *thread_routine(void *vargp)
 {
-    // 각 스레드별 connfd는 입력으로 가져온 fdP = connfdp가 가리키던 할당된 위치의 fd값
-    int connfd = *((int *)fdP);
-    // 스레드 종료시 자원을 반납하고
     Pthread_detach(pthread_self());
-    // connfdp도 이미 connfd를 얻어 역할을 다했으니 반납
-    Free(fdP);
-    // 이후 sequential과 같은 과정 진행
-    doit(connfd);
+    while (1)
+        serve_client(sbuf_remove(&connq));
+    return NULL;
+}
+
+#if RIO_STATS
+// 요청 하나 동안 이 스레드의 Rio 카운터가 늘어난 만큼을 접근 로그와 지표에 넘긴다
+static void rio_account(rio_stats_t *before)
+{
+    unsigned long syscalls = rio_stats.syscalls - before->syscalls;
+    unsigned long long bytes = rio_stats.read_bytes + rio_stats.write_bytes - before->read_bytes - before->write_bytes;
+    unsigned long long copied = rio_stats.copy_bytes - before->copy_bytes;
+
+    log_request_io(syscalls, bytes, copied);
+    metrics_add(M_IO_SYSCALLS, syscalls);
+    metrics_add(M_IO_SHORT, rio_stats.short_reads + rio_stats.short_writes - before->short_reads - before->short_writes);
+    metrics_add(M_IO_BYTES, bytes);
+    metrics_add(M_IO_COPIED_BYTES, copied);
+}
+#endif
+
+// keep-alive 연결에서 다음 요청이 올 때까지 기다린다, 그만 기다리고 연결을 닫아야 하면 0
+// 큐에 워커를 기다리는 연결이 생기면 idle timeout까지 워커를 붙잡고 있지 않고 바로 양보한다
+static int idle_wait(rio_t *rio, conn_deadline *dl)
+{
+    struct pollfd pfd;
+
+    // 파이프라이닝으로 이미 받아둔 요청이 있으면 기다릴 것이 없다
+    if (rio->rio_cnt > 0)
+        return 1;
+    pfd.fd = rio->rio_fd;
+    pfd.events = POLLIN;
+    while (poll(&pfd, 1, IDLE_QUEUE_CHECK_MS) == 0)
+    {
+        if (dl->expired || sbuf_count(&connq) > 0)
+            return 0;
+    }
+    // 요청이 왔거나, 클라이언트가 닫았거나, idle timeout으로 끊겼다면 doit의 읽기가 알아서 처리한다
+    return 1;
+}
+
+// 클라이언트 연결 하나를 닫힐 때까지 처리
+void serve_client(int connfd)
+{
+    int nreq = 0, keepalive, nodelay = 1;
+    char hostname[NI_MAXHOST], port[NI_MAXSERV];
+    rio_t rio;
+    conn_deadline dl;
+    metrics_add(M_CONNS_ACTIVE, 1);
+    // accept4가 논블로킹으로 만든 소켓을 rio가 쓸 수 있게 블로킹으로 되돌리고, 주소는 숫자로만 찍는다
+    listener_set_blocking(connfd);
+    // 응답은 헤더와 body를 따로 쓰는 경우가 많아서 Nagle이 켜져 있으면 클라이언트의 delayed ACK(~40ms)를 기다리게 된다
+    setsockopt(connfd, IPPROTO_TCP, TCP_NODELAY, &nodelay, sizeof(nodelay));
+    listener_format_peer(connfd, hostname, sizeof(hostname), port, sizeof(port));
+    log_msg(LOG_DEBUG, "Accepted connection from (%s, %s)", hostname, port);
+    log_request_client(hostname);
+    // 클라이언트가 keep-alive라면 같은 연결, 같은 rio에서 다음 요청을 계속 읽는다
+    // 파이프라이닝으로 미리 도착한 요청은 rio 버퍼에 남아 있다가 순서대로 처리되고 응답도 그 순서로 나간다
+    // 요청 사이에는 idle timeout이 걸려 있어서, 다음 요청이 오지 않으면 타이밍 휠이 연결을 끊는다
+    // 큐에 기다리는 연결이 있으면 keep-alive를 끝내서 워커를 양보한다
+    // 다음 요청을 기다리는 중에 큐가 차도 idle_wait가 연결을 닫아 양보한다
+    Rio_readinitb(&rio, connfd);
+    timer_init(&dl.timer);
+    dl.connfd = connfd;
+    dl.backfd = -1;
+    dl.timer_at = 0;
+    while (1)
+    {
+        nreq = nreq + 1;
+        deadline_set(&dl, PHASE_IDLE, CLIENT_IDLE_TIMEOUT * 1000);
+        if (nreq > 1 && !idle_wait(&rio, &dl))
+            break;
+#if RIO_STATS
+        rio_stats_t before = rio_stats;
+#endif
+        log_request_begin();
+        keepalive = doit(connfd, &rio, nreq < CLIENT_MAX_REQUESTS && sbuf_count(&connq) == 0, &dl);
+#if RIO_STATS
+        rio_account(&before);
+#endif
+        log_request_end();
+        hotkey_end();
+        latency_end();
+        PROBE2(request__end, connfd, keepalive);
+        if (!keepalive)
+            break;
+    }
+    deadline_clear(&dl);
     Close(connfd);
+    metrics_add(M_CONNS_ACTIVE, -1);
+}
+
+// 과부하일 때의 응답, 파싱도 할당도 없이 미리 만들어둔 바이트를 그대로 쓴다
+static const char overloaded_response[] =
+    "HTTP/1.0 503 Service Unavailable\r\n"
+    "Connection: close\r\n"
+    "Retry-After: 1\r\n"
+    "Content-Length: 0\r\n"
+    "\r\n";
+
+// accept 루프에서도 불리는데 그 스레드에는 열린 access log 레코드가 없으니 여기서는 로그를 남기지 않는다
+// (거절은 M_CONNS_REJECTED로 센다, 요청 처리 중에 부른 워커는 직접 상태를 남긴다)
+void send_overloaded(int connfd)
+{
+    metrics_add(M_CONNS_REJECTED, 1);
+    // 쓰기가 막혀도 기다리지 않는다, 못 보내면 그냥 닫힌다
+    send(connfd, overloaded_response, sizeof(overloaded_response) - 1, MSG_DONTWAIT | MSG_NOSIGNAL);
 }
 
 /////////////////// cache imp. part
 
+#ifndef MAX_CACHE_SIZE
 #define MAX_CACHE_SIZE 1049000
+#endif
+#ifndef MAX_OBJECT_SIZE
 #define MAX_OBJECT_SIZE 102400
+#endif
 // 오브젝트 최대갯수는 캐시용량과 오브젝트 용량으로 결정된다
 #define MAX_OBJECT_NUM ((int)(MAX_CACHE_SIZE / MAX_OBJECT_SIZE))
+// 교체 정책, FIFO는 들어온 지 가장 오래된 것을, LRU는 가장 오래 안 쓰인 것을 내보낸다
+#define CACHE_POLICY_FIFO 0
+#define CACHE_POLICY_LRU 1
+#ifndef CACHE_POLICY
+#define CACHE_POLICY CACHE_POLICY_FIFO
+#endif
 
 typedef struct 
 {
     char cache_obj[MAX_OBJECT_SIZE];
     char cache_uri[MAXLINE];
-    int order; // LRU order
+    // 헤더는 hop-by-hop 헤더를 빼고 Content-Length를 붙여서, body는 chunked였다면 풀어서 저장
+    size_t cache_size; // 바이너리 오브젝트도 있으니 strlen 대신 크기를 따로 기록
+    size_t cache_hdrlen; // 응답 헤더 부분(빈 줄 포함)의 길이, 그 뒤부터 body
+    // 응답의 Vary에 나열된 요청 헤더 이름들과, 기록 당시 그 헤더들의 값
+    // 같은 uri라도 cache_variant가 다르면 다른 오브젝트
+    char cache_vary[MAXLINE];
+    char cache_variant[MAXLINE];
+    unsigned long order; // 교체 순서, 가장 작은 것부터 내보낸다
     int alloc, read;
     // write, read 과정에서 스레드간의 충돌으로부터 보호할 세마포어 각 1개씩
-    sem_t write_mutex, read_mutex;
+    prof_lock write_mutex, read_mutex;
 } cache_block;
 
 typedef struct
 {
     cache_block cacheOBJ[MAX_OBJECT_NUM];
+    unsigned long clock; // order를 매기는 시계, 삽입(과 LRU에서는 hit)마다 1씩 증가
+    // 삽입은 한 번에 하나씩, cache_eviction이 고른 칸에 쓰기를 마칠 때까지 다른 삽입이 같은 칸을 차출하지 못하게 한다
+    prof_lock insert_mutex;
 } Cache;
 
 // cache 스트럭쳐의 초기값을 설정
@@ -87,39 +445,71 @@ void cache_init()
     {
         cache.cacheOBJ[index].order = 0;
         cache.cacheOBJ[index].alloc = 0;
-        Sem_init(&cache.cacheOBJ[index].write_mutex, 0, 1);
-        Sem_init(&cache.cacheOBJ[index].read_mutex, 0, 1);
+        prof_lock_init(&cache.cacheOBJ[index].write_mutex);
+        prof_lock_init(&cache.cacheOBJ[index].read_mutex);
         cache.cacheOBJ[index].read = 0;
     }
+    prof_lock_init(&cache.insert_mutex);
 }
 
 // 캐시를 읽기 전 세마포어 연산으로 타 스레드로부터 보호
 void readstart(int index)
 {
-    P(&cache.cacheOBJ[index].read_mutex);
+    prof_P(&cache.cacheOBJ[index].read_mutex, LS_CACHE_READSTART);
     cache.cacheOBJ[index].read = cache.cacheOBJ[index].read + 1;
     // +1한 read가 1이라면 이 스레드에서 readstart 이후 write할 가능성이 열려있다
     // 타 스레드의 write로부터도 보호
     if (cache.cacheOBJ[index].read == 1)
-        P(&cache.cacheOBJ[index].write_mutex);
-    V(&cache.cacheOBJ[index].read_mutex);
+        prof_P(&cache.cacheOBJ[index].write_mutex, LS_CACHE_READER_WRITE);
+    prof_V(&cache.cacheOBJ[index].read_mutex);
 }
 
 // readstart의 역연산으로 돌려놓음
 void readend(int index)
 {
-    P(&cache.cacheOBJ[index].read_mutex);
+    prof_P(&cache.cacheOBJ[index].read_mutex, LS_CACHE_READEND);
     cache.cacheOBJ[index].read = cache.cacheOBJ[index].read - 1;
     // -1한 read가 0이라면 readstart때 write 보호를 받은 오브젝트인데, 이제 다음 readstart 전까지 write할 가능성이 없다
     // write로부터 보호 해제
     if (cache.cacheOBJ[index].read == 0)
-        V(&cache.cacheOBJ[index].write_mutex);
-    V(&cache.cacheOBJ[index].read_mutex);
+        prof_V(&cache.cacheOBJ[index].write_mutex);
+    prof_V(&cache.cacheOBJ[index].read_mutex);
+}
+
+// Vary에 나열된 헤더 이름마다 클라이언트 요청의 값을 모아 variant 문자열을 만든다
+// ex. vary = "Accept-Encoding, Accept-Language" -> "accept-encoding=gzip\naccept-language=ko\n"
+void cache_variant(char *vary, char *client_header, char *variant)
+{
+    char name[MAXLINE], value[MAXLINE];
+    char *p = vary;
+    size_t len, used = 0;
+    variant[0] = '\0';
+    while (*p)
+    {
+        p = p + strspn(p, ", \t");
+        len = strcspn(p, ", \t");
+        if (len == 0)
+            break;
+        if (len >= MAXLINE)
+            len = MAXLINE - 1;
+        memcpy(name, p, len);
+        name[len] = '\0';
+        p = p + len;
+        if (!header_value(client_header, strlen(client_header), name, value, MAXLINE))
+            value[0] = '\0';
+        for (len = 0; name[len]; len = len + 1)
+            name[len] = tolower(name[len]);
+        used = used + snprintf(variant + used, MAXLINE - used, "%s=%s\n", name, value);
+        if (used >= MAXLINE)
+            break;
+    }
 }
 
 // 가용한 캐시가 있는지 탐색하고 있다면 index를 리턴하는 함수
-int cache_find(char *uri)
+// uri가 같아도 Vary로 갈리는 오브젝트라면 클라이언트 헤더로 만든 variant까지 같아야 한다
+int cache_find(char *uri, char *client_header)
 {
+    char variant[MAXLINE];
     int index = 0;
     // 각 캐시에 대해 탐색
     for (; index < MAX_OBJECT_NUM; index = index + 1)
@@ -127,21 +517,34 @@ int cache_find(char *uri)
         // 탐색 전 세마포어 보호
         readstart(index);
         if (cache.cacheOBJ[index].alloc && (strcmp(uri, cache.cacheOBJ[index].cache_uri) == 0))
-            break;
+        {
+            if (cache.cacheOBJ[index].cache_vary[0] == '\0')
+                break;
+            cache_variant(cache.cacheOBJ[index].cache_vary, client_header, variant);
+            if (strcmp(variant, cache.cacheOBJ[index].cache_variant) == 0)
+                break;
+        }
         // 가용하다면 보호를 유지한 채 break, 아니라면 보호를 풀고 다음 인덱스로
         readend(index);
     }
     // 가용한 캐시가 없다면 -1을 return
     if (index >= MAX_OBJECT_NUM)
+    {
+        metrics_add(M_CACHE_MISSES, 1);
         return -1;
+    }
+    metrics_add(M_CACHE_HITS, 1);
+#if CACHE_POLICY == CACHE_POLICY_LRU
+    cache_reorder(index);
+#endif
     return index;
 }
 
-// 빈 캐시, 혹은 LRU order가 제일 낮은 캐시를 골라 index를 리턴하는 함수
+// 빈 캐시, 혹은 order가 제일 낮은 캐시를 골라 index를 리턴하는 함수
 int cache_eviction()
 {
     //minorder는 upper bound에서 시작해서 자신보다 낮은 값이 나올때마다 갱신된다
-    int minorder = MAX_OBJECT_NUM + 1;
+    unsigned long minorder = ULONG_MAX, order;
     int minindex = 0;
     int index = 0;
     // 모든 index를 탐색하며 비교
@@ -155,124 +558,1110 @@ int cache_eviction()
             return index;
         }
         // 빈 캐시가 발견되지 않는 동안 minorder를 갱신하며 탐색
-        if (cache.cacheOBJ[index].order < minorder)
+        order = __atomic_load_n(&cache.cacheOBJ[index].order, __ATOMIC_RELAXED);
+        if (order < minorder)
         {
             minindex = index;
-            minorder = cache.cacheOBJ[index].order;
+            minorder = order;
         }
         readend(index);
     }
     // 빈 캐시가 발견되지 않고 for문이 종료되었다면 minindex를 return
+    // (insert_mutex를 쥐고 있어서 다른 스레드가 이 칸을 바꾸지 못한다)
+    metrics_add(M_CACHE_EVICTIONS, 1);
+    PROBE3(cache__evict, minindex, cache.cacheOBJ[minindex].cache_size, cache.cacheOBJ[minindex].cache_uri);
     return minindex;
 }
 
-// LRU order를 재정렬하는 함수
+// target을 가장 최근 order로 옮기는 함수
+// 나머지 칸을 하나씩 -1 하는 대신 시계를 올려 찍으니 다른 칸의 보호를 잡을 필요가 없다
+// (LRU의 hit에서는 read 보호만 쥔 채 부르므로 원자적으로 쓴다)
 void cache_reorder(int target)
 {
-    // 방금 쓴 target을 최고 order로
-    cache.cacheOBJ[target].order = MAX_OBJECT_NUM + 1;
-    int index = 0;
-    for (; index < MAX_OBJECT_NUM; index = index + 1)
-    {
-        // 나머지는 모두 order -1 (값을 수정하니 write 보호 필요)
-        if (index - target)
-        {
-            P(&cache.cacheOBJ[index].write_mutex);
-            cache.cacheOBJ[index].order = cache.cacheOBJ[index].order - 1;
-            V(&cache.cacheOBJ[index].write_mutex);
-        }
-    }
+    __atomic_store_n(&cache.cacheOBJ[target].order, __atomic_add_fetch(&cache.clock, 1, __ATOMIC_RELAXED), __ATOMIC_RELAXED);
 }
 
-// cache_eviction으로 차출된 캐시에 uri와 buf를기록하는 함수
-void cache_uri(char *uri, char *buf)
+// cache_eviction으로 차출된 캐시에 uri와 응답(헤더 hdr + body)을 기록하는 함수
+// 응답에 Vary가 있으면 client_header로 variant를 같이 기록하고, Vary: *면 캐시하지 않는다
+void cache_uri(char *uri, char *hdr, size_t hdrlen, char *body, size_t bodylen, char *client_header)
 {
+    char vary[MAXLINE], variant[MAXLINE] = "";
+    if (hdrlen + bodylen > MAX_OBJECT_SIZE)
+        return;
+    if (!header_value(hdr, hdrlen, "Vary", vary, MAXLINE))
+        vary[0] = '\0';
+    if (strchr(vary, '*'))
+        return;
+    if (vary[0])
+        cache_variant(vary, client_header, variant);
     // 차출
+    prof_P(&cache.insert_mutex, LS_CACHE_INSERT);
     int index = cache_eviction();
     // 쓰기 전 세마포어 보호
-    P(&cache.cacheOBJ[index].write_mutex);
+    prof_P(&cache.cacheOBJ[index].write_mutex, LS_CACHE_WRITER_WRITE);
     // buf, uri 카피
-    strcpy(cache.cacheOBJ[index].cache_obj, buf);
+    memcpy(cache.cacheOBJ[index].cache_obj, hdr, hdrlen);
+    memcpy(cache.cacheOBJ[index].cache_obj + hdrlen, body, bodylen);
+    RIO_STAT_COPY(hdrlen + bodylen);
+    cache.cacheOBJ[index].cache_size = hdrlen + bodylen;
+    cache.cacheOBJ[index].cache_hdrlen = hdrlen;
     strcpy(cache.cacheOBJ[index].cache_uri, uri);
+    strcpy(cache.cacheOBJ[index].cache_vary, vary);
+    strcpy(cache.cacheOBJ[index].cache_variant, variant);
     cache.cacheOBJ[index].alloc = 1;
     // LRU order 재정렬
     cache_reorder(index);
     // 보호 해제
-    V(&cache.cacheOBJ[index].write_mutex);
+    prof_V(&cache.cacheOBJ[index].write_mutex);
+    prof_V(&cache.insert_mutex);
+    metrics_add(M_CACHE_INSERTS, 1);
+    PROBE3(cache__insert, uri, index, hdrlen + bodylen);
+}
+
+// 캐시 키 정규화 옵션
+// 쿼리 파라미터 정렬은 의미가 바뀔 수 있는 origin도 있으니 기본은 끔
+#ifndef CACHE_KEY_SORT_QUERY
+#define CACHE_KEY_SORT_QUERY 0
+#endif
+// 캐시 키에서 뺄 쿼리 파라미터 이름들 (콤마로 구분, ex. "utm_source,utm_medium,fbclid")
+#ifndef CACHE_KEY_IGNORE_PARAMS
+#define CACHE_KEY_IGNORE_PARAMS ""
+#endif
+#define CACHE_KEY_MAX_PARAMS 64
+
+static int hexval(int c)
+{
+    if (c >= '0' && c <= '9')
+        return c - '0';
+    c = tolower(c);
+    if (c >= 'a' && c <= 'f')
+        return c - 'a' + 10;
+    return -1;
+}
+
+// RFC 3986의 unreserved 문자는 %인코딩 여부와 상관없이 같은 의미
+static int is_unreserved(int c)
+{
+    return isalnum(c) || c == '-' || c == '.' || c == '_' || c == '~';
+}
+
+// %XX 중 unreserved 문자는 디코딩하고, 나머지는 16진수를 대문자로 통일
+static void normalize_pct(char *str)
+{
+    char *src = str, *dst = str;
+    while (*src)
+    {
+        int hi, lo;
+        if (*src == '%' && (hi = hexval(src[1])) >= 0 && (lo = hexval(src[2])) >= 0)
+        {
+            int c = hi * 16 + lo;
+            if (is_unreserved(c))
+            {
+                *dst++ = c;
+            }
+            else
+            {
+                *dst++ = '%';
+                *dst++ = toupper(src[1]);
+                *dst++ = toupper(src[2]);
+            }
+            src = src + 3;
+            continue;
+        }
+        *dst++ = *src++;
+    }
+    *dst = '\0';
+}
+
+// RFC 3986 5.2.4 remove_dot_segments, /a/./b/../c -> /a/c
+static void remove_dot_segments(char *path)
+{
+    char in[MAXLINE], out[MAXLINE];
+    char *ip = in, *slash;
+    size_t outlen = 0;
+    strncpy(in, path, MAXLINE - 1);
+    in[MAXLINE - 1] = '\0';
+    while (*ip)
+    {
+        if (!strncmp(ip, "../", 3))
+            ip = ip + 3;
+        else if (!strncmp(ip, "./", 2))
+            ip = ip + 2;
+        else if (!strncmp(ip, "/./", 3))
+            ip = ip + 2;
+        else if (!strcmp(ip, "/."))
+        {
+            ip = ip + 1;
+            *ip = '/';
+        }
+        else if (!strncmp(ip, "/../", 4) || !strcmp(ip, "/.."))
+        {
+            // 상위 세그먼트로 올라가면서 output의 마지막 세그먼트를 버린다
+            if (ip[3] == '\0')
+            {
+                ip = ip + 2;
+                *ip = '/';
+            }
+            else
+            {
+                ip = ip + 3;
+            }
+            out[outlen] = '\0';
+            slash = strrchr(out, '/');
+            outlen = slash ? (size_t)(slash - out) : 0;
+        }
+        else if (!strcmp(ip, ".") || !strcmp(ip, ".."))
+            ip = ip + strlen(ip);
+        else
+        {
+            // 첫 세그먼트(앞의 '/' 포함, 다음 '/' 전까지)를 output으로 옮긴다
+            size_t seglen = 1 + strcspn(ip + 1, "/");
+            memcpy(out + outlen, ip, seglen);
+            outlen = outlen + seglen;
+            ip = ip + seglen;
+        }
+    }
+    out[outlen] = '\0';
+    strcpy(path, out);
+}
+
+static int cmp_param(const void *a, const void *b)
+{
+    return strcmp(*(char *const *)a, *(char *const *)b);
+}
+
+// 무시 목록에 있는 파라미터인지 확인
+static int ignored_param(const char *param)
+{
+    const char *list = CACHE_KEY_IGNORE_PARAMS;
+    size_t namelen = strcspn(param, "=");
+    while (*list)
+    {
+        size_t toklen = strcspn(list, ",");
+        if (toklen == namelen && !strncmp(list, param, namelen))
+            return 1;
+        list = list + toklen;
+        if (*list == ',')
+            list = list + 1;
+    }
+    return 0;
+}
+
+// 쿼리에서 무시할 파라미터를 빼고 옵션에 따라 정렬
+static void normalize_query(char *query)
+{
+    char copy[MAXLINE], *params[CACHE_KEY_MAX_PARAMS], *saveptr, *tok;
+    int n = 0, i;
+    strcpy(copy, query);
+    for (tok = strtok_r(copy, "&", &saveptr); tok != NULL; tok = strtok_r(NULL, "&", &saveptr))
+    {
+        if (ignored_param(tok))
+            continue;
+        // 파라미터가 너무 많으면 손대지 않는다
+        if (n == CACHE_KEY_MAX_PARAMS)
+            return;
+        params[n++] = tok;
+    }
+    if (CACHE_KEY_SORT_QUERY)
+        qsort(params, n, sizeof(char *), cmp_param);
+    query[0] = '\0';
+    for (i = 0; i < n; i = i + 1)
+    {
+        if (i)
+            strcat(query, "&");
+        strcat(query, params[i]);
+    }
+}
+
+// 같은 오브젝트를 가리키는 uri들이 같은 캐시 키를 갖도록 정규화
+// scheme/host 소문자화, 기본 포트 제거, fragment 제거, %인코딩과 dot segment 정규화, 쿼리 정리
+// 결과 key는 MAXLINE 크기 버퍼, 정규화한 키가 버퍼에 다 들어가지 않으면 잘린 키를 쓰지 않도록 -1
+int cache_key(char *uri, char *key)
+{
+    char scheme[MAXLINE] = "http", host[MAXLINE], path[MAXLINE] = "/", query[MAXLINE] = "";
+    char *p = uri, *sep, *colon;
+    size_t len;
+    int hasquery = 0;
+
+    // scheme이 없으면 parse_uri처럼 http로 간주
+    if ((sep = strstr(p, "://")) != NULL && (size_t)(sep - p) < sizeof(scheme))
+    {
+        len = sep - p;
+        memcpy(scheme, p, len);
+        scheme[len] = '\0';
+        p = sep + 3;
+    }
+    for (sep = scheme; *sep; sep = sep + 1)
+        *sep = tolower(*sep);
+
+    // authority는 '/', '?', '#' 전까지
+    len = strcspn(p, "/?#");
+    if (len >= MAXLINE)
+        len = MAXLINE - 1;
+    memcpy(host, p, len);
+    host[len] = '\0';
+    p = p + len;
+    for (sep = host; *sep; sep = sep + 1)
+        *sep = tolower(*sep);
+    // scheme의 기본 포트거나 비어있는 포트는 떼어낸다 (IPv6 리터럴의 ':'는 건너뜀)
+    colon = strrchr(host, ':');
+    if (colon != NULL && strchr(colon, ']') == NULL)
+    {
+        if (colon[1] == '\0'
+                || (!strcmp(scheme, "http") && !strcmp(colon + 1, "80"))
+                || (!strcmp(scheme, "https") && !strcmp(colon + 1, "443")))
+            *colon = '\0';
+    }
+
+    // path와 query 분리, fragment는 origin으로 가지도 않으니 버린다
+    len = strcspn(p, "?#");
+    if (len > 0)
+    {
+        memcpy(path, p, len);
+        path[len] = '\0';
+    }
+    p = p + len;
+    if (*p == '?')
+    {
+        p = p + 1;
+        len = strcspn(p, "#");
+        memcpy(query, p, len);
+        query[len] = '\0';
+        hasquery = 1;
+    }
+
+    normalize_pct(path);
+    remove_dot_segments(path);
+    if (path[0] == '\0')
+        strcpy(path, "/");
+    if (hasquery)
+    {
+        normalize_pct(query);
+        normalize_query(query);
+    }
+    if (snprintf(key, MAXLINE, "%s://%s%s%s%s", scheme, host, path, query[0] ? "?" : "", query) >= MAXLINE)
+        return -1;
+    return 0;
+}
+
+// 캐시에서 만든 응답 하나를 access log, 핫키 통계, 메트릭에 남긴다
+// body는 로그에 남길 body 크기, written은 헤더까지 합쳐 클라이언트에 쓰는 크기
+static void log_cached_reply(int status, size_t body, size_t written)
+{
+    log_request_status(status);
+    log_request_bytes(body);
+    hotkey_bytes(body);
+    metrics_add(M_BYTES_TO_CLIENT, written);
+}
+
+// 캐시된 응답 전체를 보내는 함수, 저장된 헤더 끝의 빈 줄 앞에 Connection 헤더를 끼워 넣는다
+// (캐시된 응답에는 항상 Content-Length가 있으니 keep-alive 연결에서도 경계가 분명하다)
+void send_cached(int connfd, int index, int keepalive)
+{
+    cache_block *block = &cache.cacheOBJ[index];
+    const char *conn = client_conn_header(keepalive);
+    log_cached_reply(200, block->cache_size - block->cache_hdrlen, block->cache_size + strlen(conn));
+    if (rio_writen(connfd, block->cache_obj, block->cache_hdrlen - 2) < 0
+            || rio_writen(connfd, (void *)conn, strlen(conn)) < 0)
+        return;
+    rio_writen(connfd, block->cache_obj + block->cache_hdrlen - 2, block->cache_size - block->cache_hdrlen + 2);
+}
+
+// If-None-Match의 태그 목록 중 etag와 (weak 비교로) 같은 것이 있는지
+static int etag_match(char *list, char *etag)
+{
+    char *p = list, *tag;
+    size_t len;
+    if (!strncmp(etag, "W/", 2))
+        etag = etag + 2;
+    while (*p)
+    {
+        p = p + strspn(p, ", \t");
+        len = strcspn(p, ", \t");
+        if (len == 0)
+            break;
+        tag = p;
+        if (len == 1 && *tag == '*')
+            return 1;
+        if (!strncmp(tag, "W/", 2))
+        {
+            tag = tag + 2;
+            len = len - 2;
+        }
+        if (len == strlen(etag) && !strncmp(tag, etag, len))
+            return 1;
+        p = p + strcspn(p, ",");
+    }
+    return 0;
+}
+
+// 클라이언트의 조건부 요청(If-None-Match / If-Modified-Since)이 캐시된 오브젝트에 대해
+// 304로 답해도 되는 경우 1을 리턴 (호출 전 index에 read 보호가 걸려 있어야 함)
+int cache_not_modified(int index, char *client_header)
+{
+    char cond[MAXLINE], validator[MAXLINE];
+    cache_block *block = &cache.cacheOBJ[index];
+    size_t clen = strlen(client_header);
+    time_t since, modified;
+    // If-None-Match가 있으면 If-Modified-Since는 보지 않는다 (RFC 7232 6)
+    if (header_value(client_header, clen, "If-None-Match", cond, MAXLINE))
+    {
+        if (!header_value(block->cache_obj, block->cache_hdrlen, "ETag", validator, MAXLINE))
+            return 0;
+        return etag_match(cond, validator);
+    }
+    if (header_value(client_header, clen, "If-Modified-Since", cond, MAXLINE))
+    {
+        if (!header_value(block->cache_obj, block->cache_hdrlen, "Last-Modified", validator, MAXLINE))
+            return 0;
+        since = parse_http_date(cond);
+        modified = parse_http_date(validator);
+        return since != -1 && modified != -1 && modified <= since;
+    }
+    return 0;
+}
+
+// 캐시된 응답의 status line에서 HTTP 버전만 꺼낸다
+// 캐시에서 만드는 304/206/416도 send_cached가 보내는 200과 같은 버전으로 답하기 위해
+static void cached_version(cache_block *block, char *version, size_t size)
+{
+    snprintf(version, size, "%.*s", (int)strcspn(block->cache_obj, " \r\n"), block->cache_obj);
+}
+
+// 캐시된 응답의 validator 관련 헤더만 골라 body 없는 304를 보내는 함수
+void send_not_modified(int connfd, int index, int keepalive)
+{
+    static const char *keep[] = {"ETag", "Last-Modified", "Cache-Control", "Expires", "Vary", "Date", "Content-Location"};
+    char buf[MAXLINE], value[MAXLINE], version[16];
+    cache_block *block = &cache.cacheOBJ[index];
+    size_t i, used;
+    cached_version(block, version, sizeof(version));
+    used = snprintf(buf, MAXLINE, "%s 304 Not Modified\r\n", version);
+    for (i = 0; i < sizeof(keep) / sizeof(keep[0]); i = i + 1)
+    {
+        if (header_value(block->cache_obj, block->cache_hdrlen, keep[i], value, MAXLINE)
+                && used + strlen(keep[i]) + strlen(value) + 6 < MAXLINE)
+            used = used + snprintf(buf + used, MAXLINE - used, "%s: %s\r\n", keep[i], value);
+    }
+    used = used + snprintf(buf + used, MAXLINE - used, "%s\r\n", client_conn_header(keepalive));
+    log_cached_reply(304, 0, used);
+    rio_writen(connfd, buf, used);
+}
+
+// Range 요청에서 처리할 최대 구간 수, 넘으면 Range를 무시하고 전체를 보낸다
+#define MAX_RANGES 16
+
+typedef struct
+{
+    size_t first, last; // 양 끝 포함
+} byte_range;
+
+// "bytes=0-99,200-,-50"을 길이 len인 body에 대한 구간들로 변환
+// 만족 가능한 구간 수를 리턴, 하나도 없으면 0, 문법이 틀렸거나 처리하지 않을 Range면 -1
+static int parse_range(char *spec, size_t len, byte_range *ranges)
+{
+    char *p, *dash, *end;
+    unsigned long long first, last;
+    int n = 0;
+    if (strncasecmp(spec, "bytes=", 6))
+        return -1;
+    p = spec + 6;
+    while (*p)
+    {
+        p = p + strspn(p, ", \t");
+        if (*p == '\0')
+            break;
+        if (n == MAX_RANGES)
+            return -1;
+        dash = strchr(p, '-');
+        if (dash == NULL)
+            return -1;
+        if (dash == p)
+        {
+            // "-n"은 마지막 n바이트
+            last = strtoull(dash + 1, &end, 10);
+            if (end == dash + 1)
+                return -1;
+            if (last == 0 || len == 0)
+            {
+                p = end;
+                continue;
+            }
+            ranges[n].first = last < len ? len - last : 0;
+            ranges[n].last = len - 1;
+        }
+        else
+        {
+            first = strtoull(p, &end, 10);
+            if (end != dash)
+                return -1;
+            last = strtoull(dash + 1, &end, 10);
+            if (end == dash + 1)
+                last = len - 1;
+            else if (last < first)
+                return -1;
+            // body 밖에서 시작하는 구간은 만족 불가
+            if (first >= len)
+            {
+                p = end;
+                continue;
+            }
+            ranges[n].first = first;
+            ranges[n].last = last < len ? last : len - 1;
+        }
+        n = n + 1;
+        p = end;
+        p = p + strspn(p, " \t");
+        if (*p && *p != ',')
+            return -1;
+    }
+    return n;
+}
+
+// If-Range가 없거나 캐시된 validator와 (strong 비교로) 같다면 1
+static int if_range_match(cache_block *block, char *client_header)
+{
+    char cond[MAXLINE], validator[MAXLINE];
+    if (!header_value(client_header, strlen(client_header), "If-Range", cond, MAXLINE))
+        return 1;
+    if (cond[0] == '"' || !strncmp(cond, "W/", 2))
+        return cond[0] == '"'
+            && header_value(block->cache_obj, block->cache_hdrlen, "ETag", validator, MAXLINE)
+            && !strcmp(cond, validator);
+    return header_value(block->cache_obj, block->cache_hdrlen, "Last-Modified", validator, MAXLINE)
+        && !strcmp(cond, validator);
+}
+
+// 캐시된 오브젝트에서 Range 요청을 처리하는 함수 (호출 전 index에 read 보호가 걸려 있어야 함)
+// 206 (구간이 여럿이면 multipart/byteranges) 혹은 416을 보냈다면 1,
+// Range가 없거나 무시해야 해서 전체를 보내야 한다면 0을 리턴
+int cache_send_range(int connfd, int index, char *client_header, int keepalive)
+{
+    static const char *const skip_single[] = {"Content-Length", "Content-Range", "Transfer-Encoding", NULL};
+    static const char *const skip_multi[] = {"Content-Length", "Content-Range", "Transfer-Encoding", "Content-Type", NULL};
+    cache_block *block = &cache.cacheOBJ[index];
+    char spec[MAXLINE], head[MAXLINE], part[MAXLINE], type[MAXLINE], boundary[64], version[16];
+    byte_range ranges[MAX_RANGES];
+    char *body = block->cache_obj + block->cache_hdrlen;
+    size_t bodylen = block->cache_size - block->cache_hdrlen, total, used, statuslen;
+    int n, i;
+
+    if (!header_value(client_header, strlen(client_header), "Range", spec, MAXLINE)
+            || !if_range_match(block, client_header)
+            || (n = parse_range(spec, bodylen, ranges)) < 0)
+        return 0;
+    cached_version(block, version, sizeof(version));
+    if (n == 0)
+    {
+        used = snprintf(head, MAXLINE, "%s 416 Range Not Satisfiable\r\nContent-Range: bytes */%zu\r\nContent-Length: 0\r\n%s\r\n",
+                version, bodylen, client_conn_header(keepalive));
+        log_cached_reply(416, 0, used);
+        rio_writen(connfd, head, used);
+        return 1;
+    }
+
+    // status line 다음부터의 헤더를 Content-Length 등만 빼고 그대로 가져온다
+    // 헤더가 MAXLINE을 넘으면 전체를 보내는 쪽으로 물러나니, 로그는 206 헤더가 다 만들어진 뒤에 남긴다
+    statuslen = strcspn(block->cache_obj, "\n") + 1;
+    used = snprintf(head, MAXLINE, "%s 206 Partial Content\r\n", version);
+    used = used + filter_headers(block->cache_obj + statuslen, block->cache_hdrlen - statuslen,
+            head + used, MAXLINE - used, n == 1 ? skip_single : skip_multi);
+    if (n == 1)
+    {
+        used = used + snprintf(head + used, MAXLINE - used, "Content-Range: bytes %zu-%zu/%zu\r\nContent-Length: %zu\r\n%s\r\n",
+                ranges[0].first, ranges[0].last, bodylen, ranges[0].last - ranges[0].first + 1, client_conn_header(keepalive));
+        if (used >= MAXLINE)
+            return 0;
+        log_cached_reply(206, ranges[0].last - ranges[0].first + 1, used + ranges[0].last - ranges[0].first + 1);
+        rio_writen(connfd, head, used);
+        rio_writen(connfd, body + ranges[0].first, ranges[0].last - ranges[0].first + 1);
+        return 1;
+    }
+
+    // multipart는 각 파트 헤더 길이까지 더해 Content-Length를 먼저 계산
+    if (!header_value(block->cache_obj, block->cache_hdrlen, "Content-Type", type, MAXLINE))
+        strcpy(type, "application/octet-stream");
+    snprintf(boundary, sizeof(boundary), "proxy-byteranges-%lx%x", (unsigned long)time(NULL), index);
+    total = 0;
+    for (i = 0; i < n; i = i + 1)
+    {
+        total = total + snprintf(part, MAXLINE, "\r\n--%s\r\nContent-Type: %s\r\nContent-Range: bytes %zu-%zu/%zu\r\n\r\n",
+                boundary, type, ranges[i].first, ranges[i].last, bodylen);
+        total = total + ranges[i].last - ranges[i].first + 1;
+    }
+    total = total + snprintf(part, MAXLINE, "\r\n--%s--\r\n", boundary);
+    used = used + snprintf(head + used, MAXLINE - used, "Content-Type: multipart/byteranges; boundary=%s\r\nContent-Length: %zu\r\n%s\r\n",
+            boundary, total, client_conn_header(keepalive));
+    if (used >= MAXLINE)
+        return 0;
+    log_cached_reply(206, total, used + total);
+    rio_writen(connfd, head, used);
+    for (i = 0; i < n; i = i + 1)
+    {
+        used = snprintf(part, MAXLINE, "\r\n--%s\r\nContent-Type: %s\r\nContent-Range: bytes %zu-%zu/%zu\r\n\r\n",
+                boundary, type, ranges[i].first, ranges[i].last, bodylen);
+        rio_writen(connfd, part, used);
+        rio_writen(connfd, body + ranges[i].first, ranges[i].last - ranges[i].first + 1);
+    }
+    used = snprintf(part, MAXLINE, "\r\n--%s--\r\n", boundary);
+    rio_writen(connfd, part, used);
+    return 1;
 }
 
 /////////////////// cache imp. part end
 
-void doit(int connfd)
+/////////////////// negative cache part
+
+// origin 실패(DNS 실패, 연결 거부, 5xx 응답)를 잠깐 기억해서
+// 같은 곳으로 가는 요청이 매번 getaddrinfo/connect 타임아웃을 다시 겪지 않게 한다
+// 키는 DNS/연결 실패는 "host:port", 5xx 응답은 캐시 키(uri)
+// DNS는 이름이 없다는 확답(EAI_NONAME)만, 연결은 거부(ECONNREFUSED)만 기록한다
+// 리졸버 타임아웃이나 connect 타임아웃처럼 잠깐의 문제일 수 있는 실패는 다음 요청이 다시 시도한다
+// 기억하는 시간은 PROXY_NEG_CACHE_TTL(초)로 바꿀 수 있다, 0이면 끈다
+#ifndef NEG_CACHE_TTL
+#define NEG_CACHE_TTL 5 // 초
+#endif
+#define NEG_CACHE_NUM 64
+
+typedef struct
+{
+    char key[MAXLINE];
+    int status;
+    char reason[64];
+    time_t expire; // 0이면 빈 칸
+} neg_entry;
+
+neg_entry negcache[NEG_CACHE_NUM];
+static int negcache_ttl = NEG_CACHE_TTL;
+// 엔트리가 작고 잠깐만 잡으니 테이블 전체를 세마포어 하나로 보호
+prof_lock negcache_mutex;
+
+void negcache_init()
+{
+    char *env;
+    memset(negcache, 0, sizeof(negcache));
+    if ((env = getenv("PROXY_NEG_CACHE_TTL")) != NULL && atoi(env) >= 0)
+        negcache_ttl = atoi(env);
+    prof_lock_init(&negcache_mutex);
+}
+
+// 만료되지 않은 실패 기록이 있다면 status, reason을 채우고 1을 리턴
+int negcache_find(char *key, int *status, char *reason)
+{
+    time_t now = time(NULL);
+    int index, found = 0;
+    prof_P(&negcache_mutex, LS_NEGCACHE_FIND);
+    for (index = 0; index < NEG_CACHE_NUM; index = index + 1)
+    {
+        if (negcache[index].expire > now && !strcmp(negcache[index].key, key))
+        {
+            *status = negcache[index].status;
+            strcpy(reason, negcache[index].reason);
+            found = 1;
+            break;
+        }
+    }
+    prof_V(&negcache_mutex);
+    return found;
+}
+
+// 같은 키가 있으면 갱신, 없으면 만료된 칸이나 가장 먼저 만료될 칸에 기록
+void negcache_insert(char *key, int status, char *reason)
+{
+    time_t now = time(NULL);
+    int index, target = 0;
+    prof_P(&negcache_mutex, LS_NEGCACHE_INSERT);
+    for (index = 0; index < NEG_CACHE_NUM; index = index + 1)
+    {
+        if (!strcmp(negcache[index].key, key) || negcache[index].expire <= now)
+        {
+            target = index;
+            break;
+        }
+        if (negcache[index].expire < negcache[target].expire)
+            target = index;
+    }
+    snprintf(negcache[target].key, MAXLINE, "%s", key);
+    snprintf(negcache[target].reason, sizeof(negcache[target].reason), "%s", reason);
+    negcache[target].status = status;
+    negcache[target].expire = now + negcache_ttl;
+    prof_V(&negcache_mutex);
+}
+
+/////////////////// negative cache part end
+
+// 요청 하나를 처리하는 함수, 클라이언트 연결을 유지하고 다음 요청을 읽어도 되면 1을 리턴
+// keepalive_allowed가 0이면 클라이언트가 원해도 이번 응답 후 연결을 닫는다
+int doit(int connfd, rio_t *rio, int keepalive_allowed, conn_deadline *dl)
 {
-    char buf[MAXLINE], method[MAXLINE], uri[MAXLINE], version[MAXLINE];
+    char buf[MAXLINE], method[MAXLINE], uri[MAXLINE], version[MAXLINE] = "HTTP/1.0";
     char HTTPheader[MAXLINE], hostname[MAXLINE], path[MAXLINE];
-    int backfd;
-    rio_t rio, backrio;
+    int backfd, keepalive;
+    rio_t backrio;
     
-    Rio_readinitb(&rio, connfd);
-    Rio_readlineb(&rio, buf, MAXLINE);
-    printf("Request headers:\n");
-    printf("%s", buf);
-    sscanf(buf, "%s %s %s", method, uri, version);
+    // 파이프라이닝된 요청 사이의 빈 줄은 건너뛴다, 클라이언트가 닫았다면 끝
+    do
+    {
+        if (rio_readlineb(rio, buf, MAXLINE) <= 0)
+            return 0;
+    } while (!strcmp(buf, "\r\n") || !strcmp(buf, "\n"));
+    deadline_set(dl, PHASE_CLIENT_READ, CLIENT_HEADER_TIMEOUT * 1000);
+    log_msg(LOG_DEBUG, "Request line: %s", buf);
+    if (sscanf(buf, "%s %s %s", method, uri, version) < 2)
+        return 0;
+    log_request_line(method, uri, version);
+    PROBE3(request__start, connfd, uri, strlen(uri));
+    metrics_add(M_REQUESTS, 1);
+    latency_begin();
 
     if (strcasecmp(method, "GET"))
     {
-        printf("Proxy does not implement this method\n");
-        return;
+        clienterror(connfd, method, "501", "Not Implemented", "Proxy does not implement this method");
+        return 0;
     }
 
-    // uri를 MAX_OBJECT_SIZE가 허용하는 만큼만 uri_store에 담는다
-    char uri_store[MAX_OBJECT_SIZE];
-    strcpy(uri_store, uri);
-    int cache_index;
-    // 캐시에 있는지 확인
-    if ((cache_index = cache_find(uri_store)) != -1)
+    // 캐시는 uri 원문 대신 정규화된 키로 찾고 기록한다
+    char uri_store[MAXLINE];
+    if (cache_key(uri, uri_store) < 0)
     {
-        // 있다면 캐시에서 보내고 doit 종료
-        readstart(cache_index);
-        Rio_writen(connfd, cache.cacheOBJ[cache_index].cache_obj, strlen(cache.cacheOBJ[cache_index].cache_obj));
-        readend(cache_index);
-        return;
+        clienterror(connfd, uri, "414", "URI Too Long", "Proxy could not normalize the request URI");
+        return 0;
     }
+    hotkey_request(uri_store);
     int port;
     // uri를 파싱하는 목적은 서버마다 다른데, 프록시 서버에서의 목적은 hostname과 path를 추출하고 포트를 결정하는 것이다
     // 아래에서 이 목적에 따르는 코드로 parse_uri를 구현
     parse_uri(uri, hostname, path, &port);
     // 결정된 hostname, path, port에 따라 HTTP header를 만든다
-    makeHTTPheader(HTTPheader, hostname, path, port, &rio);
+    // Vary로 갈리는 캐시를 고르려면 클라이언트 헤더가 필요하니 캐시 확인보다 먼저 읽는다
+    char client_header[MAXLINE];
+    int header_ok = makeHTTPheader(HTTPheader, hostname, path, port, rio, client_header) == 0;
+    if (dl->expired)
+        return 0;
+    if (!header_ok)
+    {
+        clienterror(connfd, hostname, "400", "Bad Request", "Request headers are too large to forward");
+        return 0;
+    }
+    // 헤더 deadline은 여기까지, 남은 DNS 대기와 connect에서 터져 클라이언트 소켓이 끊기지 않도록 연결 단계로 넘어간다
+    deadline_set(dl, PHASE_CONNECT, ORIGIN_CONNECT_TIMEOUT * 1000);
+    latency_mark(LAT_PARSE);
+    // HTTP/1.1은 기본이 keep-alive, 1.0은 Connection(혹은 Proxy-Connection): keep-alive가 있어야 유지
+    char connval[MAXLINE];
+    keepalive = strcasecmp(version, "HTTP/1.0") != 0;
+    if (header_value(client_header, strlen(client_header), "Connection", connval, MAXLINE)
+            || header_value(client_header, strlen(client_header), "Proxy-Connection", connval, MAXLINE))
+    {
+        if (has_token(connval, "close"))
+            keepalive = 0;
+        else if (has_token(connval, "keep-alive"))
+            keepalive = 1;
+    }
+    keepalive = keepalive && keepalive_allowed;
+    int cache_index;
+    // 캐시에 있는지 확인
+    cache_index = cache_find(uri_store, client_header);
+    PROBE3(cache__lookup, uri_store, cache_index != -1, cache_index);
+    if (cache_index != -1)
+    {
+        deadline_set(dl, PHASE_CLIENT_WRITE, CLIENT_WRITE_TIMEOUT * 1000);
+        log_request_cache(LOG_CACHE_HIT);
+        latency_mark(LAT_CACHE);
+        latency_class(LAT_HIT);
+        // 있다면 캐시에서 보내고 doit 종료 (cache_find가 건 read 보호를 여기서 푼다)
+        // 클라이언트가 가진 사본이 아직 유효하다면 body 없이 304만 보낸다
+        // Range 요청이라면 캐시된 body에서 필요한 구간만 잘라 보낸다
+        if (cache_not_modified(cache_index, client_header))
+            send_not_modified(connfd, cache_index, keepalive);
+        else if (!cache_send_range(connfd, cache_index, client_header, keepalive))
+            send_cached(connfd, cache_index, keepalive);
+        readend(cache_index);
+        latency_mark(LAT_RELAY);
+        return keepalive;
+    }
+    latency_mark(LAT_CACHE);
 
-    char portch[10];
+    char portch[10], hostport[MAXLINE + sizeof(portch)], reason[64], errnum[8];
+    int status, dns_error;
     sprintf(portch, "%d", port);
-    // back과 연결 후 만든 HTTP header를 보낸다
-    backfd = Open_clientfd(hostname, portch);
-    if(backfd < 0)
+    snprintf(hostport, sizeof(hostport), "%s:%s", hostname, portch);
+    // 최근에 실패한 origin이나 5xx를 준 uri라면 연결을 시도하지 않고 바로 에러를 보낸다
+    if (negcache_find(hostport, &status, reason) || negcache_find(uri_store, &status, reason))
+    {
+        metrics_add(M_NEGCACHE_HITS, 1);
+        sprintf(errnum, "%d", status);
+        clienterror(connfd, uri_store, errnum, reason, "Recent origin failure is cached");
+        return 0;
+    }
+    log_request_cache(LOG_CACHE_MISS);
+    // 동시에 진행 중인 origin 요청이 한도에 닿았으면 기다리지 않고 바로 503
+    if (sem_trywait(&fetch_slots) < 0)
     {
-        printf("connection failed\n");
+        log_request_status(503);
+        send_overloaded(connfd);
+        return 0;
+    }
+    // origin 연결은 풀에 남아있는 keep-alive 연결을 먼저 쓰고, 없으면 새로 연결한다
+    // 재사용한 연결은 그새 origin이 닫았을 수 있으니 요청을 보내고 status line을 받을 때까지 실패하면
+    // 닫고 다음 연결로 다시 시도한다 (새로 연결한 것까지 실패하면 포기)
+    int reused;
+    size_t headerlen = strlen(HTTPheader);
+    while (1)
+    {
+        backfd = connpool_get(hostport);
+        reused = backfd >= 0;
+        if (reused)
+        {
+            latency_mark(LAT_CONNECT);
+            PROBE4(origin__connect, hostname, port, backfd, 1);
+        }
+        if (!reused)
+        {
+            // Open_clientfd는 실패하면 프록시 전체를 종료하니 에러를 직접 처리하고
+            // 매번 getaddrinfo를 부르지 않도록 DNS 캐시를 거쳐 연결한다
+            backfd = dnscache_open_clientfd(hostname, portch, &dns_error);
+            latency_mark(LAT_CONNECT);
+            PROBE4(origin__connect, hostname, port, backfd, 0);
+            if (dl->expired == PHASE_CONNECT)
+            {
+                if (backfd >= 0)
+                    Close(backfd);
+                V(&fetch_slots);
+                metrics_add(M_ORIGIN_TIMEOUTS, 1);
+                clienterror(connfd, hostname, "504", "Gateway Timeout", "Proxy could not connect to the origin server in time");
+                return 0;
+            }
+            if(backfd < 0)
+            {
+                // -2는 getaddrinfo 실패(에러코드는 dns_error), -1은 connect 실패(errno)
+                // 이름이 없거나 연결을 거부당한 경우만 negative cache에 남긴다
+                int definite = backfd == -2 ? dns_error == EAI_NONAME : errno == ECONNREFUSED;
+                strcpy(reason, backfd == -2 ? "DNS Lookup Failed" : "Connection Failed");
+                V(&fetch_slots);
+                if (definite)
+                    negcache_insert(hostport, 502, reason);
+                metrics_add(M_ORIGIN_ERRORS, 1);
+                clienterror(connfd, hostname, "502", reason, "Proxy could not reach the origin server");
+                return 0;
+            }
+        }
+        metrics_add(M_ORIGIN_REQUESTS, 1);
+        metrics_add(M_ORIGIN_REUSED, reused);
+        Rio_readinitb(&backrio, backfd);
+        // 요청을 보내고 첫 줄이 올 때까지 origin deadline, 넘기면 504
+        dl->backfd = backfd;
+        deadline_set(dl, PHASE_ORIGIN, ORIGIN_TIMEOUT * 1000);
+        if (rio_writen(backfd, HTTPheader, headerlen) == (ssize_t)headerlen && rio_readlineb(&backrio, buf, MAXLINE) > 0)
+        {
+            latency_mark(LAT_TTFB);
+            PROBE2(origin__first__byte, backfd, buf);
+            break;
+        }
+        deadline_clear(dl);
+        Close(backfd);
+        if (dl->expired == PHASE_ORIGIN || !reused)
+            V(&fetch_slots);
+        if (dl->expired == PHASE_ORIGIN)
+        {
+            metrics_add(M_ORIGIN_TIMEOUTS, 1);
+            clienterror(connfd, hostname, "504", "Gateway Timeout", "Origin server did not respond in time");
+            return 0;
+        }
+        if (!reused)
+        {
+            metrics_add(M_ORIGIN_ERRORS, 1);
+            clienterror(connfd, hostname, "502", "Bad Gateway", "Origin server closed the connection");
+            return 0;
+        }
+        // 풀에서 꺼낸 연결이 죽어 있었으니 새로 연결할 시간을 다시 준다
+        deadline_set(dl, PHASE_CONNECT, ORIGIN_CONNECT_TIMEOUT * 1000);
+    }
+    // 응답을 끝까지 전달했고 origin도 연결을 유지한다면 풀에 반납
+    // 클라이언트 쪽도 응답의 경계가 분명할 때만 연결을 유지한다 (relay_response가 keepalive를 조정)
+    int reusable = relay_response(connfd, &backrio, buf, !strcasecmp(version, "HTTP/1.0"), &keepalive, uri_store, client_header, dl);
+    latency_mark(LAT_RELAY);
+    deadline_clear(dl);
+    V(&fetch_slots);
+    if (reusable)
+        connpool_put(hostport, backfd);
+    else
+        Close(backfd);
+    return keepalive;
+}
+
+// origin 응답 body의 끝을 아는 방법
+#define BODY_NONE 0 // 1xx, 204, 304
+#define BODY_LENGTH 1 // Content-Length
+#define BODY_CHUNKED 2 // Transfer-Encoding: chunked
+#define BODY_EOF 3 // 둘 다 없으면 origin이 연결을 닫을 때까지
+
+// 헤더 줄의 이름이 name인지
+static int header_is(const char *line, const char *name)
+{
+    size_t len = strlen(name);
+    return !strncasecmp(line, name, len) && line[len] == ':';
+}
+
+// 콤마로 구분된 헤더 값 목록에 token이 있는지 (대소문자 무시)
+int has_token(const char *value, const char *token)
+{
+    size_t len, toklen = strlen(token);
+    while (*value)
+    {
+        value = value + strspn(value, ", \t");
+        len = strcspn(value, ",");
+        while (len > 0 && (value[len - 1] == ' ' || value[len - 1] == '\t'))
+            len = len - 1;
+        if (len == toklen && !strncasecmp(value, token, len))
+            return 1;
+        value = value + strcspn(value, ",");
+    }
+    return 0;
+}
+
+// 클라이언트로 보낼 응답 헤더를 모아뒀다가 한 번에 보내기 위한 버퍼
+typedef struct
+{
+    char buf[MAXLINE];
+    size_t len;
+    int sent; // 이미 클라이언트에 일부라도 보냈는지
+    int ok; // 쓰기 실패가 없었는지
+} out_buffer;
+
+// 버퍼가 차면 먼저 비운다 (헤더가 MAXLINE을 넘는 드문 경우)
+static void out_append(int fd, out_buffer *out, const char *data, size_t len)
+{
+    if (!out->ok)
+        return;
+    if (out->len + len > MAXLINE)
+    {
+        out->sent = 1;
+        out->ok = rio_writen(fd, out->buf, out->len) == (ssize_t)out->len;
+        out->len = 0;
+        if (out->ok && len > MAXLINE)
+        {
+            out->ok = rio_writen(fd, (void *)data, len) == (ssize_t)len;
+            return;
+        }
+    }
+    memcpy(out->buf + out->len, data, len);
+    RIO_STAT_COPY(len);
+    out->len = out->len + len;
+}
+
+// origin에서 읽기, rio 버퍼가 비어서 실제로 블록될 수 있을 때만 origin deadline을 미룬다
+static ssize_t origin_readlineb(conn_deadline *dl, rio_t *rp, void *buf, size_t maxlen)
+{
+    ssize_t rc;
+    if (rp->rio_cnt == 0)
+        deadline_progress(dl, PHASE_ORIGIN, ORIGIN_TIMEOUT * 1000);
+    if ((rc = rio_readlineb(rp, buf, maxlen)) > 0)
+        metrics_add(M_BYTES_FROM_ORIGIN, rc);
+    return rc;
+}
+
+static ssize_t origin_readnb(conn_deadline *dl, rio_t *rp, void *buf, size_t n)
+{
+    ssize_t rc;
+    if (rp->rio_cnt < (int)n)
+        deadline_progress(dl, PHASE_ORIGIN, ORIGIN_TIMEOUT * 1000);
+    if ((rc = rio_readnb(rp, buf, n)) > 0)
+        metrics_add(M_BYTES_FROM_ORIGIN, rc);
+    return rc;
+}
+
+// 클라이언트에 쓰기, 한 번 실패하면 이후는 건너뛴다
+static void client_send(conn_deadline *dl, const void *buf, size_t n, int *ok)
+{
+    if (!*ok)
         return;
+    deadline_progress(dl, PHASE_CLIENT_WRITE, CLIENT_WRITE_TIMEOUT * 1000);
+    *ok = rio_writen(dl->connfd, (void *)buf, n) == (ssize_t)n;
+    metrics_add(M_BYTES_TO_CLIENT, n);
+}
+
+// origin 응답(status line은 이미 statusline에 읽혀 있음)을 클라이언트에 전달하고,
+// 200이고 크기가 맞으면 캐시에, 5xx면 negative cache에 기록하는 함수
+// Content-Length나 chunked로 응답의 끝을 찾으니 origin 연결을 닫지 않고도 응답을 끝까지 읽을 수 있다
+// HTTP/1.0 클라이언트에게는 chunked를 풀어서 보낸다
+// 클라이언트에게도 응답의 끝을 알려줄 수 없는 경우(EOF로 끝나는 body, 풀어낸 chunked)는 *client_keepalive를 0으로
+// 리턴값: 응답을 끝까지 전달했고 origin 연결을 재사용할 수 있으면 1
+int relay_response(int connfd, rio_t *backrio, char *statusline, int client_http10, int *client_keepalive, char *uri_store, char *client_header, conn_deadline *dl)
+{
+    const char *conn;
+    char buf[MAXLINE], cachehdr[MAXLINE], value[MAXLINE], reason[64];
+    char cachebody[MAX_OBJECT_SIZE];
+    out_buffer out = {.len = 0, .sent = 0, .ok = 1};
+    int major, minor, status, bodytype, keepalive, complete = 0, client_ok = 1, cacheable = 1;
+    size_t hdrlen, bodylen = 0, remain = 0, n, want;
+    ssize_t rc;
+
+    if (sscanf(statusline, "HTTP/%d.%d %d", &major, &minor, &status) != 3)
+    {
+        metrics_add(M_ORIGIN_ERRORS, 1);
+        clienterror(connfd, uri_store, "502", "Bad Gateway", "Malformed response from origin server");
+        return 0;
+    }
+    if (sscanf(statusline, "HTTP/%*d.%*d %*d %63[^\r\n]", reason) != 1)
+        strcpy(reason, "Origin Error");
+    log_request_status(status);
+    // HTTP/1.1은 기본이 keep-alive, 1.0은 명시해야 keep-alive
+    keepalive = major > 1 || (major == 1 && minor >= 1);
+    bodytype = (status / 100 == 1 || status == 204 || status == 304) ? BODY_NONE : BODY_EOF;
+
+    // 클라이언트로 갈 헤더는 out에 모아뒀다가 헤더가 끝나면 한 번에 보낸다
+    // 그래서 헤더를 받는 도중 origin이 멈추면 클라이언트에게는 아직 아무것도 안 간 상태로 504를 보낼 수 있다
+    hdrlen = snprintf(cachehdr, MAXLINE, "%s", statusline);
+    out_append(connfd, &out, statusline, strlen(statusline));
+    while ((rc = origin_readlineb(dl, backrio, buf, MAXLINE)) > 0 && strcmp(buf, "\r\n") && strcmp(buf, "\n"))
+    {
+        // hop-by-hop 헤더는 클라이언트에도 캐시에도 넘기지 않는다
+        if (header_is(buf, "Connection") || header_is(buf, "Proxy-Connection"))
+        {
+            header_value(buf, rc, header_is(buf, "Connection") ? "Connection" : "Proxy-Connection", value, MAXLINE);
+            if (has_token(value, "close"))
+                keepalive = 0;
+            else if (has_token(value, "keep-alive"))
+                keepalive = 1;
+            continue;
+        }
+        if (header_is(buf, "Keep-Alive"))
+            continue;
+        if (header_is(buf, "Transfer-Encoding"))
+        {
+            header_value(buf, rc, "Transfer-Encoding", value, MAXLINE);
+            if (bodytype != BODY_NONE && has_token(value, "chunked"))
+                bodytype = BODY_CHUNKED;
+            if (!client_http10)
+                out_append(connfd, &out, buf, rc);
+            continue;
+        }
+        if (header_is(buf, "Content-Length"))
+        {
+            header_value(buf, rc, "Content-Length", value, MAXLINE);
+            if (bodytype == BODY_EOF)
+            {
+                bodytype = BODY_LENGTH;
+                remain = strtoul(value, NULL, 10);
+            }
+        }
+        else if (hdrlen + rc < MAXLINE)
+        {
+            memcpy(cachehdr + hdrlen, buf, rc);
+            RIO_STAT_COPY(rc);
+            hdrlen = hdrlen + rc;
+        }
+        else
+            cacheable = 0;
+        out_append(connfd, &out, buf, rc);
+    }
+    if (rc <= 0)
+    {
+        *client_keepalive = 0;
+        if (!out.sent && dl->expired == PHASE_ORIGIN)
+        {
+            metrics_add(M_ORIGIN_TIMEOUTS, 1);
+            clienterror(connfd, uri_store, "504", "Gateway Timeout", "Origin server stalled while sending headers");
+        }
+        return 0;
+    }
+    *client_keepalive = *client_keepalive
+        && (bodytype == BODY_NONE || bodytype == BODY_LENGTH || (bodytype == BODY_CHUNKED && !client_http10));
+    conn = client_conn_header(*client_keepalive);
+    out_append(connfd, &out, conn, strlen(conn));
+    out_append(connfd, &out, "\r\n", 2);
+    if (out.ok && out.len > 0)
+    {
+        deadline_set(dl, PHASE_CLIENT_WRITE, CLIENT_WRITE_TIMEOUT * 1000);
+        out.ok = rio_writen(connfd, out.buf, out.len) == (ssize_t)out.len;
+        metrics_add(M_BYTES_TO_CLIENT, out.len);
+    }
+    client_ok = out.ok;
+
+    // body 전달, 캐시할 수 있는 크기까지는 cachebody에 모은다
+    if (bodytype == BODY_NONE)
+        complete = 1;
+    else if (bodytype == BODY_LENGTH || bodytype == BODY_EOF)
+    {
+        while (bodytype == BODY_EOF || remain > 0)
+        {
+            want = (bodytype == BODY_EOF || remain > MAXLINE) ? MAXLINE : remain;
+            if ((rc = origin_readnb(dl, backrio, buf, want)) <= 0)
+                break;
+            log_msg(LOG_DEBUG, "proxy received %zd bytes, then send", rc);
+            if (bodylen + rc <= MAX_OBJECT_SIZE)
+            {
+                memcpy(cachebody + bodylen, buf, rc);
+                RIO_STAT_COPY(rc);
+            }
+            bodylen = bodylen + rc;
+            remain = remain - (bodytype == BODY_LENGTH ? (size_t)rc : 0);
+            client_send(dl, buf, rc, &client_ok);
+        }
+        complete = bodytype == BODY_EOF ? rc == 0 : remain == 0;
     }
-    Rio_readinitb(&backrio, backfd);
-    Rio_writen(backfd, HTTPheader, strlen(HTTPheader));
-    // 이어서 클라이언트가 보냈던 원문도 보낸 뒤 close
-    char cachebuf[MAX_OBJECT_SIZE];
-    size_t sizerecvd, sizebuf = 0;
-    while((sizerecvd = Rio_readlineb(&backrio, buf, MAXLINE)) != 0)
+    else
     {
-        // 이때 buf의 크기가 MAX_OBJECT_SIZE보다 작다면 cachebuf에 카피하고
-        sizebuf = sizebuf + sizerecvd;
-        if (sizebuf < MAX_OBJECT_SIZE)
+        // chunked: 크기 줄, 데이터, CRLF를 반복하고 크기 0인 chunk 뒤에 trailer가 온다
+        // HTTP/1.1 클라이언트에는 받은 그대로, HTTP/1.0 클라이언트에는 데이터만 보낸다
+        while ((rc = origin_readlineb(dl, backrio, buf, MAXLINE)) > 0)
         {
-            strcat(cachebuf, buf);
+            remain = strtoul(buf, NULL, 16);
+            if (!client_http10)
+                client_send(dl, buf, rc, &client_ok);
+            if (remain == 0)
+            {
+                while ((rc = origin_readlineb(dl, backrio, buf, MAXLINE)) > 0)
+                {
+                    if (!client_http10)
+                        client_send(dl, buf, rc, &client_ok);
+                    if (!strcmp(buf, "\r\n") || !strcmp(buf, "\n"))
+                    {
+                        complete = 1;
+                        break;
+                    }
+                }
+                break;
+            }
+            while (remain > 0)
+            {
+                want = remain > MAXLINE ? MAXLINE : remain;
+                if ((rc = origin_readnb(dl, backrio, buf, want)) <= 0)
+                    break;
+                log_msg(LOG_DEBUG, "proxy received %zd bytes, then send", rc);
+                if (bodylen + rc <= MAX_OBJECT_SIZE)
+                {
+                    memcpy(cachebody + bodylen, buf, rc);
+                    RIO_STAT_COPY(rc);
+                }
+                bodylen = bodylen + rc;
+                remain = remain - rc;
+                client_send(dl, buf, rc, &client_ok);
+            }
+            // 데이터 뒤의 CRLF
+            if (remain > 0 || (rc = origin_readlineb(dl, backrio, buf, MAXLINE)) <= 0)
+                break;
+            if (!client_http10)
+                client_send(dl, buf, rc, &client_ok);
         }
-        printf("proxy received %d bytes, then send\n", sizerecvd);
-        Rio_writen(connfd, buf, sizerecvd);
     }
-    Close(backfd);
-    if (sizebuf < MAX_OBJECT_SIZE)
+
+    log_request_bytes(bodylen);
+    hotkey_bytes(bodylen);
+    // 5xx 응답은 실패로 기억해두고 TTL 동안 같은 uri 요청에 바로 에러로 답한다
+    if (status >= 500)
+        negcache_insert(uri_store, status, reason);
+    // 200 응답만 캐시한다 (조건부 요청이 그대로 전달되면 origin이 304를 줄 수도 있음)
+    // 캐시에 없던 Range 요청도 origin으로 그대로 가고, 206 부분 응답은 여기서 걸러진다
+    if (complete && cacheable && status == 200 && bodylen <= MAX_OBJECT_SIZE)
     {
-        // cachebuf를 cache에 기록한다
-        cache_uri(uri_store, cachebuf);
+        n = snprintf(cachehdr + hdrlen, MAXLINE - hdrlen, "Content-Length: %zu\r\n\r\n", bodylen);
+        if (hdrlen + n < MAXLINE)
+            cache_uri(uri_store, cachehdr, hdrlen + n, cachebody, bodylen, client_header);
     }
+    *client_keepalive = *client_keepalive && complete && client_ok;
+    // origin 쪽 버퍼에 남은 바이트가 있다면 응답 경계가 어긋난 것이니 재사용하지 않는다
+    return complete && client_ok && keepalive && bodytype != BODY_EOF && backrio->rio_cnt == 0;
 }
 
 // uri로부터 hostname, path를 파싱하고 port를 결정하는 함수
@@ -324,35 +1713,173 @@ int parse_uri(char *uri, char *hostname, char *path, int *port)
 }
 
 static const char *user_agent_header = "User-Agent: Mozilla/5.0 (X11; Linux x86_64; rv:10.0.3) Gecko/20120305 Firefox/10.0.3\r\n";
-static const char *conn_header = "Connection: close\r\n";
-static const char *prox_header = "Proxy-Connection: close\r\n";
+// origin 연결은 풀에서 재사용하니 keep-alive로 요청한다
+static const char *conn_header = "Connection: keep-alive\r\n";
 static const char *host_header_format = "Host: %s\r\n";
-static const char *requestlint_header_format = "GET %s HTTP/1.0\r\n";
+static const char *requestlint_header_format = "GET %s HTTP/1.1\r\n";
 static const char *endof_header = "\r\n";
 static const char *connection_key = "Connection";
 static const char *user_agent_key = "User-Agent";
 static const char *proxy_connection_key = "Proxy-Connection";
 static const char *host_key = "Host";
+static const char *keep_alive_key = "Keep-Alive";
+
+// 클라이언트에게 보내는 응답에 붙일 Connection 헤더
+const char *client_conn_header(int keepalive)
+{
+    return keepalive ? "Connection: keep-alive\r\n" : "Connection: close\r\n";
+}
+
+// 응답 헤더가 끝나는 빈 줄(\r\n\r\n)까지의 길이, 빈 줄이 없다면 size
+size_t header_length(const char *buf, size_t size)
+{
+    size_t i;
+    for (i = 0; i + 4 <= size; i = i + 1)
+    {
+        if (buf[i] == '\r' && !memcmp(buf + i, "\r\n\r\n", 4))
+            return i + 4;
+    }
+    return size;
+}
+
+// 헤더 줄들(길이 len)을 out에 복사하되 skip(NULL로 끝나는 목록)에 있는 이름의 헤더는 뺀다
+// 빈 줄에서 멈추며 빈 줄은 복사하지 않는다, out에 쓴 길이를 리턴
+size_t filter_headers(const char *headers, size_t len, char *out, size_t outsize, const char *const *skip)
+{
+    const char *p = headers, *end = headers + len, *eol;
+    const char *const *name;
+    size_t used = 0, linelen, namelen;
+    while (p < end)
+    {
+        eol = memchr(p, '\n', end - p);
+        eol = eol ? eol + 1 : end;
+        linelen = eol - p;
+        if (*p == '\r' || *p == '\n')
+            break;
+        for (name = skip; *name; name = name + 1)
+        {
+            namelen = strlen(*name);
+            if (linelen > namelen && p[namelen] == ':' && !strncasecmp(p, *name, namelen))
+                break;
+        }
+        if (*name == NULL && used + linelen < outsize)
+        {
+            memcpy(out + used, p, linelen);
+            used = used + linelen;
+        }
+        p = eol;
+    }
+    if (used < outsize)
+        out[used] = '\0';
+    return used;
+}
+
+// 응답의 status line에서 상태 코드를 읽는 함수, 읽지 못하면 -1
+int response_status(const char *buf, size_t size)
+{
+    char line[64];
+    int status;
+    size_t len = size < sizeof(line) - 1 ? size : sizeof(line) - 1;
+    memcpy(line, buf, len);
+    line[len] = '\0';
+    if (sscanf(line, "HTTP/%*d.%*d %d", &status) != 1)
+        return -1;
+    return status;
+}
+
+// HTTP 날짜(IMF-fixdate, RFC 850, asctime 세 형식)를 time_t로, 실패하면 -1
+time_t parse_http_date(const char *date)
+{
+    static const char *formats[] = {"%a, %d %b %Y %H:%M:%S GMT", "%A, %d-%b-%y %H:%M:%S GMT", "%a %b %e %H:%M:%S %Y"};
+    struct tm tm;
+    size_t i;
+    for (i = 0; i < sizeof(formats) / sizeof(formats[0]); i = i + 1)
+    {
+        memset(&tm, 0, sizeof(tm));
+        if (strptime(date, formats[i], &tm) != NULL)
+            return timegm(&tm);
+    }
+    return -1;
+}
+
+// headers(길이 len, 빈 줄에서 끝남)에서 name 헤더의 값을 앞뒤 공백을 떼고 value에 담는 함수
+// 같은 이름이 여러 줄이면 ", "로 이어붙이고, 찾았다면 1을 리턴
+int header_value(const char *headers, size_t len, const char *name, char *value, size_t valsize)
+{
+    const char *p = headers, *end = headers + len, *eol, *v, *vend;
+    size_t namelen = strlen(name), used = 0, n;
+    int found = 0;
+    value[0] = '\0';
+    while (p < end)
+    {
+        eol = memchr(p, '\n', end - p);
+        if (eol == NULL)
+            eol = end;
+        // 빈 줄이면 헤더 끝
+        if (p == eol || (*p == '\r' && p + 1 == eol))
+            break;
+        if ((size_t)(eol - p) > namelen && p[namelen] == ':' && !strncasecmp(p, name, namelen))
+        {
+            v = p + namelen + 1;
+            vend = eol;
+            while (v < vend && (*v == ' ' || *v == '\t'))
+                v = v + 1;
+            while (vend > v && (vend[-1] == '\r' || vend[-1] == ' ' || vend[-1] == '\t'))
+                vend = vend - 1;
+            n = vend - v;
+            if (found && used + 2 < valsize)
+            {
+                memcpy(value + used, ", ", 2);
+                used = used + 2;
+            }
+            if (used + n >= valsize)
+                n = valsize - used - 1;
+            memcpy(value + used, v, n);
+            used = used + n;
+            value[used] = '\0';
+            found = 1;
+        }
+        p = eol + 1;
+    }
+    return found;
+}
+
 // 조건대로 포맷을 맞춰 헤더를 만드는 함수
-void makeHTTPheader(char *HTTPheader, char *hostname, char *path, int port, rio_t *client_rio)
+// 클라이언트가 보낸 헤더 원문은 client_header(MAXLINE)에 모아둔다 (Vary 등 캐시 판단에 사용)
+// 헤더가 client_header나 만든 요청(MAXLINE)에 다 들어가지 않으면 일부가 빠진 요청을 보내지 않도록 -1
+int makeHTTPheader(char *HTTPheader, char *hostname, char *path, int port, rio_t *client_rio, char *client_header)
 {
-    char buf[MAXLINE], request_header[MAXLINE], other_header[MAXLINE], host_header[MAXLINE];
+    char buf[MAXLINE], request_header[MAXLINE], other_header[MAXLINE] = "", host_header[MAXLINE] = "";
+    size_t buflen;
+    client_header[0] = '\0';
     sprintf(request_header, requestlint_header_format, path);
-    while(Rio_readlineb(client_rio, buf, MAXLINE) > 0)
+    while(rio_readlineb(client_rio, buf, MAXLINE) > 0)
     {
         if(strcmp(buf, endof_header) == 0)
         {
             break;
         }
+        buflen = strlen(buf);
+        if(strlen(client_header) + buflen >= MAXLINE)
+        {
+            return -1;
+        }
+        strcat(client_header, buf);
         if(!strncasecmp(buf, host_key, strlen(host_key)))
         {
             strcpy(host_header, buf);
             continue;
         }
-        if(!strncasecmp(buf, connection_key, strlen(connection_key))
-                &&!strncasecmp(buf, proxy_connection_key, strlen(proxy_connection_key))
-                &&!strncasecmp(buf, user_agent_key, strlen(user_agent_key)))
+        // Connection, Proxy-Connection, Keep-Alive, User-Agent는 프록시가 정한 값으로 보내니 나머지만 그대로 전달
+        if(strncasecmp(buf, connection_key, strlen(connection_key))
+                && strncasecmp(buf, proxy_connection_key, strlen(proxy_connection_key))
+                && strncasecmp(buf, keep_alive_key, strlen(keep_alive_key))
+                && strncasecmp(buf, user_agent_key, strlen(user_agent_key)))
         {
+            if(strlen(other_header) + buflen >= MAXLINE)
+            {
+                return -1;
+            }
             strcat(other_header, buf);
         }
     }
@@ -360,5 +1887,24 @@ void makeHTTPheader(char *HTTPheader, char *hostname, char *path, int port, rio_
     {
         sprintf(host_header, host_header_format, hostname);
     }
-    sprintf(HTTPheader, "%s%s%s%s%s%s%s", request_header, host_header, conn_header, prox_header, user_agent_header, other_header, endof_header);
-}
\ No newline at end of file
+    if (snprintf(HTTPheader, MAXLINE, "%s%s%s%s%s%s", request_header, host_header, conn_header, user_agent_header, other_header, endof_header) >= MAXLINE)
+        return -1;
+    return 0;
+}
+
+// tiny와 같은 형식으로 에러 페이지를 클라이언트에 보내는 함수
+void clienterror(int fd, char *cause, char *errnum, char *shortmsg, char *longmsg)
+{
+    char buf[MAXLINE], body[MAXBUF];
+    int len;
+    len = snprintf(body, MAXBUF, "<html><title>Proxy Error</title><body bgcolor=\"ffffff\">\r\n"
+            "%s: %s\r\n<p>%s: %s\r\n<hr><em>The Proxy Server</em>\r\n", errnum, shortmsg, longmsg, cause);
+    if (len >= MAXBUF)
+        len = MAXBUF - 1;
+    sprintf(buf, "HTTP/1.0 %s %s\r\nContent-type: text/html\r\nContent-length: %d\r\n\r\n", errnum, shortmsg, len);
+    log_request_status(atoi(errnum));
+    log_request_bytes(len);
+    hotkey_bytes(len);
+    if (rio_writen(fd, buf, strlen(buf)) > 0)
+        rio_writen(fd, body, len);
+}
@@ -0,0 +1,116 @@
+#include "resolver.h"
+
+// 이름 해석 전용 스레드 풀
+// getaddrinfo는 블로킹이고 느릴 때는 리졸버 타임아웃만큼 걸리니, 프록시 워커가 직접 부르지 않고
+// 여기에 요청을 넣은 뒤 완료 콜백으로 결과를 받는다
+// 같은 host:port가 이미 처리 중이면 새 작업을 만들지 않고 콜백만 붙여서 한 번만 푼다
+
+typedef struct resolver_waiter
+{
+    resolver_done_fn done;
+    void *arg;
+    struct resolver_waiter *next;
+} resolver_waiter;
+
+typedef struct resolver_job
+{
+    char host[NI_MAXHOST], port[NI_MAXSERV];
+    dns_resolver_fn fn;
+    resolver_waiter *waiters;
+    struct resolver_job *next; // 대기열 링크
+    struct resolver_job *inflight_next; // 처리 중 목록 링크
+} resolver_job;
+
+// 대기열(FIFO)과 처리 중 목록은 mutex 하나로 보호하고, items는 대기열의 작업 수
+static sem_t mutex, items;
+static resolver_job *queue_head, *queue_tail;
+static resolver_job *inflight;
+
+static void *resolver_routine(void *vargp)
+{
+    resolver_job *job, **pp;
+    resolver_waiter *w, *next;
+    dns_answer answer;
+    int rc;
+
+    Pthread_detach(pthread_self());
+    while (1)
+    {
+        P(&items);
+        P(&mutex);
+        job = queue_head;
+        queue_head = job->next;
+        if (queue_head == NULL)
+            queue_tail = NULL;
+        V(&mutex);
+
+        memset(&answer, 0, sizeof(answer));
+        rc = job->fn(job->host, job->port, &answer);
+
+        // 처리 중 목록에서 빼고 나면 그 뒤로 들어온 요청은 새 작업이 된다
+        // 그 전에 붙은 콜백들은 모두 이 결과를 받는다
+        P(&mutex);
+        for (pp = &inflight; *pp != job; pp = &(*pp)->inflight_next)
+            ;
+        *pp = job->inflight_next;
+        V(&mutex);
+        for (w = job->waiters; w != NULL; w = next)
+        {
+            next = w->next;
+            w->done(rc, &answer, w->arg);
+            Free(w);
+        }
+        Free(job);
+    }
+    return NULL;
+}
+
+void resolver_init(int nthreads)
+{
+    pthread_t tid;
+    int i;
+    Sem_init(&mutex, 0, 1);
+    Sem_init(&items, 0, 0);
+    for (i = 0; i < nthreads; i = i + 1)
+        Pthread_create(&tid, NULL, resolver_routine, NULL);
+}
+
+// host:port 해석을 요청, 끝나면 리졸버 스레드에서 done(status, answer, arg)가 불린다
+void resolver_submit(const char *host, const char *port, dns_resolver_fn fn, resolver_done_fn done, void *arg)
+{
+    resolver_waiter *w = Malloc(sizeof(resolver_waiter));
+    resolver_job *job;
+
+    w->done = done;
+    w->arg = arg;
+    P(&mutex);
+    for (job = inflight; job != NULL; job = job->inflight_next)
+    {
+        if (!strcasecmp(job->host, host) && !strcmp(job->port, port))
+            break;
+    }
+    if (job != NULL)
+    {
+        // 이미 누군가 풀고 있으니 콜백만 붙인다
+        w->next = job->waiters;
+        job->waiters = w;
+        V(&mutex);
+        return;
+    }
+    job = Malloc(sizeof(resolver_job));
+    snprintf(job->host, NI_MAXHOST, "%s", host);
+    snprintf(job->port, NI_MAXSERV, "%s", port);
+    job->fn = fn;
+    w->next = NULL;
+    job->waiters = w;
+    job->next = NULL;
+    job->inflight_next = inflight;
+    inflight = job;
+    if (queue_tail != NULL)
+        queue_tail->next = job;
+    else
+        queue_head = job;
+    queue_tail = job;
+    V(&mutex);
+    V(&items);
+}
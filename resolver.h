@@ -0,0 +1,13 @@
+#ifndef __RESOLVER_H__
+#define __RESOLVER_H__
+
+#include "dnscache.h"
+
+// 이름 해석이 끝나면 리졸버 스레드에서 불리는 콜백
+// status는 0 혹은 EAI_* 에러코드, answer는 콜백 안에서만 유효
+typedef void (*resolver_done_fn)(int status, dns_answer *answer, void *arg);
+
+void resolver_init(int nthreads);
+void resolver_submit(const char *host, const char *port, dns_resolver_fn fn, resolver_done_fn done, void *arg);
+
+#endif /* __RESOLVER_H__ */
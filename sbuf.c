@@ -0,0 +1,70 @@
+#include "sbuf.h"
+
+// n개의 슬롯을 가진 빈 버퍼를 만든다
+void sbuf_init(sbuf_t *sp, int n)
+{
+    sp->buf = Calloc(n, sizeof(int));
+    sp->n = n;
+    sp->front = sp->rear = 0;
+    Sem_init(&sp->mutex, 0, 1);
+    Sem_init(&sp->slots, 0, n);
+    Sem_init(&sp->items, 0, 0);
+}
+
+void sbuf_deinit(sbuf_t *sp)
+{
+    Free(sp->buf);
+}
+
+// 빈 슬롯이 생길 때까지 기다렸다가 item을 뒤에 넣는다
+void sbuf_insert(sbuf_t *sp, int item)
+{
+    P(&sp->slots);
+    P(&sp->mutex);
+    sp->rear = sp->rear + 1;
+    sp->buf[sp->rear % sp->n] = item;
+    V(&sp->mutex);
+    V(&sp->items);
+}
+
+// sbuf_insert와 같지만 deadline(CLOCK_REALTIME 기준 절대 시각)까지 빈 슬롯이 생기지 않으면 넣지 않고 -1
+// 여러 항목이 같은 deadline을 나눠 쓰면 기다리는 시간의 합이 한 번의 대기로 묶인다
+int sbuf_insert_until(sbuf_t *sp, int item, const struct timespec *deadline)
+{
+    int rc;
+
+    if (sem_trywait(&sp->slots) < 0)
+    {
+        while ((rc = sem_timedwait(&sp->slots, deadline)) < 0 && errno == EINTR)
+            ;
+        if (rc < 0)
+            return -1;
+    }
+    P(&sp->mutex);
+    sp->rear = sp->rear + 1;
+    sp->buf[sp->rear % sp->n] = item;
+    V(&sp->mutex);
+    V(&sp->items);
+    return 0;
+}
+
+// 항목이 생길 때까지 기다렸다가 맨 앞의 항목을 꺼낸다
+int sbuf_remove(sbuf_t *sp)
+{
+    int item;
+    P(&sp->items);
+    P(&sp->mutex);
+    sp->front = sp->front + 1;
+    item = sp->buf[sp->front % sp->n];
+    V(&sp->mutex);
+    V(&sp->slots);
+    return item;
+}
+
+// 지금 버퍼에서 기다리는 항목 수 (근사값, 과부하 판단용)
+int sbuf_count(sbuf_t *sp)
+{
+    int n;
+    sem_getvalue(&sp->items, &n);
+    return n < 0 ? 0 : n;
+}
@@ -0,0 +1,26 @@
+#ifndef __SBUF_H__
+#define __SBUF_H__
+
+#include "csapp.h"
+
+// 생산자-소비자 모델의 유한 버퍼 (CS:APP 12.5.4의 sbuf)
+// accept 루프가 connfd를 넣고 워커 스레드들이 꺼내 간다
+typedef struct
+{
+    int *buf;    // 버퍼 배열
+    int n;       // 최대 슬롯 수
+    int front;   // buf[(front+1)%n]이 첫 번째 항목
+    int rear;    // buf[rear%n]이 마지막 항목
+    sem_t mutex; // buf 접근 보호
+    sem_t slots; // 빈 슬롯 수
+    sem_t items; // 채워진 슬롯 수
+} sbuf_t;
+
+void sbuf_init(sbuf_t *sp, int n);
+void sbuf_deinit(sbuf_t *sp);
+void sbuf_insert(sbuf_t *sp, int item);
+int sbuf_insert_until(sbuf_t *sp, int item, const struct timespec *deadline);
+int sbuf_remove(sbuf_t *sp);
+int sbuf_count(sbuf_t *sp);
+
+#endif /* __SBUF_H__ */
@@ -0,0 +1,991 @@
+/*
+ * unittest - 프록시의 파싱과 캐시 판단 함수들, 그리고 프록시가 쓰는 모듈들을 직접 불러 결과를 확인하는 테스트
+ *
+ * usage: unittest [filter]   (filter가 있으면 이름에 그 문자열이 들어간 테스트만)
+ *
+ * proxy.c를 PROXY_NO_MAIN으로 컴파일한 오브젝트와 링크해서 실제 함수를 그대로 부른다 (bench/microbench와 같은 방식)
+ * 실패한 검사마다 줄 번호와 기대값을 찍고, 하나라도 실패하면 1로 끝난다
+ */
+#include "../csapp.h"
+#include "../dnscache.h"
+#include "../resolver.h"
+#include "../connpool.h"
+#include "../nbconnect.h"
+#include "../timerwheel.h"
+
+// proxy.c의 함수들 (proxy.c에는 헤더가 따로 없다)
+int cache_key(char *uri, char *key);
+void cache_init();
+int cache_find(char *uri, char *client_header);
+void cache_uri(char *uri, char *hdr, size_t hdrlen, char *body, size_t bodylen, char *client_header);
+void readend(int index);
+int cache_not_modified(int index, char *client_header);
+time_t parse_http_date(const char *date);
+int cache_send_range(int connfd, int index, char *client_header, int keepalive);
+int makeHTTPheader(char *HTTPheader, char *hostname, char *path, int port, rio_t *client_rio, char *client_header);
+void negcache_init();
+int negcache_find(char *key, int *status, char *reason);
+void negcache_insert(char *key, int status, char *reason);
+
+static int checks, failures;
+// 실제 시간을 재는 검사에서 ms 단위 반올림을 봐주는 폭
+#define TIMING_SLACK_MS 5
+
+static void check(int ok, const char *expr, int line)
+{
+    checks = checks + 1;
+    if (ok)
+        return;
+    failures = failures + 1;
+    printf("FAIL line %d: %s\n", line, expr);
+}
+
+static void check_str(const char *got, const char *want, int line)
+{
+    checks = checks + 1;
+    if (!strcmp(got, want))
+        return;
+    failures = failures + 1;
+    printf("FAIL line %d: got \"%s\", want \"%s\"\n", line, got, want);
+}
+
+#define CHECK(cond) check((cond), #cond, __LINE__)
+#define CHECK_STR(got, want) check_str((got), (want), __LINE__)
+
+typedef void (*test_fn)(void);
+
+static void run_test(const char *name, const char *filter, test_fn fn)
+{
+    int before = failures;
+
+    if (filter != NULL && strstr(name, filter) == NULL)
+        return;
+    fn();
+    printf("%-32s %s\n", name, failures == before ? "ok" : "FAILED");
+    fflush(stdout);
+}
+
+/////////////////// cache_key
+
+// uri 하나를 정규화해서 want와 비교
+static void key_is(char *uri, const char *want, int line)
+{
+    char key[MAXLINE];
+
+    if (cache_key(uri, key) < 0)
+        strcpy(key, "(rejected)");
+    check_str(key, want, line);
+}
+
+#define KEY_IS(uri, want) key_is((uri), (want), __LINE__)
+
+static void test_cache_key(void)
+{
+    static char longuri[MAXLINE];
+    char key[MAXLINE];
+
+    // scheme/host 소문자화와 기본 포트
+    KEY_IS("HTTP://Example.COM:80/Index.html", "http://example.com/Index.html");
+    KEY_IS("https://Example.com:443/", "https://example.com/");
+    KEY_IS("http://example.com:443/", "http://example.com:443/");
+    KEY_IS("http://example.com:8080/a", "http://example.com:8080/a");
+    KEY_IS("http://example.com:/a", "http://example.com/a");
+    KEY_IS("http://[::1]:8080/a", "http://[::1]:8080/a");
+    KEY_IS("http://[::1]/a", "http://[::1]/a");
+    // scheme이 없으면 http, path가 없으면 /
+    KEY_IS("example.com/a", "http://example.com/a");
+    KEY_IS("http://example.com", "http://example.com/");
+    KEY_IS("http://example.com?x=1", "http://example.com/?x=1");
+    // fragment는 버린다
+    KEY_IS("http://example.com/a#top", "http://example.com/a");
+    KEY_IS("http://example.com/a?x=1#top", "http://example.com/a?x=1");
+    // unreserved 문자의 %인코딩은 풀고 나머지는 대문자로
+    KEY_IS("http://example.com/%7euser/%41", "http://example.com/~user/A");
+    KEY_IS("http://example.com/a%2fb%3a", "http://example.com/a%2Fb%3A");
+    KEY_IS("http://example.com/?q=%61%2f", "http://example.com/?q=a%2F");
+    // dot segment
+    KEY_IS("http://example.com/a/./b/../c", "http://example.com/a/c");
+    KEY_IS("http://example.com/a/b/..", "http://example.com/a/");
+    KEY_IS("http://example.com/../../a", "http://example.com/a");
+    KEY_IS("http://example.com/a/%2E%2E/b", "http://example.com/b");
+    // 같은 오브젝트를 가리키는 표기들은 같은 키
+    KEY_IS("http://EXAMPLE.com:80/x/../%7Ey#f", "http://example.com/~y");
+    // 쿼리 순서는 기본 설정(CACHE_KEY_SORT_QUERY 0)에서 그대로 둔다
+    KEY_IS("http://example.com/q?b=2&a=1", "http://example.com/q?b=2&a=1");
+
+    // 정규화한 키가 MAXLINE을 넘으면 잘린 키 대신 -1
+    memset(longuri, 'a', MAXLINE - 4);
+    longuri[0] = '/';
+    CHECK(cache_key(longuri, key) == -1);
+}
+
+/////////////////// 캐시된 오브젝트
+
+// hdr(빈 줄까지 포함한 응답 헤더)와 짧은 body를 uri로 캐시에 넣고, read 보호를 건 index를 리턴
+// 다 쓰면 readend로 풀어야 한다
+static int cache_put(char *uri, char *hdr)
+{
+    cache_uri(uri, hdr, strlen(hdr), "0123456789", 10, "");
+    return cache_find(uri, "");
+}
+
+/////////////////// 조건부 요청 (If-None-Match / If-Modified-Since)
+
+#define LM "Wed, 21 Oct 2015 07:28:00 GMT"
+
+static void test_not_modified(void)
+{
+    int strong, weak, noetag;
+
+    strong = cache_put("http://example.com/strong", "HTTP/1.1 200 OK\r\nETag: \"v1\"\r\nLast-Modified: " LM "\r\n\r\n");
+    weak = cache_put("http://example.com/weak", "HTTP/1.1 200 OK\r\nETag: W/\"v1\"\r\n\r\n");
+    noetag = cache_put("http://example.com/noetag", "HTTP/1.1 200 OK\r\nLast-Modified: " LM "\r\n\r\n");
+    CHECK(strong >= 0 && weak >= 0 && noetag >= 0);
+    if (strong < 0 || weak < 0 || noetag < 0)
+        return;
+
+    // If-None-Match는 태그 목록 중 하나라도 weak 비교로 같으면 304
+    CHECK(cache_not_modified(strong, "If-None-Match: \"v1\"\r\n") == 1);
+    CHECK(cache_not_modified(strong, "If-None-Match: \"v0\", \"v1\"\r\n") == 1);
+    CHECK(cache_not_modified(strong, "If-None-Match: W/\"v1\"\r\n") == 1);
+    CHECK(cache_not_modified(weak, "If-None-Match: \"v1\"\r\n") == 1);
+    CHECK(cache_not_modified(strong, "If-None-Match: *\r\n") == 1);
+    CHECK(cache_not_modified(strong, "If-None-Match: \"v2\"\r\n") == 0);
+    CHECK(cache_not_modified(strong, "If-None-Match: \"v1x\", \"v\"\r\n") == 0);
+    CHECK(cache_not_modified(noetag, "If-None-Match: \"v1\"\r\n") == 0);
+
+    // If-Modified-Since는 Last-Modified보다 같거나 늦으면 304
+    CHECK(cache_not_modified(strong, "If-Modified-Since: " LM "\r\n") == 1);
+    CHECK(cache_not_modified(noetag, "If-Modified-Since: Thu, 22 Oct 2015 07:28:00 GMT\r\n") == 1);
+    CHECK(cache_not_modified(noetag, "If-Modified-Since: Wednesday, 21-Oct-15 07:28:00 GMT\r\n") == 1);
+    CHECK(cache_not_modified(noetag, "If-Modified-Since: Tue, 20 Oct 2015 07:28:00 GMT\r\n") == 0);
+    CHECK(cache_not_modified(noetag, "If-Modified-Since: yesterday\r\n") == 0);
+    CHECK(cache_not_modified(weak, "If-Modified-Since: " LM "\r\n") == 0);
+
+    // 둘 다 있으면 If-None-Match만 본다
+    CHECK(cache_not_modified(strong, "If-None-Match: \"v2\"\r\nIf-Modified-Since: " LM "\r\n") == 0);
+    CHECK(cache_not_modified(strong, "If-Modified-Since: Tue, 20 Oct 2015 07:28:00 GMT\r\nIf-None-Match: \"v1\"\r\n") == 1);
+    // If-None-Match가 있는데 ETag가 없으면 날짜가 맞아도 304가 아니다
+    CHECK(cache_not_modified(noetag, "If-None-Match: \"v1\"\r\nIf-Modified-Since: " LM "\r\n") == 0);
+    // 조건이 없으면 전체 응답
+    CHECK(cache_not_modified(strong, "Accept: */*\r\n") == 0);
+
+    readend(strong);
+    readend(weak);
+    readend(noetag);
+}
+
+static void test_parse_http_date(void)
+{
+    // RFC 7231 7.1.1.1의 예, 세 형식 모두 같은 시각
+    CHECK(parse_http_date("Sun, 06 Nov 1994 08:49:37 GMT") == 784111777);
+    CHECK(parse_http_date("Sunday, 06-Nov-94 08:49:37 GMT") == 784111777);
+    CHECK(parse_http_date("Sun Nov  6 08:49:37 1994") == 784111777);
+    CHECK(parse_http_date("Thu, 01 Jan 1970 00:00:00 GMT") == 0);
+    CHECK(parse_http_date("Wed, 21 Oct 2015 07:28:00 GMT") == 1445412480);
+    // 형식이 틀리면 -1
+    CHECK(parse_http_date("") == -1);
+    CHECK(parse_http_date("yesterday") == -1);
+    CHECK(parse_http_date("2015-10-21T07:28:00Z") == -1);
+}
+
+/////////////////// Range
+
+// cache_send_range가 socketpair에 쓴 응답 전체를 out에 받아온다, 206/416을 보냈다면 1
+// 응답이 작아서 소켓 버퍼에 다 들어가니 한 스레드에서 쓰고 읽어도 된다
+static int send_range(int index, char *client_header, char *out, size_t outsize)
+{
+    int fds[2], rc;
+    ssize_t n;
+
+    if (socketpair(AF_UNIX, SOCK_STREAM, 0, fds) < 0)
+        unix_error("socketpair");
+    rc = cache_send_range(fds[0], index, client_header, 0);
+    Close(fds[0]);
+    n = rio_readn(fds[1], out, outsize - 1);
+    out[n > 0 ? n : 0] = '\0';
+    Close(fds[1]);
+    return rc;
+}
+
+static int starts_with(const char *str, const char *prefix)
+{
+    return !strncmp(str, prefix, strlen(prefix));
+}
+
+// 응답의 body (헤더 끝의 빈 줄 다음)
+static char *body_of(char *resp)
+{
+    char *p = strstr(resp, "\r\n\r\n");
+    return p != NULL ? p + 4 : "";
+}
+
+// 구간 하나짜리 206의 Content-Range와 body 확인
+static void single_is(int index, char *range, const char *content_range, const char *body, int line)
+{
+    char hdr[MAXLINE], resp[MAXLINE];
+
+    snprintf(hdr, sizeof(hdr), "Range: %s\r\n", range);
+    check(send_range(index, hdr, resp, sizeof(resp)) == 1, range, line);
+    check(starts_with(resp, "HTTP/1.1 206 Partial Content\r\n"), range, line);
+    check(strstr(resp, content_range) != NULL, content_range, line);
+    check_str(body_of(resp), body, line);
+}
+
+// 만족 가능한 구간이 없어서 416
+static void unsatisfiable(int index, char *range, int line)
+{
+    char hdr[MAXLINE], resp[MAXLINE];
+
+    snprintf(hdr, sizeof(hdr), "Range: %s\r\n", range);
+    check(send_range(index, hdr, resp, sizeof(resp)) == 1, range, line);
+    check(starts_with(resp, "HTTP/1.1 416 Range Not Satisfiable\r\n"), range, line);
+    check(strstr(resp, "Content-Range: bytes */10\r\n") != NULL, range, line);
+    check_str(body_of(resp), "", line);
+}
+
+// Range를 무시하고 전체를 보내야 하는 경우, 아무것도 쓰지 않고 0
+static void ignored(int index, char *client_header, int line)
+{
+    char resp[MAXLINE];
+
+    check(send_range(index, client_header, resp, sizeof(resp)) == 0, client_header, line);
+    check_str(resp, "", line);
+}
+
+#define SINGLE_IS(range, content_range, body) single_is(index, (range), (content_range), (body), __LINE__)
+#define UNSATISFIABLE(range) unsatisfiable(index, (range), __LINE__)
+#define IGNORED(client_header) ignored(index, (client_header), __LINE__)
+
+static void test_range(void)
+{
+    char resp[MAXLINE], many[MAXLINE], *body, *p;
+    size_t length;
+    int index, i;
+
+    index = cache_put("http://example.com/range",
+            "HTTP/1.1 200 OK\r\nContent-Type: text/plain\r\nContent-Length: 10\r\nETag: \"r1\"\r\n"
+            "Last-Modified: " LM "\r\n\r\n");
+    CHECK(index >= 0);
+    if (index < 0)
+        return;
+
+    // 구간 하나, 끝이 body를 넘으면 body 끝까지
+    SINGLE_IS("bytes=0-3", "Content-Range: bytes 0-3/10\r\nContent-Length: 4\r\n", "0123");
+    SINGLE_IS("bytes=5-", "Content-Range: bytes 5-9/10\r\n", "56789");
+    SINGLE_IS("bytes=8-100", "Content-Range: bytes 8-9/10\r\n", "89");
+    SINGLE_IS("bytes=9-9", "Content-Range: bytes 9-9/10\r\n", "9");
+    // suffix는 마지막 n바이트, body보다 길면 전체
+    SINGLE_IS("bytes=-3", "Content-Range: bytes 7-9/10\r\n", "789");
+    SINGLE_IS("bytes=-20", "Content-Range: bytes 0-9/10\r\n", "0123456789");
+    // 만족 불가능한 구간은 빼고 남은 것만
+    SINGLE_IS("bytes=20-30, 2-2", "Content-Range: bytes 2-2/10\r\n", "2");
+    // 원래 Content-Length는 빼고 구간 길이로 바꾼다
+    CHECK(send_range(index, "Range: bytes=0-3\r\n", resp, sizeof(resp)) == 1 && strstr(resp, "Content-Length: 10") == NULL);
+
+    // 구간이 여럿이면 multipart/byteranges, Content-Length는 multipart body 전체 길이
+    CHECK(send_range(index, "Range: bytes=0-1,-2\r\n", resp, sizeof(resp)) == 1);
+    CHECK(starts_with(resp, "HTTP/1.1 206 Partial Content\r\n"));
+    CHECK(strstr(resp, "Content-Type: multipart/byteranges; boundary=") != NULL);
+    CHECK(strstr(resp, "Content-Type: text/plain\r\nContent-Range: bytes 0-1/10\r\n\r\n01\r\n--") != NULL);
+    CHECK(strstr(resp, "Content-Type: text/plain\r\nContent-Range: bytes 8-9/10\r\n\r\n89\r\n--") != NULL);
+    body = body_of(resp);
+    p = strstr(resp, "\r\nContent-Length: ");
+    CHECK(p != NULL && sscanf(p, "\r\nContent-Length: %zu", &length) == 1 && length == strlen(body));
+    p = strrchr(body, '-');
+    CHECK(p != NULL && !strcmp(p - 1, "--\r\n"));
+
+    // 416
+    UNSATISFIABLE("bytes=10-");
+    UNSATISFIABLE("bytes=-0");
+    UNSATISFIABLE("bytes=20-30,40-");
+
+    // Range가 없거나, 문법이 틀렸거나, 너무 많으면 전체 응답
+    IGNORED("Accept: */*\r\n");
+    IGNORED("Range: items=0-1\r\n");
+    IGNORED("Range: bytes=5-2\r\n");
+    IGNORED("Range: bytes=abc\r\n");
+    IGNORED("Range: bytes=1-2x\r\n");
+    strcpy(many, "Range: bytes=0-0");
+    for (i = 1; i <= 16; i = i + 1)
+        sprintf(many + strlen(many), ",%d-%d", i % 10, i % 10);
+    strcat(many, "\r\n");
+    IGNORED(many);
+
+    // If-Range가 캐시된 validator와 같을 때만 구간을 보낸다 (ETag는 strong 비교)
+    CHECK(send_range(index, "Range: bytes=0-0\r\nIf-Range: \"r1\"\r\n", resp, sizeof(resp)) == 1);
+    CHECK(send_range(index, "Range: bytes=0-0\r\nIf-Range: " LM "\r\n", resp, sizeof(resp)) == 1);
+    IGNORED("Range: bytes=0-0\r\nIf-Range: \"r0\"\r\n");
+    IGNORED("Range: bytes=0-0\r\nIf-Range: W/\"r1\"\r\n");
+
+    readend(index);
+}
+
+/////////////////// makeHTTPheader
+
+// 클라이언트가 보낸 헤더 블록(빈 줄 포함)을 socketpair로 흘려 넣고 makeHTTPheader를 부른다
+static int make_header(const char *block, char *out, char *client_header)
+{
+    int fds[2], rc;
+    rio_t rio;
+
+    if (socketpair(AF_UNIX, SOCK_STREAM, 0, fds) < 0)
+        unix_error("socketpair");
+    Rio_writen(fds[0], (void *)block, strlen(block));
+    Close(fds[0]);
+    rio_readinitb(&rio, fds[1]);
+    rc = makeHTTPheader(out, "example.com", "/a", 80, &rio, client_header);
+    Close(fds[1]);
+    return rc;
+}
+
+static void test_make_header(void)
+{
+    static char block[MAXLINE * 2];
+    char out[MAXLINE], client_header[MAXLINE];
+    int i;
+
+    // Host는 클라이언트 것을 쓰고, 연결 관련 헤더와 User-Agent는 프록시 값으로 바꾸고, 나머지는 그대로
+    CHECK(make_header("Host: www.example.com\r\nProxy-Connection: close\r\nAccept: */*\r\n\r\n", out, client_header) == 0);
+    CHECK(starts_with(out, "GET /a HTTP/1.1\r\nHost: www.example.com\r\nConnection: keep-alive\r\nUser-Agent: "));
+    CHECK(strstr(out, "Accept: */*\r\n\r\n") != NULL);
+    CHECK(strstr(out, "Proxy-Connection") == NULL);
+    CHECK(strstr(client_header, "Proxy-Connection: close\r\n") != NULL);
+    // Host가 없으면 uri의 hostname으로
+    CHECK(make_header("\r\n", out, client_header) == 0);
+    CHECK(strstr(out, "Host: example.com\r\n") != NULL);
+
+    // 헤더가 버퍼에 다 들어가지 않으면 일부를 버린 요청을 만들지 않고 -1
+    block[0] = '\0';
+    for (i = 0; i < 80; i = i + 1)
+        sprintf(block + strlen(block), "X-Filler-%02d: %0100d\r\n", i, 0);
+    strcat(block, "\r\n");
+    CHECK(make_header(block, out, client_header) == -1);
+    // 전달하지 않는 헤더가 커서 client_header만 넘치는 경우도 (Vary 판단이 잘린 헤더로 이뤄지지 않도록)
+    sprintf(block, "User-Agent: %05000d\r\n", 0);
+    for (i = 0; i < 30; i = i + 1)
+        sprintf(block + strlen(block), "X-Filler-%02d: %0100d\r\n", i, 0);
+    strcat(block, "\r\n");
+    CHECK(make_header(block, out, client_header) == -1);
+}
+
+/////////////////// negative cache
+
+// 실패를 기록한 뒤 time()이 ttl초 넘어갈 때까지 기다린다 (최대 ttl초)
+static void wait_seconds_from(time_t start, int ttl)
+{
+    while (time(NULL) < start + ttl)
+        usleep(10000);
+}
+
+static void test_negcache(void)
+{
+    char reason[64];
+    int status;
+    time_t inserted;
+
+    // PROXY_NEG_CACHE_TTL로 기억 시간을 1초로 줄인다
+    setenv("PROXY_NEG_CACHE_TTL", "1", 1);
+    negcache_init();
+    CHECK(negcache_find("a.example:80", &status, reason) == 0);
+    inserted = time(NULL);
+    negcache_insert("a.example:80", 502, "DNS Lookup Failed");
+    CHECK(negcache_find("a.example:80", &status, reason) == 1);
+    CHECK(status == 502);
+    CHECK_STR(reason, "DNS Lookup Failed");
+    CHECK(negcache_find("b.example:80", &status, reason) == 0);
+    // 같은 키는 새 실패로 덮어쓴다
+    negcache_insert("a.example:80", 503, "Connection Failed");
+    CHECK(negcache_find("a.example:80", &status, reason) == 1);
+    CHECK(status == 503);
+    CHECK_STR(reason, "Connection Failed");
+    // TTL이 지나면 잊는다
+    wait_seconds_from(inserted, 1);
+    CHECK(negcache_find("a.example:80", &status, reason) == 0);
+
+    // 0이면 기록해도 바로 만료된다 (negative cache 끔)
+    setenv("PROXY_NEG_CACHE_TTL", "0", 1);
+    negcache_init();
+    negcache_insert("a.example:80", 502, "DNS Lookup Failed");
+    CHECK(negcache_find("a.example:80", &status, reason) == 0);
+
+    // 다음 테스트를 위해 기본값으로 되돌린다
+    setenv("PROXY_NEG_CACHE_TTL", "5", 1);
+    negcache_init();
+    unsetenv("PROXY_NEG_CACHE_TTL");
+}
+
+/////////////////// DNS 캐시
+
+// 시간은 가짜 시계로 움직이고, 리졸버는 hosts 파일 리졸버에 호출 횟수와 TTL을 더해 쓴다
+static time_t fake_now = 1000;
+static int dns_calls, dns_ttl;
+
+static time_t fake_clock(void)
+{
+    return fake_now;
+}
+
+// "flaky."로 시작하는 이름은 리졸버 타임아웃처럼 EAI_AGAIN
+static int counting_resolver(const char *host, const char *port, dns_answer *answer)
+{
+    int rc;
+
+    __atomic_add_fetch(&dns_calls, 1, __ATOMIC_SEQ_CST);
+    if (!strncmp(host, "flaky.", 6))
+        return EAI_AGAIN;
+    if ((rc = dns_hosts_resolver(host, port, answer)) == 0)
+        answer->ttl = dns_ttl;
+    return rc;
+}
+
+// 백그라운드 갱신처럼 따로 도는 리졸버 호출이 n번째가 될 때까지 최대 2초 기다린다
+static int wait_calls(int *calls, int n)
+{
+    int i;
+
+    for (i = 0; i < 200 && __atomic_load_n(calls, __ATOMIC_SEQ_CST) < n; i = i + 1)
+        usleep(10000);
+    return __atomic_load_n(calls, __ATOMIC_SEQ_CST) >= n;
+}
+
+static void test_dnscache(void)
+{
+    char path[] = "/tmp/unittest-hostsXXXXXX";
+    static const char hosts_text[] = "127.0.0.1 one.test\n127.0.0.2 two.test # 주석\n::1 six.test\n";
+    dns_answer answer;
+    int fd;
+
+    if ((fd = mkstemp(path)) < 0)
+        unix_error("mkstemp");
+    Rio_writen(fd, (void *)hosts_text, strlen(hosts_text));
+    Close(fd);
+    CHECK(dnscache_load_hosts(path) == 3);
+    unlink(path);
+    dnscache_set_resolver(counting_resolver);
+    dnscache_set_clock(fake_clock);
+
+    // 처음 조회만 리졸버를 부르고, 이름은 대소문자를 가리지 않는다
+    dns_ttl = 60;
+    CHECK(dnscache_lookup("one.test", "80", &answer) == 0);
+    CHECK(dns_calls == 1);
+    CHECK(answer.naddr == 1 && answer.addr[0].family == AF_INET);
+    CHECK(ntohs(((struct sockaddr_in *)&answer.addr[0].addr)->sin_port) == 80);
+    fake_now = fake_now + 49;
+    CHECK(dnscache_lookup("ONE.test", "80", &answer) == 0);
+    CHECK(dns_calls == 1);
+    // 포트가 다르면 다른 키
+    CHECK(dnscache_lookup("one.test", "8080", &answer) == 0);
+    CHECK(dns_calls == 2);
+    CHECK(ntohs(((struct sockaddr_in *)&answer.addr[0].addr)->sin_port) == 8080);
+
+    // 만료까지 DNS_REFRESH_AHEAD(10초) 이하로 남으면 캐시로 답하고 뒤에서 다시 푼다
+    fake_now = fake_now + 2;
+    CHECK(dnscache_lookup("one.test", "80", &answer) == 0);
+    CHECK(answer.naddr == 1);
+    CHECK(wait_calls(&dns_calls, 3));
+    // 갱신 중이든 끝났든 다음 조회가 또 갱신을 걸지는 않는다
+    CHECK(dnscache_lookup("one.test", "80", &answer) == 0);
+    CHECK(dns_calls == 3);
+
+    // 리졸버가 준 TTL만큼 기억한다
+    dns_ttl = 30;
+    CHECK(dnscache_lookup("two.test", "80", &answer) == 0);
+    CHECK(dns_calls == 4);
+    fake_now = fake_now + 19;
+    CHECK(dnscache_lookup("two.test", "80", &answer) == 0);
+    CHECK(dns_calls == 4);
+    fake_now = fake_now + 11;
+    CHECK(dnscache_lookup("two.test", "80", &answer) == 0);
+    CHECK(dns_calls == 5);
+    CHECK(answer.addr[0].family == AF_INET);
+    CHECK(dnscache_lookup("six.test", "80", &answer) == 0);
+    CHECK(answer.naddr == 1 && answer.addr[0].family == AF_INET6);
+    CHECK(dns_calls == 6);
+
+    // 없는 이름은 DNS_NEG_TTL(5초) 동안 negative 엔트리로 답한다
+    CHECK(dnscache_lookup("missing.test", "80", &answer) == EAI_NONAME);
+    CHECK(dns_calls == 7);
+    fake_now = fake_now + 4;
+    CHECK(dnscache_lookup("missing.test", "80", &answer) == EAI_NONAME);
+    CHECK(dns_calls == 7);
+    fake_now = fake_now + 1;
+    CHECK(dnscache_lookup("missing.test", "80", &answer) == EAI_NONAME);
+    CHECK(dns_calls == 8);
+
+    // 일시적인 실패는 기억하지 않는다
+    CHECK(dnscache_lookup("flaky.test", "80", &answer) == EAI_AGAIN);
+    CHECK(dnscache_lookup("flaky.test", "80", &answer) == EAI_AGAIN);
+    CHECK(dns_calls == 10);
+
+    dnscache_set_clock(NULL);
+    dnscache_set_resolver(dns_getaddrinfo_resolver);
+}
+
+/////////////////// 리졸버 풀
+
+// 세마포어를 최대 ms 동안 기다린다, 잡았으면 1 (기다리던 일이 안 일어나도 테스트가 멈추지 않도록)
+static int wait_sem(sem_t *sem, int ms)
+{
+    struct timespec deadline;
+
+    clock_gettime(CLOCK_REALTIME, &deadline);
+    deadline.tv_sec = deadline.tv_sec + ms / 1000;
+    deadline.tv_nsec = deadline.tv_nsec + (ms % 1000) * 1000000L;
+    if (deadline.tv_nsec >= 1000000000L)
+    {
+        deadline.tv_sec = deadline.tv_sec + 1;
+        deadline.tv_nsec = deadline.tv_nsec - 1000000000L;
+    }
+    while (sem_timedwait(sem, &deadline) < 0)
+    {
+        if (errno != EINTR)
+            return 0;
+    }
+    return 1;
+}
+
+// 테스트가 문을 열어줄 때까지 리졸버 스레드를 붙잡아두는 리졸버
+static sem_t gate_entered, gate_open, resolved;
+static int gated_calls;
+
+static int gated_resolver(const char *host, const char *port, dns_answer *answer)
+{
+    __atomic_add_fetch(&gated_calls, 1, __ATOMIC_SEQ_CST);
+    V(&gate_entered);
+    P(&gate_open);
+    answer->naddr = 1;
+    answer->addr[0].family = AF_INET;
+    answer->ttl = atoi(port);
+    return 0;
+}
+
+// 받은 결과의 ttl(= 포트 번호)을 arg에 남긴다
+static void resolved_to(int status, dns_answer *answer, void *arg)
+{
+    *(int *)arg = status == 0 ? answer->ttl : -1;
+    V(&resolved);
+}
+
+static void test_resolver(void)
+{
+    int seen[5] = {0, 0, 0, 0, 0}, i;
+
+    Sem_init(&gate_entered, 0, 0);
+    Sem_init(&gate_open, 0, 0);
+    Sem_init(&resolved, 0, 0);
+
+    // 첫 요청이 풀리는 동안 같은 host:port(대소문자 무관)로 온 요청은 콜백만 붙는다
+    resolver_submit("slow.test", "80", gated_resolver, resolved_to, &seen[0]);
+    CHECK(wait_sem(&gate_entered, 2000));
+    resolver_submit("SLOW.test", "80", gated_resolver, resolved_to, &seen[1]);
+    resolver_submit("slow.test", "80", gated_resolver, resolved_to, &seen[2]);
+    // 포트가 다르면 따로 푼다
+    resolver_submit("slow.test", "8080", gated_resolver, resolved_to, &seen[3]);
+    CHECK(wait_sem(&gate_entered, 2000));
+    CHECK(gated_calls == 2);
+    V(&gate_open);
+    V(&gate_open);
+    for (i = 0; i < 4; i = i + 1)
+        CHECK(wait_sem(&resolved, 2000));
+    CHECK(gated_calls == 2);
+    CHECK(seen[0] == 80 && seen[1] == 80 && seen[2] == 80);
+    CHECK(seen[3] == 8080);
+
+    // 끝난 뒤에 온 요청은 새로 푼다
+    resolver_submit("slow.test", "80", gated_resolver, resolved_to, &seen[4]);
+    CHECK(wait_sem(&gate_entered, 2000));
+    V(&gate_open);
+    CHECK(wait_sem(&resolved, 2000));
+    CHECK(gated_calls == 3);
+    CHECK(seen[4] == 80);
+}
+
+/////////////////// origin 연결 풀
+
+// 풀이 닫은 fd인지 (확인 전에 새 fd를 만들지 않아야 번호 재사용에 속지 않는다)
+static int fd_closed(int fd)
+{
+    return fcntl(fd, F_GETFD) < 0 && errno == EBADF;
+}
+
+static void test_connpool(void)
+{
+    // POOL_MAX_IDLE_PER_ORIGIN(8)보다 하나 많이
+    int pairs[9][2], peer[2], i;
+
+    connpool_init();
+    connpool_set_clock(fake_clock);
+
+    // origin당 한도를 넘은 반납은 닫는다
+    for (i = 0; i < 9; i = i + 1)
+    {
+        if (socketpair(AF_UNIX, SOCK_STREAM, 0, pairs[i]) < 0)
+            unix_error("socketpair");
+    }
+    for (i = 0; i < 9; i = i + 1)
+    {
+        connpool_put("a.test:80", pairs[i][0]);
+        fake_now = fake_now + 1;
+    }
+    CHECK(fd_closed(pairs[8][0]));
+    CHECK(connpool_get("b.test:80") == -1);
+    // 가장 최근에 반납된 연결부터 꺼낸다
+    for (i = 7; i >= 0; i = i - 1)
+        CHECK(connpool_get("a.test:80") == pairs[i][0]);
+    CHECK(connpool_get("a.test:80") == -1);
+    for (i = 0; i < 9; i = i + 1)
+    {
+        if (i < 8)
+            Close(pairs[i][0]);
+        Close(pairs[i][1]);
+    }
+
+    // origin이 닫은 연결은 꺼내지 않고 버린다
+    if (socketpair(AF_UNIX, SOCK_STREAM, 0, peer) < 0)
+        unix_error("socketpair");
+    connpool_put("a.test:80", peer[0]);
+    Close(peer[1]);
+    CHECK(connpool_get("a.test:80") == -1);
+    CHECK(fd_closed(peer[0]));
+
+    // POOL_IDLE_TIMEOUT(30초)까지는 쓰고, 넘게 놀았으면 버린다
+    if (socketpair(AF_UNIX, SOCK_STREAM, 0, peer) < 0)
+        unix_error("socketpair");
+    connpool_put("a.test:80", peer[0]);
+    fake_now = fake_now + 30;
+    CHECK(connpool_get("a.test:80") == peer[0]);
+    connpool_put("a.test:80", peer[0]);
+    fake_now = fake_now + 31;
+    CHECK(connpool_get("a.test:80") == -1);
+    CHECK(fd_closed(peer[0]));
+    Close(peer[1]);
+
+    connpool_set_clock(NULL);
+}
+
+/////////////////// happy eyeballs 연결 경주
+
+static void addr_v4(dns_addr *a, const char *ip, int port)
+{
+    struct sockaddr_in *sin = (struct sockaddr_in *)&a->addr;
+
+    memset(a, 0, sizeof(*a));
+    a->family = AF_INET;
+    a->socktype = SOCK_STREAM;
+    a->protocol = IPPROTO_TCP;
+    a->addrlen = sizeof(struct sockaddr_in);
+    sin->sin_family = AF_INET;
+    sin->sin_port = htons(port);
+    inet_pton(AF_INET, ip, &sin->sin_addr);
+}
+
+static void addr_v6(dns_addr *a, const char *ip, int port)
+{
+    struct sockaddr_in6 *sin6 = (struct sockaddr_in6 *)&a->addr;
+
+    memset(a, 0, sizeof(*a));
+    a->family = AF_INET6;
+    a->socktype = SOCK_STREAM;
+    a->protocol = IPPROTO_TCP;
+    a->addrlen = sizeof(struct sockaddr_in6);
+    sin6->sin6_family = AF_INET6;
+    sin6->sin6_port = htons(port);
+    inet_pton(AF_INET6, ip, &sin6->sin6_addr);
+}
+
+// 127.0.0.1의 빈 포트에서 listen하는 소켓, 포트는 *port에
+static int listen_local(int backlog, int *port)
+{
+    struct sockaddr_in sin;
+    socklen_t len = sizeof(sin);
+    int fd = Socket(AF_INET, SOCK_STREAM, 0);
+
+    memset(&sin, 0, sizeof(sin));
+    sin.sin_family = AF_INET;
+    sin.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    Bind(fd, (SA *)&sin, sizeof(sin));
+    Listen(fd, backlog);
+    if (getsockname(fd, (SA *)&sin, &len) < 0)
+        unix_error("getsockname");
+    *port = ntohs(sin.sin_port);
+    return fd;
+}
+
+// 연결된 소켓의 상대 포트
+static int peer_port(int fd)
+{
+    struct sockaddr_in sin;
+    socklen_t len = sizeof(sin);
+
+    if (getpeername(fd, (SA *)&sin, &len) < 0)
+        return -1;
+    return ntohs(sin.sin_port);
+}
+
+static long long elapsed_ms(struct timespec *start)
+{
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (now.tv_sec - start->tv_sec) * 1000LL + (now.tv_nsec - start->tv_nsec) / 1000000;
+}
+
+static void test_connect_race(void)
+{
+    connect_race cr;
+    dns_answer answer;
+    struct timespec start;
+    int good, good_port, stall, stall_port, filler, refused_port, fd, closed;
+
+    // 리졸버 순서를 지키면서 첫 주소의 패밀리부터 번갈아 시도한다
+    answer.naddr = 4;
+    addr_v4(&answer.addr[0], "192.0.2.1", 80);
+    addr_v4(&answer.addr[1], "192.0.2.2", 80);
+    addr_v6(&answer.addr[2], "2001:db8::1", 80);
+    addr_v6(&answer.addr[3], "2001:db8::2", 80);
+    connect_race_start(&cr, &answer, CONNECT_ATTEMPT_TIMEOUT_MS, CONNECT_TIMEOUT_MS);
+    CHECK(cr.naddr == 4);
+    CHECK(cr.addr[0].family == AF_INET && cr.addr[1].family == AF_INET6);
+    CHECK(cr.addr[2].family == AF_INET && cr.addr[3].family == AF_INET6);
+    CHECK(!memcmp(&cr.addr[0], &answer.addr[0], sizeof(dns_addr)) && !memcmp(&cr.addr[2], &answer.addr[1], sizeof(dns_addr)));
+    CHECK(!memcmp(&cr.addr[1], &answer.addr[2], sizeof(dns_addr)) && !memcmp(&cr.addr[3], &answer.addr[3], sizeof(dns_addr)));
+    connect_race_abort(&cr);
+    // 한 패밀리가 바닥나면 남은 것을 순서대로
+    answer.naddr = 3;
+    addr_v6(&answer.addr[0], "2001:db8::1", 80);
+    addr_v6(&answer.addr[1], "2001:db8::2", 80);
+    addr_v4(&answer.addr[2], "192.0.2.1", 80);
+    connect_race_start(&cr, &answer, CONNECT_ATTEMPT_TIMEOUT_MS, CONNECT_TIMEOUT_MS);
+    CHECK(cr.addr[0].family == AF_INET6 && cr.addr[1].family == AF_INET && cr.addr[2].family == AF_INET6);
+    CHECK(!memcmp(&cr.addr[2], &answer.addr[1], sizeof(dns_addr)));
+    connect_race_abort(&cr);
+
+    // 받는 서버, 거부하는 포트(닫은 listener의 포트), 응답하지 않는 서버를 만든다
+    // backlog 0인 listener는 accept 큐가 한 번 차면 SYN을 버리니 connect가 끝나지 않는다
+    good = listen_local(16, &good_port);
+    closed = listen_local(1, &refused_port);
+    Close(closed);
+    stall = listen_local(0, &stall_port);
+    filler = Socket(AF_INET, SOCK_STREAM, 0);
+    answer.naddr = 1;
+    addr_v4(&answer.addr[0], "127.0.0.1", stall_port);
+    Connect(filler, (SA *)&answer.addr[0].addr, answer.addr[0].addrlen);
+
+    // 거부당하면 딜레이를 기다리지 않고 바로 다음 후보로
+    answer.naddr = 2;
+    addr_v4(&answer.addr[0], "127.0.0.1", refused_port);
+    addr_v4(&answer.addr[1], "127.0.0.1", good_port);
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    fd = connect_race_blocking(&answer, CONNECT_ATTEMPT_TIMEOUT_MS, CONNECT_TIMEOUT_MS);
+    CHECK(fd >= 0 && peer_port(fd) == good_port);
+    CHECK(elapsed_ms(&start) < CONNECT_ATTEMPT_DELAY_MS);
+    // 돌려받은 fd는 blocking 모드
+    CHECK(fd >= 0 && !(fcntl(fd, F_GETFL) & O_NONBLOCK));
+    if (fd >= 0)
+        Close(fd);
+    // 모두 거부당하면 마지막 에러로 실패
+    answer.naddr = 1;
+    addr_v4(&answer.addr[0], "127.0.0.1", refused_port);
+    CHECK(connect_race_blocking(&answer, CONNECT_ATTEMPT_TIMEOUT_MS, CONNECT_TIMEOUT_MS) == -1 && errno == ECONNREFUSED);
+
+    // 응답 없는 첫 후보는 두고 CONNECT_ATTEMPT_DELAY_MS 뒤에 다음 후보를 시작해서 먼저 된 쪽을 쓴다
+    answer.naddr = 2;
+    addr_v4(&answer.addr[0], "127.0.0.1", stall_port);
+    addr_v4(&answer.addr[1], "127.0.0.1", good_port);
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    fd = connect_race_blocking(&answer, CONNECT_ATTEMPT_TIMEOUT_MS, CONNECT_TIMEOUT_MS);
+    CHECK(fd >= 0 && peer_port(fd) == good_port);
+    CHECK(elapsed_ms(&start) >= CONNECT_ATTEMPT_DELAY_MS - TIMING_SLACK_MS && elapsed_ms(&start) < CONNECT_ATTEMPT_TIMEOUT_MS);
+    if (fd >= 0)
+        Close(fd);
+
+    // 후보 하나의 시도 타임아웃이 지나면 다음 후보로, 남은 게 없으면 ETIMEDOUT
+    answer.naddr = 1;
+    addr_v4(&answer.addr[0], "127.0.0.1", stall_port);
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    CHECK(connect_race_blocking(&answer, 100, 2000) == -1 && errno == ETIMEDOUT);
+    CHECK(elapsed_ms(&start) >= 100 - TIMING_SLACK_MS && elapsed_ms(&start) < 1000);
+    // 전체 타임아웃은 시도 타임아웃보다 먼저 끝낸다
+    answer.naddr = 2;
+    addr_v4(&answer.addr[1], "127.0.0.1", stall_port);
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    CHECK(connect_race_blocking(&answer, 2000, 300) == -1 && errno == ETIMEDOUT);
+    CHECK(elapsed_ms(&start) >= 300 - TIMING_SLACK_MS && elapsed_ms(&start) < 2000);
+
+    Close(filler);
+    Close(stall);
+    Close(good);
+}
+
+/////////////////// 타이밍 휠
+
+// main이 tick 스레드 없이 초기화한 휠을 timerwheel_advance로 직접 돌린다
+typedef struct
+{
+    wheel_timer timer;
+    char name;
+    int fired;
+    int rearm_ms; // 0보다 크면 처음 울릴 때 자기 타이머를 이만큼 뒤로 다시 건다
+    sem_t *entered, *gate; // NULL이 아니면 콜백 안에서 gate가 열릴 때까지 기다린다
+} test_timer;
+
+static char fire_order[32];
+static int fire_count;
+
+static void test_timer_fired(void *arg)
+{
+    test_timer *tt = arg;
+
+    tt->fired = tt->fired + 1;
+    if (fire_count < (int)sizeof(fire_order) - 1)
+        fire_order[fire_count] = tt->name;
+    fire_count = fire_count + 1;
+    if (tt->rearm_ms > 0 && tt->fired == 1)
+        timer_arm(&tt->timer, tt->rearm_ms, test_timer_fired, tt);
+    if (tt->gate != NULL)
+    {
+        V(tt->entered);
+        P(tt->gate);
+    }
+}
+
+static void test_timer_init(test_timer *tt, char name)
+{
+    memset(tt, 0, sizeof(*tt));
+    timer_init(&tt->timer);
+    tt->name = name;
+}
+
+static void test_timer_arm(test_timer *tt, int ms)
+{
+    timer_arm(&tt->timer, ms, test_timer_fired, tt);
+}
+
+static void *advance_one(void *vargp)
+{
+    timerwheel_advance(1);
+    return NULL;
+}
+
+static void *cancel_timer(void *vargp)
+{
+    test_timer *tt = vargp;
+
+    timer_cancel(&tt->timer);
+    __atomic_store_n(&tt->rearm_ms, -1, __ATOMIC_SEQ_CST);
+    return NULL;
+}
+
+static void test_timerwheel(void)
+{
+    test_timer a, b, c, d;
+    sem_t entered, gate;
+    pthread_t runner, canceller;
+
+    // ms는 tick으로 올림하고, 0이어도 다음 tick에 울린다
+    test_timer_init(&a, 'a');
+    test_timer_arm(&a, 3 * TIMER_TICK_MS - 1);
+    timerwheel_advance(2);
+    CHECK(a.fired == 0);
+    timerwheel_advance(1);
+    CHECK(a.fired == 1);
+    timerwheel_advance(10);
+    CHECK(a.fired == 1);
+    test_timer_arm(&a, 0);
+    timerwheel_advance(1);
+    CHECK(a.fired == 2);
+
+    // 64 tick 이상은 위 레벨에 들어갔다가 cascade로 내려와서 정확한 tick에 울린다
+    // (레벨 1은 64 tick, 레벨 2는 4096 tick, 레벨 3은 262144 tick부터)
+    test_timer_init(&a, 'a');
+    test_timer_init(&b, 'b');
+    test_timer_init(&c, 'c');
+    test_timer_arm(&a, 100 * TIMER_TICK_MS);
+    test_timer_arm(&b, 5000 * TIMER_TICK_MS);
+    test_timer_arm(&c, 300000 * TIMER_TICK_MS);
+    timerwheel_advance(99);
+    CHECK(a.fired == 0);
+    timerwheel_advance(1);
+    CHECK(a.fired == 1);
+    timerwheel_advance(4899);
+    CHECK(b.fired == 0);
+    timerwheel_advance(1);
+    CHECK(b.fired == 1);
+    timerwheel_advance(294999);
+    CHECK(c.fired == 0);
+    timerwheel_advance(1);
+    CHECK(c.fired == 1);
+
+    // 여러 타이머는 만료 순서대로, 다시 걸면 새 시간으로 옮겨지고, 취소하면 울리지 않는다
+    test_timer_init(&a, 'a');
+    test_timer_init(&b, 'b');
+    test_timer_init(&c, 'c');
+    test_timer_init(&d, 'd');
+    fire_count = 0;
+    memset(fire_order, 0, sizeof(fire_order));
+    test_timer_arm(&a, 70 * TIMER_TICK_MS);
+    test_timer_arm(&b, 5 * TIMER_TICK_MS);
+    test_timer_arm(&c, 200 * TIMER_TICK_MS);
+    test_timer_arm(&d, 10 * TIMER_TICK_MS);
+    test_timer_arm(&c, 30 * TIMER_TICK_MS);
+    timer_cancel(&d.timer);
+    timerwheel_advance(300);
+    CHECK_STR(fire_order, "bca");
+    CHECK(d.fired == 0);
+
+    // 콜백은 자기 타이머를 다시 걸 수 있다
+    test_timer_init(&a, 'a');
+    a.rearm_ms = 20 * TIMER_TICK_MS;
+    test_timer_arm(&a, TIMER_TICK_MS);
+    timerwheel_advance(1);
+    CHECK(a.fired == 1);
+    timerwheel_advance(19);
+    CHECK(a.fired == 1);
+    timerwheel_advance(1);
+    CHECK(a.fired == 2);
+
+    // 콜백이 도는 중의 취소는 콜백이 끝날 때까지 기다렸다가, 콜백이 다시 건 타이머까지 해제한다
+    Sem_init(&entered, 0, 0);
+    Sem_init(&gate, 0, 0);
+    test_timer_init(&a, 'a');
+    a.rearm_ms = TIMER_TICK_MS;
+    a.entered = &entered;
+    a.gate = &gate;
+    test_timer_arm(&a, TIMER_TICK_MS);
+    Pthread_create(&runner, NULL, advance_one, NULL);
+    CHECK(wait_sem(&entered, 2000));
+    Pthread_create(&canceller, NULL, cancel_timer, &a);
+    usleep(50000);
+    CHECK(__atomic_load_n(&a.rearm_ms, __ATOMIC_SEQ_CST) == TIMER_TICK_MS);
+    V(&gate);
+    Pthread_join(runner, NULL);
+    Pthread_join(canceller, NULL);
+    CHECK(a.rearm_ms == -1);
+    a.gate = NULL;
+    timerwheel_advance(10);
+    CHECK(a.fired == 1);
+}
+
+int main(int argc, char **argv)
+{
+    char *filter = argc > 1 ? argv[1] : NULL;
+
+    cache_init();
+    dnscache_init();
+    timerwheel_init_manual();
+    run_test("cache_key", filter, test_cache_key);
+    run_test("cache_not_modified", filter, test_not_modified);
+    run_test("parse_http_date", filter, test_parse_http_date);
+    run_test("cache_send_range", filter, test_range);
+    run_test("makeHTTPheader", filter, test_make_header);
+    run_test("negcache", filter, test_negcache);
+    run_test("dnscache", filter, test_dnscache);
+    run_test("resolver", filter, test_resolver);
+    run_test("connpool", filter, test_connpool);
+    run_test("connect_race", filter, test_connect_race);
+    run_test("timerwheel", filter, test_timerwheel);
+
+    printf("%d checks, %d failed\n", checks, failures);
+    return failures > 0;
+}
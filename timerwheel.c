@@ -0,0 +1,196 @@
+#include "timerwheel.h"
+
+// 계층형 타이밍 휠 (Varghese & Lauck)
+// 레벨마다 WHEEL_SLOTS칸짜리 바퀴가 있고, 만료까지 남은 tick 수에 따라 레벨을 고른다
+// 아래 레벨이 한 바퀴 돌 때마다 위 레벨의 한 칸을 아래로 다시 나눠 담는다(cascade)
+// 등록/변경/취소가 모두 O(1)이라 연결이 10만 개여도 타이머 관리 비용이 작다
+// 만료 콜백은 tick 스레드에서 휠 락을 놓은 채로 불린다
+// 콜백은 자기 타이머를 다시 걸 수 있다 (늦게 확인하는 deadline이 남은 시간만큼 다시 기다릴 때)
+
+#define WHEEL_BITS 6
+#define WHEEL_SLOTS (1 << WHEEL_BITS)
+#define WHEEL_MASK (WHEEL_SLOTS - 1)
+#define WHEEL_LEVELS 4
+// 표현할 수 있는 최대 tick 수, 이보다 긴 타이머는 여기로 잘린다 (10ms tick이면 약 46시간)
+#define WHEEL_MAX_TICKS ((1ULL << (WHEEL_BITS * WHEEL_LEVELS)) - 1)
+
+// 슬롯은 원형 이중 연결 리스트의 머리
+static wheel_timer wheel[WHEEL_LEVELS][WHEEL_SLOTS];
+static unsigned long long current_tick;
+static pthread_mutex_t wheel_mutex = PTHREAD_MUTEX_INITIALIZER;
+// 콜백이 돌고 있는 타이머, 이 타이머를 취소하거나 다시 거는 쪽은 콜백이 끝날 때까지 기다린다
+// (콜백이 끝나기 전에 타이머를 가진 구조체가 사라지지 않도록)
+static wheel_timer *running;
+static pthread_cond_t running_done = PTHREAD_COND_INITIALIZER;
+static pthread_t wheel_tid; // 콜백을 부르는 tick 스레드
+
+static void list_add(wheel_timer *head, wheel_timer *t)
+{
+    t->prev = head->prev;
+    t->next = head;
+    head->prev->next = t;
+    head->prev = t;
+}
+
+static void list_del(wheel_timer *t)
+{
+    t->prev->next = t->next;
+    t->next->prev = t->prev;
+    t->next = t->prev = NULL;
+}
+
+// 남은 tick 수로 레벨을, 만료 tick의 해당 자릿수로 슬롯을 고른다
+static void wheel_insert(wheel_timer *t)
+{
+    unsigned long long delta = t->expire - current_tick;
+    int level = 0;
+    while (level < WHEEL_LEVELS - 1 && delta >= (1ULL << (WHEEL_BITS * (level + 1))))
+        level = level + 1;
+    list_add(&wheel[level][(t->expire >> (WHEEL_BITS * level)) & WHEEL_MASK], t);
+}
+
+// level의 현재 슬롯에 있는 타이머들을 다시 넣어서 아래 레벨로 내린다
+static void cascade(int level)
+{
+    wheel_timer *head = &wheel[level][(current_tick >> (WHEEL_BITS * level)) & WHEEL_MASK], *t;
+    while (head->next != head)
+    {
+        t = head->next;
+        list_del(t);
+        wheel_insert(t);
+    }
+}
+
+// tick 하나 진행, wheel_mutex를 잡은 채로 불린다
+static void wheel_tick(void)
+{
+    wheel_timer *head, *t;
+    int level;
+
+    current_tick = current_tick + 1;
+    for (level = 1; level < WHEEL_LEVELS; level = level + 1)
+    {
+        if ((current_tick >> (WHEEL_BITS * (level - 1))) & WHEEL_MASK)
+            break;
+        cascade(level);
+    }
+    head = &wheel[0][current_tick & WHEEL_MASK];
+    // 콜백이 도는 동안 다른 스레드가 이 슬롯의 타이머를 취소할 수 있으니 하나씩 꺼낸다
+    while (head->next != head)
+    {
+        t = head->next;
+        list_del(t);
+        t->active = 0;
+        running = t;
+        pthread_mutex_unlock(&wheel_mutex);
+        t->callback(t->arg);
+        pthread_mutex_lock(&wheel_mutex);
+        running = NULL;
+        pthread_cond_broadcast(&running_done);
+    }
+}
+
+static long long now_ms(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000LL + ts.tv_nsec / 1000000;
+}
+
+// 실제 흐른 시간만큼 tick을 진행한다 (늦게 깨어났다면 밀린 tick을 몰아서 처리)
+static void *wheel_routine(void *vargp)
+{
+    long long start = now_ms(), target;
+    struct timespec ts = {0, TIMER_TICK_MS * 1000000L};
+
+    Pthread_detach(pthread_self());
+    wheel_tid = pthread_self();
+    while (1)
+    {
+        nanosleep(&ts, NULL);
+        target = (now_ms() - start) / TIMER_TICK_MS;
+        pthread_mutex_lock(&wheel_mutex);
+        while ((long long)current_tick < target)
+            wheel_tick();
+        pthread_mutex_unlock(&wheel_mutex);
+    }
+    return NULL;
+}
+
+// 휠만 초기화하고 tick 스레드는 만들지 않는다, 시간은 timerwheel_advance로 직접 진행 (테스트용)
+void timerwheel_init_manual(void)
+{
+    int level, slot;
+    for (level = 0; level < WHEEL_LEVELS; level = level + 1)
+    {
+        for (slot = 0; slot < WHEEL_SLOTS; slot = slot + 1)
+            wheel[level][slot].next = wheel[level][slot].prev = &wheel[level][slot];
+    }
+}
+
+void timerwheel_init(void)
+{
+    pthread_t tid;
+    timerwheel_init_manual();
+    Pthread_create(&tid, NULL, wheel_routine, NULL);
+}
+
+// tick을 ticks번 진행한다, 만료된 콜백은 부른 스레드에서 돈다
+// timerwheel_init_manual로 초기화한 휠에서만 쓴다 (tick 스레드와 같이 돌리면 시간이 두 번 간다)
+void timerwheel_advance(int ticks)
+{
+    pthread_mutex_lock(&wheel_mutex);
+    wheel_tid = pthread_self();
+    while (ticks > 0)
+    {
+        wheel_tick();
+        ticks = ticks - 1;
+    }
+    pthread_mutex_unlock(&wheel_mutex);
+}
+
+void timer_init(wheel_timer *t)
+{
+    memset(t, 0, sizeof(*t));
+}
+
+// 콜백 안에서 자기 타이머를 다시 거는 경우는 기다리지 않는다 (자기 자신을 기다리게 되니)
+static void wait_not_running(wheel_timer *t)
+{
+    while (running == t && !pthread_equal(pthread_self(), wheel_tid))
+        pthread_cond_wait(&running_done, &wheel_mutex);
+}
+
+// ms 뒤에 callback(arg)이 불리도록 건다, 이미 걸려 있다면 새 시간으로 옮긴다
+// 콜백 안에서 자기 타이머를 다시 걸 수 있다, 다른 타이머를 건드리는 것은 안 된다
+void timer_arm(wheel_timer *t, int ms, void (*callback)(void *arg), void *arg)
+{
+    unsigned long long ticks = (ms + TIMER_TICK_MS - 1) / TIMER_TICK_MS;
+    if (ticks == 0)
+        ticks = 1;
+    if (ticks > WHEEL_MAX_TICKS)
+        ticks = WHEEL_MAX_TICKS;
+    pthread_mutex_lock(&wheel_mutex);
+    wait_not_running(t);
+    if (t->active)
+        list_del(t);
+    t->callback = callback;
+    t->arg = arg;
+    t->expire = current_tick + ticks;
+    t->active = 1;
+    wheel_insert(t);
+    pthread_mutex_unlock(&wheel_mutex);
+}
+
+// 타이머를 해제한다, 콜백이 돌고 있었다면 끝날 때까지 기다린 뒤 리턴
+void timer_cancel(wheel_timer *t)
+{
+    pthread_mutex_lock(&wheel_mutex);
+    wait_not_running(t);
+    if (t->active)
+    {
+        list_del(t);
+        t->active = 0;
+    }
+    pthread_mutex_unlock(&wheel_mutex);
+}
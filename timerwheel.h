@@ -0,0 +1,29 @@
+#ifndef __TIMERWHEEL_H__
+#define __TIMERWHEEL_H__
+
+#include "csapp.h"
+
+// tick 하나의 길이, 타이머는 이 단위로 올림해서 만료된다
+#ifndef TIMER_TICK_MS
+#define TIMER_TICK_MS 10
+#endif
+
+// 타이머 하나, 사용하는 쪽의 구조체 안에 넣어두고 쓴다 (할당 없음)
+// 처음 쓰기 전에 timer_init으로 초기화
+typedef struct wheel_timer
+{
+    struct wheel_timer *next, *prev;
+    unsigned long long expire; // 만료 tick
+    void (*callback)(void *arg);
+    void *arg;
+    int active;
+} wheel_timer;
+
+void timerwheel_init(void);
+void timerwheel_init_manual(void);
+void timerwheel_advance(int ticks);
+void timer_init(wheel_timer *t);
+void timer_arm(wheel_timer *t, int ms, void (*callback)(void *arg), void *arg);
+void timer_cancel(wheel_timer *t);
+
+#endif /* __TIMERWHEEL_H__ */